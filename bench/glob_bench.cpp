@@ -0,0 +1,155 @@
+/* Filename pattern matching microbenchmark: backtracking 'Matcher' rebuilt for every entry
+ * against 'glob_pattern' compiled once per pattern.
+ * Usage : glob_bench [entries number] (default 100000)
+ * Directory with given number of empty files is created in /tmp and removed afterwards.
+ * Names are read once, so that only matching time is measured. */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../matcher.h"
+#include "../glob_pattern.h"
+
+/* Creates test directory. Every tenth name is long and nearly matches "*a*a*a*b" */
+static std::string create_test_dir(long entries_num)
+{
+  char dir_name[] = "/tmp/glob_bench.XXXXXX";
+  if (mkdtemp(dir_name) == nullptr)
+  {
+    perror("mkdtemp");
+    exit(EXIT_FAILURE);
+  }
+
+  std::string long_name(200, 'a');
+  for (long i = 0; i < entries_num; i++)
+  {
+    std::string name = std::string(dir_name) + "/";
+    if (i % 10 == 0)
+    {
+      name += long_name + std::to_string(i);
+    }
+    else
+    {
+      name += "file_" + std::to_string(i) + ((i % 3 == 0) ? ".txt" : ".log");
+    }
+
+    int fd = open(name.c_str(), O_CREAT | O_WRONLY, 0644);
+    if (fd == -1)
+    {
+      perror("open");
+      exit(EXIT_FAILURE);
+    }
+    close(fd);
+  }
+
+  return dir_name;
+}
+
+/* Reads all directory entry names */
+static std::vector<std::string> read_names(const std::string &dir_name)
+{
+  std::vector<std::string> names;
+  DIR *dir = opendir(dir_name.c_str());
+
+  for (dirent *d = readdir(dir); d != nullptr; d = readdir(dir))
+  {
+    if (d->d_name[0] != '.')
+    {
+      names.emplace_back(d->d_name);
+    }
+  }
+  closedir(dir);
+
+  return names;
+}
+
+/* Removes test directory with its content */
+static void remove_test_dir(const std::string &dir_name, const std::vector<std::string> &names)
+{
+  for (const auto &name : names)
+  {
+    unlink((dir_name + "/" + name).c_str());
+  }
+  rmdir(dir_name.c_str());
+}
+
+/* Returns milliseconds spent by 'func' and number of matched names written to 'matched' */
+template <typename Func>
+static double measure(Func func, long &matched)
+{
+  auto start = std::chrono::steady_clock::now();
+  matched = func();
+  auto stop = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  long entries_num = (argc > 1) ? atol(argv[1]) : 100000;
+  std::string dir_name = create_test_dir(entries_num);
+  std::vector<std::string> names = read_names(dir_name);
+
+  // 'Matcher' supports only '*' and '?', class patterns are measured for 'glob_pattern' only
+  const struct { const char *pattern; bool matcher_supported; } patterns[] = {
+    {"*.txt",              true},
+    {"file_1*9.log",       true},
+    {"f?le_*",             true},
+    {"*a*a*a*b",           true},
+    {"*a*a*a*a*a*a*a*a*b", true},
+    {"file_[0-4]*.[!l]*",  false},
+  };
+
+  printf("%zu entries\n", names.size());
+  printf("%-22s %12s %10s %12s %10s\n", "pattern", "Matcher, ms", "matched", "glob, ms", "matched");
+
+  for (const auto &p : patterns)
+  {
+    long matcher_matched = 0, glob_matched = 0;
+    double matcher_ms = 0;
+
+    if (p.matcher_supported)
+    {
+      matcher_ms = measure([&]()
+                           {
+                             long count = 0;
+                             for (const auto &name : names)
+                             {
+                               Matcher m(name.c_str(), p.pattern);
+                               count += m.match();
+                             }
+                             return count;
+                           }, matcher_matched);
+    }
+
+    double glob_ms = measure([&]()
+                             {
+                               long count = 0;
+                               glob_pattern pattern(p.pattern);
+                               for (const auto &name : names)
+                               {
+                                 count += pattern.match(name.c_str(), name.size());
+                               }
+                               return count;
+                             }, glob_matched);
+
+    if (p.matcher_supported)
+    {
+      printf("%-22s %12.2f %10ld %12.2f %10ld\n", p.pattern, matcher_ms, matcher_matched, glob_ms, glob_matched);
+    }
+    else
+    {
+      printf("%-22s %12s %10s %12.2f %10ld\n", p.pattern, "-", "-", glob_ms, glob_matched);
+    }
+  }
+
+  remove_test_dir(dir_name, names);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/* Builtin-to-builtin pipeline throughput: stages on threads connected by 'spsc_ring'
+ * against the same stages connected by kernel pipes.
+ * Usage : pipe_bench [megabytes] (default 4096)
+ * Pipeline is "producer | cat | ... | consumer" with 0 and 2 'cat' builtins in the middle.
+ * Producer writes 64 KiB chunks, consumer reads everything and counts bytes. */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../builtin_commands.h"
+#include "../fd_stream.h"
+#include "../spsc_ring.h"
+
+#define CHUNK_SIZE (1 << 16)
+
+/* Pipeline edge: ring or pipe */
+struct edge
+{
+  std::shared_ptr<spsc_ring> ring;
+  std::array<int, 2> pipe{-1, -1};
+};
+
+/* Returns output stream of the edge */
+static std::unique_ptr<std::ostream> open_output(edge &e)
+{
+  if (e.ring != nullptr)
+  {
+    return std::make_unique<ring_ostream>(*e.ring);
+  }
+  return std::make_unique<fd_ostream>(e.pipe[1]);
+}
+
+/* Returns input stream of the edge */
+static std::unique_ptr<std::istream> open_input(edge &e)
+{
+  if (e.ring != nullptr)
+  {
+    return std::make_unique<ring_istream>(*e.ring);
+  }
+  return std::make_unique<fd_istream>(e.pipe[0]);
+}
+
+/* Closes write end of the edge */
+static void close_output(edge &e)
+{
+  if (e.ring != nullptr) { e.ring->close_write(); }
+  else                   { close(e.pipe[1]);      }
+}
+
+/* Closes read end of the edge */
+static void close_input(edge &e)
+{
+  if (e.ring != nullptr) { e.ring->close_read(); }
+  else                   { close(e.pipe[0]);     }
+}
+
+/* Runs pipeline of 'cats_num' cat builtins and returns throughput in GB/s */
+static double run_pipeline(bool use_ring, int cats_num, size_t total_size)
+{
+  std::vector<edge> edges(cats_num + 1);
+  for (auto &e : edges)
+  {
+    if (use_ring)
+    {
+      e.ring = std::make_shared<spsc_ring>();
+    }
+    else if (pipe2(e.pipe.data(), O_CLOEXEC) != 0)
+    {
+      perror("pipe2");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  flat_argv cat_args;
+  cat_args.push_back("cat");
+  size_t received = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+
+  threads.emplace_back([&]()
+                       {
+                         std::vector<char> chunk(CHUNK_SIZE, 'x');
+                         {
+                           auto os = open_output(edges.front());
+                           for (size_t sent = 0; sent < total_size && os->good(); sent += CHUNK_SIZE)
+                           {
+                             os->write(chunk.data(), CHUNK_SIZE);
+                           }
+                         }
+                         close_output(edges.front());
+                       });
+
+  for (int i = 0; i < cats_num; i++)
+  {
+    threads.emplace_back([&, i]()
+                         {
+                           {
+                             auto is = open_input(edges[i]);
+                             auto os = open_output(edges[i + 1]);
+                             builtin_commands::exec_cat(cat_args, *is, *os);
+                           }
+                           close_input(edges[i]);
+                           close_output(edges[i + 1]);
+                         });
+  }
+
+  threads.emplace_back([&]()
+                       {
+                         std::vector<char> chunk(CHUNK_SIZE);
+                         {
+                           auto is = open_input(edges.back());
+                           std::streamsize size;
+                           while ((size = is->rdbuf()->sgetn(chunk.data(), CHUNK_SIZE)) > 0)
+                           {
+                             received += size;
+                           }
+                         }
+                         close_input(edges.back());
+                       });
+
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  auto stop = std::chrono::steady_clock::now();
+
+  if (received != total_size)
+  {
+    fprintf(stderr, "received %zu bytes of %zu\n", received, total_size);
+    exit(EXIT_FAILURE);
+  }
+
+  return (double)total_size / 1e9 / std::chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  size_t total_size = (size_t)((argc > 1) ? atol(argv[1]) : 4096) << 20;
+
+  printf("%zu MiB through every pipeline\n", total_size >> 20);
+  printf("%-36s %12s %12s\n", "pipeline", "pipe, GB/s", "ring, GB/s");
+
+  for (int cats_num : {0, 2})
+  {
+    double pipe_speed = run_pipeline(false, cats_num, total_size),
+           ring_speed = run_pipeline(true, cats_num, total_size);
+
+    std::string name = "producer |";
+    for (int i = 0; i < cats_num; i++)
+    {
+      name += " cat |";
+    }
+    name += " consumer";
+
+    printf("%-36s %12.2f %12.2f\n", name.c_str(), pipe_speed, ring_speed);
+  }
+
+  return EXIT_SUCCESS;
+}
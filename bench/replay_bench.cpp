@@ -0,0 +1,356 @@
+/* Replays recorded command lines through shell instances and checks them for leaks.
+ * Usage : replay_bench [-j shells] [-r passes] workload_file
+ *   -j - number of concurrent shell processes (default 4), each of them replays the whole workload
+ *   -r - number of passes over the workload in every shell (default 10)
+ * Workload is a file of command lines as 'microsha script' takes them: empty lines and '#' lines are skipped.
+ * Every shell is a forked process with its own 'Microsha' object, its standard output and error go to /dev/null,
+ * and it starts from its own line of the workload, so that shells do not run the same line at once.
+ * Reported: throughput, per-line latency percentiles, processes created for pipeline stages, descriptor numbers
+ * (sampled every millisecond) and leaks - descriptors kept after the first pass and children which are left
+ * running or unreaped after 'wait'. Exit status is 1 if there is a leak, so it can be used as regression gate. */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../microsha.h"
+
+#define FD_SAMPLE_PERIOD_MS 1
+
+/* Results of one shell, sent to the harness through a pipe */
+struct shell_result
+{
+  size_t lines = 0;            // executed lines
+  size_t forks = 0, spawns = 0;
+  int start_fds = 0;           // descriptors before the first line
+  int base_fds = 0;            // descriptors after the first pass (caches and log are open by then)
+  int end_fds = 0;             // descriptors after the last pass
+  int peak_fds = 0;
+  int live_children = 0;       // children running after the final 'wait'
+  int zombie_children = 0;     // children finished but not reaped after the final 'wait'
+};
+
+/* Returns number of open descriptors of the process */
+static int count_fds()
+{
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir == nullptr)
+  {
+    return -1;
+  }
+
+  int count = 0;
+  for (dirent *d = readdir(dir); d != nullptr; d = readdir(dir))
+  {
+    count += (d->d_name[0] != '.');
+  }
+  closedir(dir);
+
+  return count - 1; // descriptor of the directory itself
+}
+
+/* Counts children of the process: running ones and zombies */
+static void count_children(int &live, int &zombies)
+{
+  live = zombies = 0;
+  DIR *dir = opendir("/proc");
+  if (dir == nullptr)
+  {
+    return;
+  }
+
+  pid_t self = getpid();
+  for (dirent *d = readdir(dir); d != nullptr; d = readdir(dir))
+  {
+    if (d->d_name[0] < '0' || d->d_name[0] > '9')
+    {
+      continue;
+    }
+
+    char path[64], stat[512];
+    snprintf(path, sizeof(path), "/proc/%s/stat", d->d_name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      continue;
+    }
+    ssize_t size = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (size <= 0)
+    {
+      continue;
+    }
+    stat[size] = '\0';
+
+    // "pid (comm) state ppid ...", command name may contain spaces and parentheses
+    const char *fields = strrchr(stat, ')');
+    char state = 0;
+    int ppid = 0;
+    if (fields != nullptr && sscanf(fields + 1, " %c %d", &state, &ppid) == 2 && ppid == self)
+    {
+      (state == 'Z' ? zombies : live)++;
+    }
+  }
+  closedir(dir);
+}
+
+/* Reads workload lines */
+static std::vector<std::string> read_workload(const char *file_name)
+{
+  std::vector<std::string> lines;
+  std::ifstream file(file_name);
+  std::string line;
+
+  while (std::getline(file, line))
+  {
+    if (!line.empty() && line[0] != '#')
+    {
+      lines.push_back(line);
+    }
+  }
+
+  return lines;
+}
+
+/* Writes all bytes to descriptor */
+static void write_all(int fd, const void *data, size_t size)
+{
+  auto bytes = (const char *)data;
+  while (size > 0)
+  {
+    ssize_t written = write(fd, bytes, size);
+    if (written <= 0)
+    {
+      return;
+    }
+    bytes += written;
+    size -= written;
+  }
+}
+
+/* Reads all bytes from descriptor. Returns false if input ended earlier */
+static bool read_all(int fd, void *data, size_t size)
+{
+  auto bytes = (char *)data;
+  while (size > 0)
+  {
+    ssize_t got = read(fd, bytes, size);
+    if (got <= 0)
+    {
+      return false;
+    }
+    bytes += got;
+    size -= got;
+  }
+  return true;
+}
+
+/* Shell process: replays workload 'passes' times starting from line 'first',
+ * writes result and line latencies in nanoseconds to 'out_fd' */
+static void run_shell(const std::vector<std::string> &lines, int passes, size_t first, int out_fd)
+{
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  dup2(null_fd, STDOUT_FILENO);
+  dup2(null_fd, STDERR_FILENO);
+  close(null_fd);
+
+  shell_result result;
+  std::vector<uint64_t> latencies;
+  latencies.reserve(lines.size() * passes);
+
+  Microsha shell;
+  result.start_fds = result.base_fds = count_fds();
+
+  std::atomic<bool> is_done{false};
+  std::atomic<int> peak_fds{result.start_fds};
+  std::thread sampler([&]()
+                      {
+                        while (!is_done.load(std::memory_order_relaxed))
+                        {
+                          // sampler's own directory descriptor is not counted by 'count_fds'
+                          peak_fds.store(std::max(peak_fds.load(std::memory_order_relaxed), count_fds()), std::memory_order_relaxed);
+                          std::this_thread::sleep_for(std::chrono::milliseconds(FD_SAMPLE_PERIOD_MS));
+                        }
+                      });
+
+  for (int pass = 0; pass < passes; pass++)
+  {
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      const std::string &line = lines[(first + i) % lines.size()];
+
+      auto start = std::chrono::steady_clock::now();
+      shell.RunCommand(line);
+      auto stop = std::chrono::steady_clock::now();
+      latencies.push_back((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+    }
+
+    if (pass == 0)
+    {
+      result.base_fds = count_fds();
+    }
+  }
+
+  is_done.store(true);
+  sampler.join();
+
+  result.end_fds = count_fds();
+  result.peak_fds = peak_fds.load();
+  result.lines = latencies.size();
+  result.forks = shell.GetProcessCounts().forks;
+  result.spawns = shell.GetProcessCounts().spawns;
+
+  // background jobs of the workload are waited for, children left after that are leaked
+  shell.RunCommand("wait");
+  count_children(result.live_children, result.zombie_children);
+
+  write_all(out_fd, &result, sizeof(result));
+  write_all(out_fd, latencies.data(), latencies.size() * sizeof(uint64_t));
+}
+
+/* Returns percentile 'p' of sorted values */
+static double get_percentile(const std::vector<uint64_t> &sorted, double p)
+{
+  size_t index = (size_t)std::ceil(p * sorted.size());
+  return (double)sorted[std::min(index == 0 ? 0 : index - 1, sorted.size() - 1)];
+}
+
+int main(int argc, char *argv[])
+{
+  int shells = 4, passes = 10, opt;
+
+  while ((opt = getopt(argc, argv, "j:r:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j':
+        shells = atoi(optarg);
+        break;
+
+      case 'r':
+        passes = atoi(optarg);
+        break;
+
+      default:
+        shells = 0;
+        break;
+    }
+  }
+
+  if (optind + 1 != argc || shells <= 0 || passes <= 0)
+  {
+    fprintf(stderr, "Usage : %s [-j shells] [-r passes] workload_file\n", argv[0]);
+    return EXIT_SYNTAX_ERROR;
+  }
+
+  std::vector<std::string> lines = read_workload(argv[optind]);
+  if (lines.empty())
+  {
+    fprintf(stderr, "%s: no command lines\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  // every shell sends its results through own pipe
+  std::vector<std::pair<pid_t, int>> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < shells; i++)
+  {
+    int result_pipe[2];
+    if (pipe2(result_pipe, O_CLOEXEC) != 0)
+    {
+      perror("pipe2");
+      return EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+      perror("fork");
+      return EXIT_FAILURE;
+    }
+    if (pid == 0)
+    {
+      close(result_pipe[0]);
+      run_shell(lines, passes, lines.size() * i / shells, result_pipe[1]);
+      exit(EXIT_SUCCESS); // shell log is written at exit
+    }
+
+    close(result_pipe[1]);
+    workers.emplace_back(pid, result_pipe[0]);
+  }
+
+  std::vector<shell_result> results;
+  std::vector<uint64_t> latencies;
+  for (auto [pid, fd] : workers)
+  {
+    shell_result result;
+    if (read_all(fd, &result, sizeof(result)))
+    {
+      size_t old_size = latencies.size();
+      latencies.resize(old_size + result.lines);
+      if (read_all(fd, latencies.data() + old_size, result.lines * sizeof(uint64_t)))
+      {
+        results.push_back(result);
+      }
+      else
+      {
+        latencies.resize(old_size);
+      }
+    }
+    close(fd);
+    waitpid(pid, nullptr, 0);
+  }
+  auto stop = std::chrono::steady_clock::now();
+
+  if (results.size() != workers.size())
+  {
+    fprintf(stderr, "%zu of %zu shells did not report results\n", workers.size() - results.size(), workers.size());
+    return EXIT_FAILURE;
+  }
+
+  // summary over all shells
+  double seconds = std::chrono::duration<double>(stop - start).count();
+  std::sort(latencies.begin(), latencies.end());
+
+  size_t forks = 0, spawns = 0;
+  int start_fds = 0, base_fds = 0, end_fds = 0, peak_fds = 0, fd_growth = 0, live = 0, zombies = 0;
+  for (const auto &result : results)
+  {
+    forks += result.forks;
+    spawns += result.spawns;
+    start_fds = std::max(start_fds, result.start_fds);
+    base_fds = std::max(base_fds, result.base_fds);
+    end_fds = std::max(end_fds, result.end_fds);
+    peak_fds = std::max(peak_fds, result.peak_fds);
+    fd_growth = std::max(fd_growth, result.end_fds - result.base_fds);
+    live += result.live_children;
+    zombies += result.zombie_children;
+  }
+
+  printf("workload    : %zu lines x %d passes x %d shells = %zu lines\n", lines.size(), passes, shells, latencies.size());
+  printf("time        : %.3f s\n", seconds);
+  printf("throughput  : %.1f lines/s\n", (double)latencies.size() / seconds);
+  printf("latency, ms : p50 %.3f   p99 %.3f   p999 %.3f   max %.3f\n", get_percentile(latencies, 0.5) * 1e-6,
+         get_percentile(latencies, 0.99) * 1e-6, get_percentile(latencies, 0.999) * 1e-6, (double)latencies.back() * 1e-6);
+  printf("processes   : %zu forks, %zu posix_spawns (%.2f per line)\n", forks, spawns,
+         (double)(forks + spawns) / (double)latencies.size());
+  printf("descriptors : %d at start, %d after first pass, %d at end, %d peak (maximum over shells)\n",
+         start_fds, base_fds, end_fds, peak_fds);
+  printf("leaks       : %d descriptors, %d running children, %d zombies\n", std::max(fd_growth, 0), live, zombies);
+
+  return (fd_growth > 0 || live > 0 || zombies > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/* Hot paths of the shell: median and 99th percentile latency of
+ * - 'split_string_by_token' on a path;
+ * - command line parsing: 'command_lexer::tokenize' and 'command::parse_command' of every pipeline command;
+ * - 'Matcher::match' and 'glob_pattern::match' on one name;
+ * - 'command::expand_path_regex' on a synthetic directory tree (directory listing cache is warm after the first run);
+ * - end-to-end 'command_pipeline::exec' of "/bin/true | ... | /bin/true" pipelines of 1 to 64 commands
+ *   with posix_spawn and fork backends, and of the same pipelines of 'true' builtins on threads.
+ * Usage : shell_bench [samples] (default 1000; pipelines take samples / 10 runs)
+ * Fast operations are repeated in batches, a sample is the mean time of a batch. */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../matcher.h"
+#include "../command_pipeline.h"
+
+#define TREE_DIRS 10   // directories on each of two levels
+#define TREE_FILES 100 // files in every leaf directory
+
+static volatile size_t sink; // results are written here, so that the compiler keeps measured calls
+
+/* Runs 'func' 'batch' times for every sample and prints median and 99th percentile of one run */
+static void report(const char *name, int samples, int batch, const std::function<void()> &func)
+{
+  std::vector<double> times(samples);
+
+  func(); // warm up
+  for (auto &time : times)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < batch; i++)
+    {
+      func();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    time = std::chrono::duration<double, std::micro>(stop - start).count() / batch;
+  }
+
+  std::sort(times.begin(), times.end());
+  size_t p99 = (size_t)std::ceil(0.99 * samples) - 1;
+  printf("%-44s %12.3f %12.3f\n", name, times[samples / 2], times[std::min(p99, times.size() - 1)]);
+}
+
+/* Creates directory tree "d<i>/d<j>/f<k>.txt|log" in a temporary directory and returns its path */
+static std::string create_tree()
+{
+  char root[] = "/tmp/shell_bench.XXXXXX";
+  if (mkdtemp(root) == nullptr)
+  {
+    perror("mkdtemp");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < TREE_DIRS; i++)
+  {
+    std::string dir = std::string(root) + "/d" + std::to_string(i);
+    mkdir(dir.c_str(), 0755);
+    for (int j = 0; j < TREE_DIRS; j++)
+    {
+      std::string sub_dir = dir + "/d" + std::to_string(j);
+      mkdir(sub_dir.c_str(), 0755);
+      for (int k = 0; k < TREE_FILES; k++)
+      {
+        std::string file = sub_dir + "/f" + std::to_string(k) + ((k % 2 == 0) ? ".txt" : ".log");
+        close(open(file.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644));
+      }
+    }
+  }
+
+  return root;
+}
+
+/* Removes the tree made by 'create_tree' */
+static void remove_tree(const std::string &root)
+{
+  for (int i = 0; i < TREE_DIRS; i++)
+  {
+    std::string dir = root + "/d" + std::to_string(i);
+    for (int j = 0; j < TREE_DIRS; j++)
+    {
+      std::string sub_dir = dir + "/d" + std::to_string(j);
+      for (int k = 0; k < TREE_FILES; k++)
+      {
+        unlink((sub_dir + "/f" + std::to_string(k) + ((k % 2 == 0) ? ".txt" : ".log")).c_str());
+      }
+      rmdir(sub_dir.c_str());
+    }
+    rmdir(dir.c_str());
+  }
+  rmdir(root.c_str());
+}
+
+/* Parses command line into pipeline commands as 'command_pipeline::reset_pipeline' does without the cache */
+static size_t parse_line(const std::string &line)
+{
+  std::pmr::monotonic_buffer_resource arena;
+  std::pmr::vector<token> tokens(&arena);
+  std::pmr::vector<command> commands(&arena);
+
+  command_lexer::tokenize(line, tokens);
+  size_t begin = 0;
+  for (size_t i = 0; i <= tokens.size(); i++)
+  {
+    if (i == tokens.size() || tokens[i].kind == TOKEN_PIPE)
+    {
+      ERR_CODE err_code = SUCCESS;
+      commands.emplace_back(tokens.data() + begin, tokens.data() + i, 0, err_code, &arena);
+      begin = i + 1;
+    }
+  }
+  return commands.size();
+}
+
+/* Returns pipeline of 'length' copies of 'cmd' */
+static std::string make_pipeline(const char *cmd, int length)
+{
+  std::string line = cmd;
+  for (int i = 1; i < length; i++)
+  {
+    line += std::string(" | ") + cmd;
+  }
+  return line;
+}
+
+int main(int argc, char *argv[])
+{
+  int samples = (argc > 1) ? atoi(argv[1]) : 1000;
+  if (samples <= 0)
+  {
+    fprintf(stderr, "Usage : %s [samples]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%-44s %12s %12s\n", "operation", "median, us", "p99, us");
+
+  // string splitting
+  std::string path = "/usr/local/share/microsha/examples/scripts/run.msh";
+  report("split_string_by_token (8 components)", samples, 100, [&]()
+         {
+           std::vector<std::string> words;
+           split_string_by_token(path, '/', words);
+           sink = words.size();
+         });
+
+  // command line parsing
+  report("parse: ls -la /usr/bin", samples, 100, [&]() { sink = parse_line("ls -la /usr/bin"); });
+  report("parse: 4 commands, quotes, redirections", samples, 100, [&]()
+         {
+           sink = parse_line("cat < in.txt | grep -v \"a b\" | cut -d: -f2 | sort 'x y' > out.txt");
+         });
+
+  // name matching
+  std::string long_name(200, 'a');
+  report("Matcher::match *.txt", samples, 1000, [&]() { sink = Matcher("file_123.txt", "*.txt").match(); });
+  report("Matcher::match *a*a*a*b (200 chars)", samples, 10, [&]() { sink = Matcher(long_name.c_str(), "*a*a*a*b").match(); });
+  glob_pattern txt_pattern("*.txt"), long_pattern("*a*a*a*b");
+  report("glob_pattern::match *.txt", samples, 1000, [&]() { sink = txt_pattern.match("file_123.txt"); });
+  report("glob_pattern::match *a*a*a*b (200 chars)", samples, 10, [&]() { sink = long_pattern.match(long_name.c_str()); });
+
+  // pathname expansion
+  std::string root = create_tree();
+  for (const char *pattern : {"/d3/d5/f1*.txt", "/d*/d1/f7?.log", "/d*/d*/f99.txt", "/*/*/*.txt"})
+  {
+    std::string name = std::string("expand ") + pattern + " (" + std::to_string(command::expand_path_regex(root + pattern).size()) + ")";
+    report(name.c_str(), std::max(samples / 10, 1), 1, [&]() { sink = command::expand_path_regex(root + pattern).size(); });
+  }
+  remove_tree(root);
+
+  // end-to-end pipeline execution
+  command_pipeline pipeline;
+  for (auto [backend, cmd, label] : {std::tuple(SPAWN_POSIX, "/bin/true", "posix_spawn"),
+                                     std::tuple(SPAWN_FORK,  "/bin/true", "fork"),
+                                     std::tuple(SPAWN_POSIX, "true",      "builtin threads")})
+  {
+    pipeline.set_backend(backend);
+    for (int length = 1; length <= 64; length *= 2)
+    {
+      std::string line = make_pipeline(cmd, length), name = std::string("exec ") + label + ", " + std::to_string(length) + " commands";
+      report(name.c_str(), std::max(samples / 10, 1), 1, [&]()
+             {
+               pipeline.reset_pipeline(line);
+               pipeline.exec();
+             });
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
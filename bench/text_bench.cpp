@@ -0,0 +1,160 @@
+/* Text builtins against external GNU utilities.
+ * Usage : text_bench [megabytes] (default 256)
+ * Every command reads a generated file redirected to its input ('cmd < file') and writes to a file
+ * (not /dev/null: GNU grep stops at the first match when output is discarded).
+ * External utility is spawned and waited for; builtin runs in the process with every kernel set.
+ * Large input shows scanning speed, small input (4 KiB, 200 runs) shows the cost of short-lived processes. */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../text_builtins.h"
+
+#define SMALL_SIZE (4 << 10)
+#define SMALL_RUNS 200
+#define OUTPUT_FILE "/tmp/text_bench_output.txt"
+
+extern char **environ;
+
+/* Benchmarked command */
+struct bench_command
+{
+  std::vector<std::string> args;
+  int (*exec)(const flat_argv &, std::istream &, std::ostream &);
+};
+
+/* Writes file of 'size' bytes of lines with words and ':' separated fields */
+static void generate_file(const char *file_name, size_t size)
+{
+  static const char *words[] = {"alpha", "beta", "gamma", "delta", "error", "warning", "info", "microsha"};
+  std::mt19937 rng(1);
+  std::string data;
+
+  while (data.size() < size)
+  {
+    int fields = 2 + (int)(rng() % 6);
+    for (int i = 0; i < fields; i++)
+    {
+      data += words[rng() % 8];
+      data += (i + 1 < fields) ? ((rng() % 2) ? ':' : ' ') : '\n';
+    }
+  }
+
+  FILE *file = fopen(file_name, "w");
+  fwrite(data.data(), 1, data.size(), file);
+  fclose(file);
+}
+
+/* Runs external utility with input file and returns time in seconds */
+static double run_external(const bench_command &cmd, const char *file_name, int runs)
+{
+  std::vector<char *> argv;
+  for (const auto &arg : cmd.args)
+  {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, file_name, O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, OUTPUT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+  {
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ) != 0)
+    {
+      perror("posix_spawnp");
+      exit(EXIT_FAILURE);
+    }
+    waitpid(pid, nullptr, 0);
+  }
+  auto stop = std::chrono::steady_clock::now();
+
+  posix_spawn_file_actions_destroy(&actions);
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+/* Runs builtin with input file and returns time in seconds */
+static double run_builtin(const bench_command &cmd, const char *file_name, int runs)
+{
+  flat_argv args;
+  for (const auto &arg : cmd.args)
+  {
+    args.push_back(arg);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+  {
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC),
+        output_fd = open(OUTPUT_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    {
+      fd_istream is(fd);
+      fd_ostream os(output_fd);
+      cmd.exec(args, is, os);
+    }
+    close(fd);
+    close(output_fd);
+  }
+  auto stop = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  size_t large_size = (size_t)((argc > 1) ? atol(argv[1]) : 256) << 20;
+  const char *large_file = "/tmp/text_bench_large.txt", *small_file = "/tmp/text_bench_small.txt";
+  generate_file(large_file, large_size);
+  generate_file(small_file, SMALL_SIZE);
+
+  std::vector<bench_command> commands = {
+    {{"wc", "-l"},               text_builtins::exec_wc},
+    {{"wc"},                     text_builtins::exec_wc},
+    {{"grep", "-c", "error"},    text_builtins::exec_grep},
+    {{"grep", "microsha:info"},  text_builtins::exec_grep},
+    {{"cut", "-d:", "-f2"},      text_builtins::exec_cut},
+    {{"head", "-n", "1000"},     text_builtins::exec_head},
+    {{"tail", "-n", "1000"},     text_builtins::exec_tail},
+  };
+
+  for (auto [file_name, size, runs] : {std::tuple(large_file, large_size, 1),
+                                       std::tuple(small_file, (size_t)SMALL_SIZE, SMALL_RUNS)})
+  {
+    printf("\n%zu KiB input, %d run(s), ms\n", size >> 10, runs);
+    printf("%-26s %10s %10s %10s %10s\n", "command", "external", "avx2", "sse4.2", "scalar");
+
+    for (const auto &cmd : commands)
+    {
+      std::string name;
+      for (const auto &arg : cmd.args)
+      {
+        name += arg + " ";
+      }
+
+      printf("%-26s %10.2f", name.c_str(), run_external(cmd, file_name, runs) * 1e3);
+      for (text_scan_level level : {SCAN_AVX2, SCAN_SSE42, SCAN_SCALAR})
+      {
+        text_scan::set_level(level);
+        printf(" %10.2f", run_builtin(cmd, file_name, runs) * 1e3);
+      }
+      printf("\n");
+    }
+  }
+
+  unlink(large_file);
+  unlink(small_file);
+  unlink(OUTPUT_FILE);
+  return EXIT_SUCCESS;
+}
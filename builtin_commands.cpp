@@ -0,0 +1 @@
+#include "builtin_commands.h"
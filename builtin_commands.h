@@ -0,0 +1,771 @@
+#ifndef MICROSHA_BUILTIN_COMMANDS_H
+#define MICROSHA_BUILTIN_COMMANDS_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+
+#include <string>
+#include <string_view>
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+
+#include "flat_argv.h"
+
+#define EXIT_BUILTIN_USAGE 2
+#define BUILTIN_COPY_CHUNK_SIZE (1 << 16)
+
+/* Builtins executed without a new process: 'echo', 'printf', 'test'/'[', 'exit' and 'cat'.
+ * Input and output are given streams, so they can run in the shell process with redirected
+ * standard streams as well as on a thread reading and writing pipes or rings. Every function returns exit status.
+ * Argument 0 is the command name */
+class builtin_commands
+{
+public:
+  /* 'echo [-neE] [arg ...]' - prints arguments separated by spaces.
+   * -n - no trailing newline, -e - interpret backslash escapes, -E - do not interpret them (default) */
+  static int exec_echo(const flat_argv &args, std::ostream &os)
+  {
+    bool newline = true, escapes = false;
+    size_t i = 1;
+
+    for (; i < args.size() && is_echo_option(args[i]); i++)
+    {
+      for (char c : args[i].substr(1))
+      {
+        newline = newline && c != 'n';
+        escapes = (c == 'e') || (escapes && c != 'E');
+      }
+    }
+
+    for (size_t first = i; i < args.size(); i++)
+    {
+      if (i > first)
+      {
+        os << ' ';
+      }
+
+      if (!escapes)
+      {
+        os << args[i];
+      }
+      else if (!write_escaped(args[i], os, true))
+      {
+        return EXIT_SUCCESS; // '\c' stops output
+      }
+    }
+
+    if (newline)
+    {
+      os << '\n';
+    }
+    return EXIT_SUCCESS;
+  }
+
+  /* 'printf format [arg ...]' - prints arguments by format. Format is reused while arguments remain.
+   * Supported: backslash escapes, '%%' and conversions 'diouxXcsfFeEgGaAb' with flags, width and precision
+   * ('*' takes them from arguments). Missing arguments are treated as empty string or zero */
+  static int exec_printf(const flat_argv &args, std::ostream &os)
+  {
+    if (args.size() < 2)
+    {
+      std::cerr << "printf: usage: printf format [arguments]" << std::endl;
+      return EXIT_BUILTIN_USAGE;
+    }
+
+    std::string_view format = args[1];
+    size_t arg_index = 2;
+    int status = EXIT_SUCCESS;
+
+    do
+    {
+      size_t pass_start = arg_index;
+      bool stop = false;
+
+      for (size_t i = 0; i < format.size() && !stop; i++)
+      {
+        if (format[i] == '\\')
+        {
+          i += write_escape(format, i, os, false, stop) - 1;
+          continue;
+        }
+        if (format[i] != '%')
+        {
+          os << format[i];
+          continue;
+        }
+        if (i + 1 < format.size() && format[i + 1] == '%')
+        {
+          os << '%';
+          i++;
+          continue;
+        }
+
+        if (!write_conversion(args, format, i, arg_index, os, status, stop))
+        {
+          return EXIT_FAILURE;
+        }
+      }
+
+      if (stop || arg_index == pass_start)
+      {
+        break;
+      }
+    } while (arg_index < args.size());
+
+    return status;
+  }
+
+  /* 'test expression' or '[ expression ]' - evaluates expression.
+   * Returns 0 if it is true, 1 if it is false or no expression given, 2 on syntax error.
+   * Operators: '!', '-a', '-o', '( )'; unary file and string tests; string ('=', '==', '!=', '<', '>'),
+   * integer ('-eq', '-ne', '-lt', '-le', '-gt', '-ge') and file ('-nt', '-ot', '-ef') comparisons */
+  static int exec_test(const flat_argv &args)
+  {
+    std::string_view name = args[0];
+    size_t end = args.size();
+
+    if (name == "[")
+    {
+      if (end < 2 || args[end - 1] != "]")
+      {
+        std::cerr << "[: missing ']'" << std::endl;
+        return EXIT_BUILTIN_USAGE;
+      }
+      end--;
+    }
+
+    test_expression expr{args, 1, end, false};
+    if (expr.pos == end)
+    {
+      return EXIT_FAILURE;
+    }
+
+    bool result = test_or(expr);
+    if (!expr.error && expr.pos != end)
+    {
+      std::cerr << name << ": " << args[expr.pos] << ": unexpected argument" << std::endl;
+      expr.error = true;
+    }
+
+    if (expr.error)
+    {
+      return EXIT_BUILTIN_USAGE;
+    }
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  /* 'exit [n]' - returns 'n' truncated to 0..255 or 'default_status' without argument.
+   * Shell finishes with this status unless 'get_exit_permission' says otherwise */
+  static int exec_exit(const flat_argv &args, int default_status)
+  {
+    if (args.size() > 2)
+    {
+      std::cerr << "exit: too many arguments" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (args.size() == 1)
+    {
+      return default_status;
+    }
+
+    char *number_end = nullptr;
+    long status = strtol(args.c_str(1), &number_end, 10);
+    if (args[1].empty() || *number_end != '\0')
+    {
+      std::cerr << "exit: " << args[1] << ": numeric argument required" << std::endl;
+      return EXIT_BUILTIN_USAGE;
+    }
+
+    return (int)(status & 0xFF);
+  }
+
+  /* 'cat [-u] [file ...]' - copies files ('-' or no files - input) to output.
+   * Input is passed on as soon as it arrives, so the builtin does not delay streaming pipelines */
+  static int exec_cat(const flat_argv &args, std::istream &is, std::ostream &os)
+  {
+    int status = EXIT_SUCCESS;
+    bool has_files = false;
+    std::unique_ptr<char[]> chunk(new char[BUILTIN_COPY_CHUNK_SIZE]);
+
+    for (size_t i = 1; i < args.size(); i++)
+    {
+      if (args[i] == "-u")
+      {
+        continue;
+      }
+      has_files = true;
+
+      if (args[i] == "-")
+      {
+        copy_input(is, os, chunk.get());
+      }
+      else if (!copy_file(args.c_str(i), os, chunk.get()))
+      {
+        status = EXIT_FAILURE;
+      }
+    }
+
+    if (!has_files)
+    {
+      copy_input(is, os, chunk.get());
+    }
+
+    os.flush();
+    return os.good() ? status : EXIT_FAILURE;
+  }
+
+  /* Checks if 'cat' builtin supports all given options. Otherwise external 'cat' is to be used */
+  static bool is_cat_supported(const flat_argv &args)
+  {
+    for (size_t i = 1; i < args.size(); i++)
+    {
+      if (args[i].size() > 1 && args[i][0] == '-' && args[i] != "-u")
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /* Checks if 'exit' with given arguments finishes the shell ('exit' with too many arguments does not) */
+  static bool get_exit_permission(const flat_argv &args)
+  {
+    return args.size() <= 2;
+  }
+
+private:
+  /* State of 'test' expression parsing */
+  struct test_expression
+  {
+    const flat_argv &args;
+    size_t pos; // next argument to be read
+    size_t end; // end of expression arguments
+    bool error;
+  };
+
+  /* Reads at most 'size' bytes that are available without waiting for more than one chunk. Returns 0 at EOF */
+  static size_t read_some(std::istream &is, char *buffer, size_t size)
+  {
+    std::streambuf *buf = is.rdbuf();
+    if (std::istream::traits_type::eq_int_type(buf->sgetc(), std::istream::traits_type::eof()))
+    {
+      return 0;
+    }
+
+    return (size_t)buf->sgetn(buffer, std::min<std::streamsize>(buf->in_avail(), (std::streamsize)size));
+  }
+
+  /* Copies input to output chunk by chunk flushing every one */
+  static void copy_input(std::istream &is, std::ostream &os, char *chunk)
+  {
+    size_t size;
+    while (os.good() && (size = read_some(is, chunk, BUILTIN_COPY_CHUNK_SIZE)) > 0)
+    {
+      os.write(chunk, (std::streamsize)size);
+      os.flush();
+    }
+  }
+
+  /* Copies file to output. Prints message and returns false if file can not be read */
+  static bool copy_file(const char *file_name, std::ostream &os, char *chunk)
+  {
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      std::cerr << "cat: " << file_name << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    ssize_t size = 0;
+    while (os.good() && ((size = read(fd, chunk, BUILTIN_COPY_CHUNK_SIZE)) > 0 || (size == -1 && errno == EINTR)))
+    {
+      if (size > 0)
+      {
+        os.write(chunk, size);
+      }
+    }
+
+    bool is_read = (size != -1);
+    if (!is_read)
+    {
+      std::cerr << "cat: " << file_name << ": " << strerror(errno) << std::endl;
+    }
+    close(fd);
+    return is_read;
+  }
+
+  /* Checks if echo argument consists of option letters only */
+  static bool is_echo_option(std::string_view arg)
+  {
+    return arg.size() > 1 && arg[0] == '-' && arg.find_first_not_of("neE", 1) == std::string_view::npos;
+  }
+
+  /* Writes text interpreting backslash escapes. Returns false if '\c' stopped output */
+  static bool write_escaped(std::string_view text, std::ostream &os, bool zero_prefixed_octal)
+  {
+    bool stop = false;
+
+    for (size_t i = 0; i < text.size() && !stop; i++)
+    {
+      if (text[i] == '\\')
+      {
+        i += write_escape(text, i, os, zero_prefixed_octal, stop) - 1;
+      }
+      else
+      {
+        os << text[i];
+      }
+    }
+
+    return !stop;
+  }
+
+  /* Writes character of escape sequence starting with '\' at text[pos].
+   * Octal sequence is '\0nnn' if 'zero_prefixed_octal' ('echo -e', '%b') or '\nnn' otherwise (format).
+   * Returns length of the sequence. 'stop' is set for '\c' */
+  static size_t write_escape(std::string_view text, size_t pos, std::ostream &os, bool zero_prefixed_octal, bool &stop)
+  {
+    if (pos + 1 >= text.size())
+    {
+      os << '\\';
+      return 1;
+    }
+
+    char c = text[pos + 1];
+    switch (c)
+    {
+      case '\\': os << '\\'; return 2;
+      case 'a':  os << '\a'; return 2;
+      case 'b':  os << '\b'; return 2;
+      case 'e':  os << '\x1b'; return 2;
+      case 'f':  os << '\f'; return 2;
+      case 'n':  os << '\n'; return 2;
+      case 'r':  os << '\r'; return 2;
+      case 't':  os << '\t'; return 2;
+      case 'v':  os << '\v'; return 2;
+      case '"':  os << '"';  return 2;
+      case 'c':  stop = true; return 2;
+      default:   break;
+    }
+
+    if (c == 'x')
+    {
+      size_t len = 2;
+      int value = 0;
+      for (; len < 4 && pos + len < text.size() && isxdigit((unsigned char)text[pos + len]); len++)
+      {
+        value = value * 16 + (isdigit((unsigned char)text[pos + len]) ? text[pos + len] - '0'
+                                                                       : tolower(text[pos + len]) - 'a' + 10);
+      }
+      if (len == 2)
+      {
+        os << "\\x";
+        return 2;
+      }
+      os << (char)value;
+      return len;
+    }
+
+    if (c >= '0' && c <= '7' && (!zero_prefixed_octal || c == '0'))
+    {
+      size_t start = zero_prefixed_octal ? 2 : 1,
+             len = start;
+      int value = 0;
+      for (; len < start + 3 && pos + len < text.size() && text[pos + len] >= '0' && text[pos + len] <= '7'; len++)
+      {
+        value = value * 8 + (text[pos + len] - '0');
+      }
+      os << (char)value;
+      return len;
+    }
+
+    os << '\\' << c;
+    return 2;
+  }
+
+  /* Writes one printf conversion starting with '%' at format[pos] and moves 'pos' to its last character.
+   * Invalid number argument sets 'status' to failure. Returns false for invalid conversion */
+  static bool write_conversion(const flat_argv &args, std::string_view format, size_t &pos, size_t &arg_index,
+                               std::ostream &os, int &status, bool &stop)
+  {
+    std::string spec = "%";
+    size_t i = pos + 1;
+
+    auto next_arg = [&args, &arg_index]() -> std::string_view
+    {
+      return (arg_index < args.size()) ? args[arg_index++] : std::string_view();
+    };
+
+    for (; i < format.size() && std::string_view("-+ #0").find(format[i]) != std::string_view::npos; i++)
+    {
+      spec += format[i];
+    }
+
+    // width and precision: digits or '*' taking value from argument
+    for (int part = 0; part < 2; part++)
+    {
+      if (part == 1)
+      {
+        if (i >= format.size() || format[i] != '.')
+        {
+          break;
+        }
+        spec += format[i++];
+      }
+
+      if (i < format.size() && format[i] == '*')
+      {
+        long long value = 0;
+        if (!parse_integer(next_arg(), value))
+        {
+          status = EXIT_FAILURE;
+        }
+        spec += std::to_string(value);
+        i++;
+        continue;
+      }
+      for (; i < format.size() && isdigit((unsigned char)format[i]); i++)
+      {
+        spec += format[i];
+      }
+    }
+
+    if (i >= format.size())
+    {
+      std::cerr << "printf: " << format.substr(pos) << ": invalid directive" << std::endl;
+      return false;
+    }
+
+    char conversion = format[i];
+    pos = i;
+
+    switch (conversion)
+    {
+      case 'd':
+      case 'i':
+      {
+        long long value = 0;
+        if (!parse_integer(next_arg(), value))
+        {
+          status = EXIT_FAILURE;
+        }
+        write_formatted(os, spec + "ll" + conversion, value);
+        return true;
+      }
+
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+      {
+        long long value = 0;
+        if (!parse_integer(next_arg(), value))
+        {
+          status = EXIT_FAILURE;
+        }
+        write_formatted(os, spec + "ll" + conversion, (unsigned long long)value);
+        return true;
+      }
+
+      case 'f': case 'F':
+      case 'e': case 'E':
+      case 'g': case 'G':
+      case 'a': case 'A':
+      {
+        std::string arg(next_arg());
+        char *number_end = nullptr;
+        double value = arg.empty() ? 0 : strtod(arg.c_str(), &number_end);
+        if (!arg.empty() && *number_end != '\0')
+        {
+          std::cerr << "printf: " << arg << ": invalid number" << std::endl;
+          status = EXIT_FAILURE;
+        }
+        write_formatted(os, spec + conversion, value);
+        return true;
+      }
+
+      case 'c':
+      {
+        std::string_view arg = next_arg();
+        write_formatted(os, spec + 'c', arg.empty() ? '\0' : arg[0]);
+        return true;
+      }
+
+      case 's':
+      {
+        std::string arg(next_arg());
+        write_formatted(os, spec + 's', arg.c_str());
+        return true;
+      }
+
+      case 'b':
+      {
+        std::ostringstream expanded;
+        stop = !write_escaped(next_arg(), expanded, true);
+        write_formatted(os, spec + 's', expanded.str().c_str());
+        return true;
+      }
+
+      default:
+        std::cerr << "printf: %" << conversion << ": invalid directive" << std::endl;
+        return false;
+    }
+  }
+
+  /* Writes value formatted by 'printf' specification */
+  template <typename T>
+  static void write_formatted(std::ostream &os, const std::string &spec, T value)
+  {
+    char buffer[128];
+    int size = snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+    if (size < 0)
+    {
+      return;
+    }
+    if ((size_t)size < sizeof(buffer))
+    {
+      os.write(buffer, size);
+      return;
+    }
+
+    std::string large(size + 1, '\0');
+    snprintf(&large[0], large.size(), spec.c_str(), value);
+    os.write(large.data(), size);
+  }
+
+  /* Parses printf integer argument: decimal, octal ('0'), hexadecimal ('0x') number or
+   * character code if argument starts with quote. Prints message and returns false if argument is not a number */
+  static bool parse_integer(std::string_view arg, long long &value)
+  {
+    value = 0;
+    if (arg.empty())
+    {
+      return true;
+    }
+    if (arg[0] == '\'' || arg[0] == '"')
+    {
+      value = (arg.size() > 1) ? (unsigned char)arg[1] : 0;
+      return true;
+    }
+
+    std::string number(arg);
+    char *number_end = nullptr;
+    errno = 0;
+    value = strtoll(number.c_str(), &number_end, 0);
+    if (*number_end != '\0' || errno == ERANGE)
+    {
+      std::cerr << "printf: " << number << ": invalid number" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /* expression: and_expression ('-o' and_expression)* */
+  static bool test_or(test_expression &expr)
+  {
+    bool result = test_and(expr);
+
+    while (!expr.error && expr.pos < expr.end && expr.args[expr.pos] == "-o")
+    {
+      expr.pos++;
+      bool right = test_and(expr);
+      result = result || right;
+    }
+    return result;
+  }
+
+  /* and_expression: not_expression ('-a' not_expression)* */
+  static bool test_and(test_expression &expr)
+  {
+    bool result = test_not(expr);
+
+    while (!expr.error && expr.pos < expr.end && expr.args[expr.pos] == "-a")
+    {
+      expr.pos++;
+      bool right = test_not(expr);
+      result = result && right;
+    }
+    return result;
+  }
+
+  /* not_expression: '!' not_expression | primary. Single '!' is a string */
+  static bool test_not(test_expression &expr)
+  {
+    if (expr.pos + 1 < expr.end && expr.args[expr.pos] == "!")
+    {
+      expr.pos++;
+      return !test_not(expr);
+    }
+    return test_primary(expr);
+  }
+
+  /* primary: string binary_operator string | '(' expression ')' | unary_operator string | string.
+   * Binary comparison is preferred, so operator-like strings can be compared ('[ "(" = "(" ]') */
+  static bool test_primary(test_expression &expr)
+  {
+    const flat_argv &args = expr.args;
+
+    if (expr.pos >= expr.end)
+    {
+      std::cerr << args[0] << ": argument expected" << std::endl;
+      expr.error = true;
+      return false;
+    }
+
+    if (expr.end - expr.pos >= 3 && is_test_binary(args[expr.pos + 1]))
+    {
+      std::string_view left = args[expr.pos], op = args[expr.pos + 1], right = args[expr.pos + 2];
+      expr.pos += 3;
+      return test_binary(expr, left, op, right);
+    }
+
+    if (args[expr.pos] == "(" && expr.end - expr.pos >= 2)
+    {
+      expr.pos++;
+      bool result = test_or(expr);
+      if (!expr.error && (expr.pos >= expr.end || args[expr.pos] != ")"))
+      {
+        std::cerr << args[0] << ": ')' expected" << std::endl;
+        expr.error = true;
+      }
+      expr.pos++;
+      return result;
+    }
+
+    if (expr.end - expr.pos >= 2 && is_test_unary(args[expr.pos]))
+    {
+      std::string op(args[expr.pos]), operand(args[expr.pos + 1]);
+      expr.pos += 2;
+      return test_unary(op[1], operand);
+    }
+
+    return !args[expr.pos++].empty();
+  }
+
+  /* Checks if argument is unary 'test' operator */
+  static bool is_test_unary(std::string_view arg)
+  {
+    return arg.size() == 2 && arg[0] == '-' && std::string_view("bcdefghknprsStuwxzL").find(arg[1]) != std::string_view::npos;
+  }
+
+  /* Checks if argument is binary 'test' operator */
+  static bool is_test_binary(std::string_view arg)
+  {
+    return arg == "=" || arg == "==" || arg == "!=" || arg == "<" || arg == ">" ||
+           arg == "-eq" || arg == "-ne" || arg == "-lt" || arg == "-le" || arg == "-gt" || arg == "-ge" ||
+           arg == "-nt" || arg == "-ot" || arg == "-ef";
+  }
+
+  /* Evaluates unary 'test' operator */
+  static bool test_unary(char op, const std::string &operand)
+  {
+    struct stat st{};
+
+    switch (op)
+    {
+      case 'z': return operand.empty();
+      case 'n': return !operand.empty();
+      case 't': return isatty(atoi(operand.c_str())) == 1;
+      case 'r': return access(operand.c_str(), R_OK) == 0;
+      case 'w': return access(operand.c_str(), W_OK) == 0;
+      case 'x': return access(operand.c_str(), X_OK) == 0;
+      case 'h':
+      case 'L': return lstat(operand.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+      default:  break;
+    }
+
+    if (stat(operand.c_str(), &st) != 0)
+    {
+      return false;
+    }
+
+    switch (op)
+    {
+      case 'e': return true;
+      case 'f': return S_ISREG(st.st_mode);
+      case 'd': return S_ISDIR(st.st_mode);
+      case 'b': return S_ISBLK(st.st_mode);
+      case 'c': return S_ISCHR(st.st_mode);
+      case 'p': return S_ISFIFO(st.st_mode);
+      case 'S': return S_ISSOCK(st.st_mode);
+      case 's': return st.st_size > 0;
+      case 'g': return (st.st_mode & S_ISGID) != 0;
+      case 'u': return (st.st_mode & S_ISUID) != 0;
+      case 'k': return (st.st_mode & S_ISVTX) != 0;
+      default:  return false;
+    }
+  }
+
+  /* Evaluates binary 'test' operator */
+  static bool test_binary(test_expression &expr, std::string_view left, std::string_view op, std::string_view right)
+  {
+    if (op == "=" || op == "==") { return left == right; }
+    if (op == "!=")              { return left != right; }
+    if (op == "<")               { return left < right;  }
+    if (op == ">")               { return left > right;  }
+
+    if (op == "-nt" || op == "-ot" || op == "-ef")
+    {
+      struct stat left_st{}, right_st{};
+      bool has_left  = stat(std::string(left).c_str(), &left_st) == 0,
+           has_right = stat(std::string(right).c_str(), &right_st) == 0;
+
+      if (op == "-ef")
+      {
+        return has_left && has_right && left_st.st_dev == right_st.st_dev && left_st.st_ino == right_st.st_ino;
+      }
+
+      const timespec &newer = (op == "-nt") ? left_st.st_mtim : right_st.st_mtim,
+                     &older = (op == "-nt") ? right_st.st_mtim : left_st.st_mtim;
+      bool has_newer = (op == "-nt") ? has_left : has_right,
+           has_older = (op == "-nt") ? has_right : has_left;
+      return has_newer && (!has_older || newer.tv_sec > older.tv_sec ||
+                           (newer.tv_sec == older.tv_sec && newer.tv_nsec > older.tv_nsec));
+    }
+
+    long long left_value = 0, right_value = 0;
+    if (!parse_test_integer(expr, left, left_value) || !parse_test_integer(expr, right, right_value))
+    {
+      return false;
+    }
+
+    if (op == "-eq") { return left_value == right_value; }
+    if (op == "-ne") { return left_value != right_value; }
+    if (op == "-lt") { return left_value <  right_value; }
+    if (op == "-le") { return left_value <= right_value; }
+    if (op == "-gt") { return left_value >  right_value; }
+    return left_value >= right_value; // "-ge"
+  }
+
+  /* Parses integer operand of 'test' comparison. Leading and trailing blanks are allowed */
+  static bool parse_test_integer(test_expression &expr, std::string_view arg, long long &value)
+  {
+    std::string number(arg);
+    char *number_end = nullptr;
+    errno = 0;
+    value = strtoll(number.c_str(), &number_end, 10);
+
+    while (*number_end == ' ' || *number_end == '\t')
+    {
+      number_end++;
+    }
+    if (number.find_first_not_of(" \t") == std::string::npos || *number_end != '\0' || errno == ERANGE)
+    {
+      std::cerr << expr.args[0] << ": " << arg << ": integer expression expected" << std::endl;
+      expr.error = true;
+      return false;
+    }
+    return true;
+  }
+};
+
+#endif //MICROSHA_BUILTIN_COMMANDS_H
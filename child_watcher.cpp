@@ -0,0 +1 @@
+#include "child_watcher.h"
\ No newline at end of file
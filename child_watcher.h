@@ -0,0 +1,342 @@
+#ifndef MICROSHA_CHILD_WATCHER_H
+#define MICROSHA_CHILD_WATCHER_H
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+
+#include <vector>
+#include <utility>
+
+#include "job_table.h"
+
+#define EXIT_TIMEOUT 124
+#define KILL_GRACE_SEC 1.0
+
+/* Event loop collecting foreground job processes.
+ * SIGINT and SIGCHLD are blocked in the shell and read from signalfd, process exits are read from pidfds,
+ * everything is multiplexed by one epoll instance. So there is no asynchronous signal handler at all:
+ * - exit status of every process is collected by its own pid, processes of other jobs are never reaped;
+ * - SIGINT received by the shell is forwarded to the foreground job;
+ * - job running past its deadline gets SIGTERM and, after grace period, SIGKILL. */
+class child_watcher
+{
+private:
+  static constexpr uint64_t SIGNAL_FD_KEY = UINT64_MAX;
+
+  int signal_fd = -1;
+  int epoll_fd  = -1;
+  bool interrupted = false;                  // SIGINT was received during the last wait
+  bool last_interrupt_from_terminal = false; // last SIGINT was generated by terminal, not sent by 'kill'
+  std::vector<std::pair<pid_t, int>> pidfds; // pidfds of the waited job processes, buffer is reused between waits
+
+public:
+  /* Class constructor. Blocks shell signals and creates signalfd and epoll instance */
+  child_watcher()
+  {
+    sigset_t shell_signals = get_watched_signals();
+    sigprocmask(SIG_BLOCK, &shell_signals, nullptr);
+
+    signal_fd = signalfd(-1, &shell_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = SIGNAL_FD_KEY;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+  }
+
+  /* Class destructor */
+  ~child_watcher()
+  {
+    close(signal_fd);
+    close(epoll_fd);
+  }
+
+  child_watcher(const child_watcher &) = delete;
+  child_watcher &operator=(const child_watcher &) = delete;
+
+  /* Returns signals handled by the event loop. They must be unblocked in commands */
+  static sigset_t get_watched_signals()
+  {
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGCHLD);
+
+    return signals;
+  }
+
+  /* Waits until all job processes finish or the job is stopped.
+   *
+   * @param j                 - job to be waited for. Its state and statuses are updated
+   * @param timeout_sec       - seconds after which the job is killed, 0 - no deadline
+   * @param forward_interrupt - forward SIGINT to the job, otherwise SIGINT stops waiting
+   *
+   * @return true if the job was killed because of deadline */
+  bool wait_job(job &j, double timeout_sec = 0, bool forward_interrupt = true)
+  {
+    interrupted = false;
+
+    pidfds.clear();
+    for (pid_t pid : j.pids)
+    {
+      int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+      if (pidfd == -1)
+      {
+        continue; // exit will be noticed by SIGCHLD
+      }
+
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.u64 = (uint64_t)pid;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &event);
+      pidfds.emplace_back(pid, pidfd);
+    }
+
+    timespec deadline{};
+    bool has_deadline = (timeout_sec > 0), term_sent = false, timed_out = false, stop_waiting = false;
+    if (has_deadline)
+    {
+      deadline = get_deadline(timeout_sec);
+    }
+
+    // processes could finish before their pidfds were opened
+    bool scan_needed = true;
+
+    while (!j.pids.empty())
+    {
+      if (scan_needed)
+      {
+        scan_needed = false;
+        if (scan_job(j, pidfds))
+        {
+          break; // job stopped
+        }
+        continue;
+      }
+
+      int timeout_ms = -1;
+      if (has_deadline)
+      {
+        timeout_ms = get_remaining_ms(deadline);
+        if (timeout_ms == 0)
+        {
+          // first deadline asks job to terminate, the second one kills it
+          timed_out = true;
+          signal_job(j, term_sent ? SIGKILL : SIGTERM);
+          has_deadline = !term_sent;
+          deadline = get_deadline(KILL_GRACE_SEC);
+          term_sent = true;
+          continue;
+        }
+      }
+
+      epoll_event events[16];
+      int events_num = epoll_wait(epoll_fd, events, 16, timeout_ms);
+      if (events_num == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        ADD_LOG(FAILURE, 6);
+        break;
+      }
+
+      for (int i = 0; i < events_num; i++)
+      {
+        if (events[i].data.u64 != SIGNAL_FD_KEY)
+        {
+          reap_process(j, (pid_t)events[i].data.u64, pidfds);
+          continue;
+        }
+
+        int signal_num = 0;
+        while ((signal_num = read_signal()) != 0)
+        {
+          if (signal_num == SIGCHLD)
+          {
+            scan_needed = true;
+          }
+          else if (signal_num == SIGINT)
+          {
+            interrupted = true;
+            stop_waiting = !forward_interrupt;
+
+            // job sharing terminal process group with the shell got terminal SIGINT itself
+            if (forward_interrupt && (j.pgid > 0 || !last_interrupt_from_terminal))
+            {
+              signal_job(j, SIGINT);
+            }
+          }
+        }
+      }
+
+      if (stop_waiting)
+      {
+        break;
+      }
+    }
+
+    for (auto &pidfd : pidfds)
+    {
+      close(pidfd.second);
+    }
+
+    if (j.pids.empty())
+    {
+      j.state = JOB_DONE;
+    }
+    if (timed_out)
+    {
+      j.status = EXIT_TIMEOUT;
+    }
+    return timed_out;
+  }
+
+  /* Returns true if SIGINT was received during the last wait */
+  bool was_interrupted() const
+  {
+    return interrupted;
+  }
+
+  /* Reads all pending signals without blocking. Returns true if SIGINT was among them */
+  bool consume_interrupt()
+  {
+    bool sigint_received = false;
+    int signal_num = 0;
+
+    while ((signal_num = read_signal()) != 0)
+    {
+      sigint_received = sigint_received || (signal_num == SIGINT);
+    }
+
+    return sigint_received;
+  }
+
+private:
+  /* Reads one pending signal from signalfd. Returns 0 if there are no pending signals */
+  int read_signal()
+  {
+    signalfd_siginfo info{};
+
+    if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+    {
+      return 0;
+    }
+
+    if (info.ssi_signo == SIGINT)
+    {
+      last_interrupt_from_terminal = (info.ssi_code == SI_KERNEL);
+    }
+    return (int)info.ssi_signo;
+  }
+
+  /* Reaps process which pidfd became readable */
+  static void reap_process(job &j, pid_t pid, std::vector<std::pair<pid_t, int>> &pidfds)
+  {
+    int status = 0;
+    rusage usage{};
+
+    if (wait4(pid, &status, WNOHANG, &usage) == pid)
+    {
+      job_table::finish_process(j, pid, status, &usage);
+      forget_pidfd(pid, pidfds);
+    }
+  }
+
+  /* Collects state changes of all job processes. Returns true if job was stopped */
+  static bool scan_job(job &j, std::vector<std::pair<pid_t, int>> &pidfds)
+  {
+    for (size_t i = 0; i < j.pids.size();)
+    {
+      int status = 0;
+      rusage usage{};
+      pid_t pid = j.pids[i];
+      pid_t res = wait4(pid, &status, WNOHANG | WUNTRACED, &usage);
+
+      if (res == 0 || (res == -1 && errno == EINTR))
+      {
+        i++;
+        continue;
+      }
+
+      if (res == pid && WIFSTOPPED(status))
+      {
+        j.state = JOB_STOPPED;
+        return true;
+      }
+
+      job_table::finish_process(j, pid, (res == -1) ? 0 : status, (res == -1) ? nullptr : &usage);
+      forget_pidfd(pid, pidfds);
+    }
+
+    return false;
+  }
+
+  /* Closes pidfd of reaped process */
+  static void forget_pidfd(pid_t pid, std::vector<std::pair<pid_t, int>> &pidfds)
+  {
+    for (auto it = pidfds.begin(); it != pidfds.end(); it++)
+    {
+      if (it->first == pid)
+      {
+        close(it->second);
+        pidfds.erase(it);
+        return;
+      }
+    }
+  }
+
+  /* Sends signal to job process group or to each job process if job has no own group */
+  static void signal_job(const job &j, int signal_num)
+  {
+    if (j.pgid > 0)
+    {
+      kill(-j.pgid, signal_num);
+      return;
+    }
+
+    for (pid_t pid : j.pids)
+    {
+      kill(pid, signal_num);
+    }
+  }
+
+  /* Returns monotonic time point 'sec' seconds later than now */
+  static timespec get_deadline(double sec)
+  {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    auto nsec = (long long)now.tv_nsec + (long long)(sec * 1e9);
+    now.tv_sec += (time_t)(nsec / 1000000000);
+    now.tv_nsec = (long)(nsec % 1000000000);
+
+    return now;
+  }
+
+  /* Returns milliseconds left until deadline rounded up, 0 if deadline passed */
+  static int get_remaining_ms(const timespec &deadline)
+  {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long left_ns = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+    if (left_ns <= 0)
+    {
+      return 0;
+    }
+    return (int)((left_ns + 999999) / 1000000);
+  }
+};
+
+#endif //MICROSHA_CHILD_WATCHER_H
@@ -11,23 +11,54 @@
 #include <cerrno>
 #include <csignal>
 #include <dirent.h>
+#include <spawn.h>
 
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <atomic>
 
 #include "string_funcitons.h"
-#include "matcher.h"
-#include "text_colors.h"
+#include "command_lexer.h"
+#include "flat_argv.h"
+#include "builtin_commands.h"
+#include "text_builtins.h"
+#include "dir_walker.h"
+#include "path_cache.h"
+#include "pipeline_cache.h"
+#include "history.h"
+#include "command_stats.h"
 
 /* Enumeration for internal commands */
 enum command_type
 {
-  CMD_OUT,  // either external command, or not command
-  CMD_CD,   // changes directory
-  CMD_PWD,  // shows present working directory
-  CMD_TIME, // measures command work-time
-  CMD_SET   // shows all shell-variables and environment variables
+  CMD_OUT,        // either external command, or not command
+  CMD_CD,         // changes directory
+  CMD_PWD,        // shows present working directory
+  CMD_TIME,       // measures command work-time
+  CMD_TIMEOUT,    // kills command running past deadline
+  CMD_SET,        // shows all shell-variables and environment variables
+  CMD_HASH,       // shows or resets remembered command locations
+  CMD_JOBS,       // shows background and stopped jobs
+  CMD_FG,         // continues job in foreground
+  CMD_BG,         // continues stopped job in background
+  CMD_WAIT,       // waits for background jobs
+  CMD_PARALLEL,   // runs command for every item with bounded concurrency
+  CMD_PARSECACHE, // shows or resets parsed command line cache counters
+  CMD_HISTORY,    // shows or searches command history
+  CMD_STATS,      // shows per-command latency statistics
+  CMD_ECHO,       // prints arguments
+  CMD_PRINTF,     // prints arguments by format
+  CMD_TEST,       // evaluates expression ('test' or '[')
+  CMD_TRUE,       // returns success
+  CMD_FALSE,      // returns failure
+  CMD_EXIT,       // finishes the shell
+  CMD_CAT,        // copies files or input to output. Builtin only inside pipeline, external 'cat' otherwise
+  CMD_GREP,       // prints lines containing string. Builtin only inside pipeline, as 'cat'
+  CMD_WC,         // counts lines, words and bytes. Builtin only inside pipeline, as 'cat'
+  CMD_CUT,        // prints selected bytes or fields of lines. Builtin only inside pipeline, as 'cat'
+  CMD_HEAD,       // prints the first lines or bytes. Builtin only inside pipeline, as 'cat'
+  CMD_TAIL        // prints the last lines or bytes. Builtin only inside pipeline, as 'cat'
 };
 
 /* Command obtaining class */
@@ -36,10 +67,13 @@ class command
   friend class command_pipeline;
 
 private:
-  std::string input_file_name,
+  // storage is taken from memory resource given to constructor - usually the arena of command line
+  std::pmr::string input_file_name,
     output_file_name;
-  std::vector<std::string> command_name;
+  flat_argv command_name;
+  std::pmr::string exec_path; // resolved executable pathname of external command
   command_type cmd_type = CMD_OUT;
+  static inline std::atomic<unsigned> cd_count{0}; // successful 'cd' calls
 
 public:
   /* Default class constructor */
@@ -50,201 +84,142 @@ public:
   ~command()
   =default;
 
-  /* Class constructor by string.
-   *
-   * @param command_base - string containing command and attributes to be parsed
-   * @param error_code   - reference to the variable where construction errors are to be written or 'SUCCESS' otherwise */
-  command(const std::string &command_base, ERR_CODE &error_code)
-  {
-    error_code = parse_command(command_base);
+  /* Copy constructor. Copy storage is taken from the default memory resource */
+  command(const command &other)
+  =default;
 
-    if (error_code == SUCCESS)
-    {
-      error_code = expand_command_path_params();
-    }
-  }
+  /* Default move constructor */
+  command(command &&other) noexcept
+  =default;
 
-  /* Parses command string base */
-  ERR_CODE parse_command(const std::string &command_base)
+  /* Class constructor by already splitted and expanded arguments */
+  explicit command(const std::vector<std::string> &args)
   {
-    if (command_base.empty())
+    for (const auto &arg : args)
     {
-      print_err(std::cerr, ERR_WRONG_INPUT);
-      return ERR_WRONG_INPUT;
+      command_name.push_back(arg);
     }
 
-    std::vector<std::string> command_parts;
-    split_string_by_token(command_base, ' ', command_parts);
-
-    // count number of i/o points TODO: ask isn't it excessive
-    auto input_point_num  = std::count(command_parts.begin(), command_parts.end(), "<"),
-         output_point_num = std::count(command_parts.begin(), command_parts.end(), ">");
-
-    if (input_point_num > 1 || output_point_num > 1)
+    if (!command_name.empty())
     {
-      print_err(std::cerr, ERR_WRONG_INPUT);
-      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 0);
+      cmd_type = get_command_type(command_name[0]);
     }
+  }
 
-    // initialize command name and i/o file names
-    auto input_point  = std::find(command_parts.begin(), command_parts.end(), "<"),
-         output_point = std::find(command_parts.begin(), command_parts.end(), ">");
+  /* Class constructor by tokens of one pipeline command.
+   *
+   * @param begin, end  - range of command tokens, pipeline operators are not included
+   * @param last_status - exit status substituted for '$?'
+   * @param error_code  - reference to the variable where construction errors are to be written or 'SUCCESS' otherwise
+   * @param resource    - memory resource for command strings and arguments */
+  command(const token *begin, const token *end, int last_status, ERR_CODE &error_code,
+          std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+    input_file_name(resource), output_file_name(resource), command_name(resource), exec_path(resource)
+  {
+    error_code = parse_command(begin, end, last_status);
+  }
 
-    if (output_point < input_point)
+  /* Parses command tokens: words become arguments, '<' and '>' take the next word as file name.
+   * Words with unquoted pattern meta-symbols are expanded to matching pathnames */
+  ERR_CODE parse_command(const token *begin, const token *end, int last_status)
+  {
+    std::pmr::string storage(input_file_name.get_allocator().resource());
+
+    for (const token *tok = begin; tok != end; tok++)
     {
-      command_name.assign(command_parts.begin(), output_point);
-      output_file_name = *(output_point + 1);
-      if (input_point != command_parts.end()) // TODO: add format check : "cat <" or "< lol.txt" are not detected without error now
+      if (tok->kind == TOKEN_INPUT || tok->kind == TOKEN_OUTPUT)
       {
-        input_file_name = *(input_point + 1); // invalid pointer can be tried to go by
+        std::pmr::string &file_name = (tok->kind == TOKEN_INPUT) ? input_file_name : output_file_name;
+        if (tok + 1 == end || (tok[1].kind != TOKEN_WORD && tok[1].kind != TOKEN_QUOTED) || !file_name.empty())
+        {
+          print_err(std::cerr, ERR_WRONG_INPUT);
+          ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 3);
+        }
+
+        tok++;
+        file_name = command_lexer::cook_word(*tok, storage, last_status);
+        continue;
       }
-    }
-    else if (input_point < output_point)
-    {
-      command_name.assign(command_parts.begin(), input_point);
-      input_file_name = *(input_point + 1);
-      if (output_point != command_parts.end())
+
+      if (tok->has_glob)
       {
-        output_file_name = *(output_point + 1);
+        std::vector<std::string> expanded_path_names = expand_path_regex(command_lexer::get_glob_pattern(*tok, last_status));
+        for (const auto &path_name : expanded_path_names)
+        {
+          command_name.push_back(path_name);
+        }
+        if (!expanded_path_names.empty())
+        {
+          continue;
+        }
       }
-    }
-    else //if (input_point == output_point) -> input_point == command_parts.end() && output_point == command_parts.end()
-    {
-      command_name = command_parts;
+
+      command_name.push_back(command_lexer::cook_word(*tok, storage, last_status));
     }
 
-    if (!command_parts.empty())
+    if (command_name.empty())
     {
-      cmd_type = get_command_type(command_parts[0]);
+      print_err(std::cerr, ERR_WRONG_INPUT);
+      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 3);
     }
 
+    cmd_type = get_command_type(command_name[0]);
     return SUCCESS;
   }
 
   /* Returns 'command_type' value by string */
-  static command_type get_command_type(const std::string &cmd_name)
+  static command_type get_command_type(std::string_view cmd_name)
   {
-    if      (cmd_name.empty()  ) { return CMD_OUT;  }
-    else if (cmd_name == "cd"  ) { return CMD_CD;   }
-    else if (cmd_name == "pwd" ) { return CMD_PWD;  }
-    else if (cmd_name == "time") { return CMD_TIME; }
-    else if (cmd_name == "set" ) { return CMD_SET;  }
-    else                         { return CMD_OUT;  }
+    if      (cmd_name.empty()        ) { return CMD_OUT;        }
+    else if (cmd_name == "cd"        ) { return CMD_CD;         }
+    else if (cmd_name == "pwd"       ) { return CMD_PWD;        }
+    else if (cmd_name == "time"      ) { return CMD_TIME;       }
+    else if (cmd_name == "timeout"   ) { return CMD_TIMEOUT;    }
+    else if (cmd_name == "set"       ) { return CMD_SET;        }
+    else if (cmd_name == "hash"      ) { return CMD_HASH;       }
+    else if (cmd_name == "jobs"      ) { return CMD_JOBS;       }
+    else if (cmd_name == "fg"        ) { return CMD_FG;         }
+    else if (cmd_name == "bg"        ) { return CMD_BG;         }
+    else if (cmd_name == "wait"      ) { return CMD_WAIT;       }
+    else if (cmd_name == "parallel"  ) { return CMD_PARALLEL;   }
+    else if (cmd_name == "parsecache") { return CMD_PARSECACHE; }
+    else if (cmd_name == "history"   ) { return CMD_HISTORY;    }
+    else if (cmd_name == "stats"     ) { return CMD_STATS;      }
+    else if (cmd_name == "echo"      ) { return CMD_ECHO;       }
+    else if (cmd_name == "printf"    ) { return CMD_PRINTF;     }
+    else if (cmd_name == "test"      ) { return CMD_TEST;       }
+    else if (cmd_name == "["         ) { return CMD_TEST;       }
+    else if (cmd_name == "true"      ) { return CMD_TRUE;       }
+    else if (cmd_name == "false"     ) { return CMD_FALSE;      }
+    else if (cmd_name == "exit"      ) { return CMD_EXIT;       }
+    else if (cmd_name == "cat"       ) { return CMD_CAT;        }
+    else if (cmd_name == "grep"      ) { return CMD_GREP;       }
+    else if (cmd_name == "wc"        ) { return CMD_WC;         }
+    else if (cmd_name == "cut"       ) { return CMD_CUT;        }
+    else if (cmd_name == "head"      ) { return CMD_HEAD;       }
+    else if (cmd_name == "tail"      ) { return CMD_TAIL;       }
+    else                               { return CMD_OUT;        }
   }
 
-  /**********************************************************************
-   * Path regular expression expansion functions
-   **********************************************************************/
-
-  /* Checks if given text contains regex meta-symbols to be expanded */
-  static bool is_expansion_needed(const std::string &text)
+  /* Returns sorted names of shell builtins for command name completion. Utilities with builtin
+   * implementation ('cat', 'grep' ...) are not included: they are completed as '$PATH' executables */
+  static const std::vector<std::string_view> &get_builtin_names()
   {
-    if (text.find('*') != std::string::npos || text.find('?') != std::string::npos)
-    {
-      return true;
-    }
-    return false;
+    static const std::vector<std::string_view> names = {
+      "bg", "cd", "echo", "exit", "false", "fg", "hash", "history", "jobs", "parallel", "parsecache",
+      "printf", "pwd", "set", "stats", "test", "time", "timeout", "true", "wait"};
+    return names;
   }
 
-  /* Expands all path-regex parameters of command */
-  ERR_CODE expand_command_path_params ()
-  {
-    for (int i = 0; i < command_name.size(); i++)
-    {
-      if (!is_expansion_needed(command_name[i])) { continue; }
-
-      std::vector<std::string> expanded_path_names = expand_path_regex(command_name[i]);
-
-      if (expanded_path_names.empty()) { continue; }
+  /**********************************************************************
+   * Path regular expression expansion functions
+   **********************************************************************/
 
-      command_name.erase(command_name.begin() + i);
-      command_name.insert(command_name.begin() + i, expanded_path_names.begin(), expanded_path_names.end());
-    }
-    
-    return SUCCESS;
-  }
-  
-  /* Expands filesystem path regex */
+  /* Expands filesystem path regex. Matched pathnames are sorted */
   static std::vector<std::string> expand_path_regex(const std::string &path_regex)
   {
-    std::vector<std::string> splitted_path_regex;
-    split_string_by_token(path_regex, '/', splitted_path_regex);
-
-    std::vector<std::string> expanded_path_name;
-    std::string path;
-    bool flag = false;
-
-    if (splitted_path_regex[0].empty())
-    {
-      path = "/";
-      flag = true;
-    }
-    else
-    {
-      path = get_curr_dir() + "/";
-    }
-    expanded_path_name.emplace_back("");
-
-    bool is_dir = false;
-    if (splitted_path_regex[splitted_path_regex.size() - 1].empty())
-    {
-      is_dir = true;
-    }
-
-    std::vector<std::string> reverse_names;
-    for (auto it = splitted_path_regex.rbegin(); it != splitted_path_regex.rend(); it++) 
-    {
-      if (it->empty()) { continue; }
-      reverse_names.push_back(*it);
-    }
-    
-    int args_ptr = reverse_names.size() - 1;
-    while (args_ptr >= 0)
-    {
-      std::vector<std::string> tmp_path_name;
-      for (std::string& i : expanded_path_name)
-      {
-        if (flag)
-        {
-          i += '/';
-        }
-        DIR* dir = opendir((path + i).c_str());
-        if (dir != nullptr)
-        {
-          for (dirent* d = readdir(dir); d != nullptr; d = readdir(dir))
-          {
-            if (d->d_name[0] == '.') { continue; }
-            if (args_ptr > 0)
-            {
-              Matcher m(d->d_name, reverse_names[args_ptr].c_str());
-              if (d->d_type == DT_DIR && m.match())
-              {
-                tmp_path_name.push_back(i + d->d_name);
-              }
-            }
-            else
-            {
-              Matcher m(d->d_name, reverse_names[args_ptr].c_str());
-              if ((d->d_type == DT_DIR || (d->d_type == DT_REG && !is_dir)) && m.match())
-              {
-                tmp_path_name.push_back(i + d->d_name);
-              }
-            }
-          }
-        }
-        closedir(dir);
-      }
-      expanded_path_name = tmp_path_name;
-      args_ptr--;
-      flag = true;
-    }
-
-    if (expanded_path_name.empty())
-    {
-      return {};
-    }
-
-    return expanded_path_name;
+    dir_walker walker(path_regex);
+    return walker.expand();
   }
 
   /**********************************************************************/
@@ -277,68 +252,141 @@ public:
     return std::string(home_dir_name_C);
   }
 
-  /* Prints current directory to given output stream */
-  static ERR_CODE print_intro_line(std::ostream &os)
+  /* Returns number of successful directory changes. Prompt reads current directory again when it grows */
+  static unsigned get_cd_count()
   {
-    gid_t gid = getgid();
-    errno = 0;
-    std::string intro_line = get_curr_dir();
+    return cd_count.load(std::memory_order_relaxed);
+  }
 
-    if (errno != 0)
+  /* Executes command in forked copy of the shell after '<'/'>' redirections are applied:
+   * replaces the process with external command or runs builtin. Returns exit status of builtin */
+  int exec()
+  {
+    if (io_redirect() != SUCCESS)
     {
-      ADD_LOG_WITH_RETURN(FAILURE, 0);
+      return EXIT_FAILURE;
     }
 
-    if (gid == 0)
-    {
-      intro_line += "!";
-    }
-    else // if (gid != 0)
+    if (cmd_type == CMD_OUT)
     {
-      intro_line += "> ";
+      command_name.prepare_argv();
+      exec_bash_command(exec_path, command_name.get_argv());
     }
 
-    os << BOLDCYAN << intro_line << RESET;
-    return SUCCESS;
+    return exec_builtin(std::cin, std::cout, EXIT_SUCCESS);
   }
 
-  /* Executes command in current class variable */
-  ERR_CODE exec()
+  /* Executes builtin reading and writing given streams. Redirections must be applied by the caller.
+   * 'last_status' is the default exit status for 'exit'. Returns exit status of builtin */
+  int exec_builtin(std::istream &is, std::ostream &os, int last_status)
   {
     switch (cmd_type)
     {
       case CMD_CD: {
-        if (command_name.size() == 1) { IS_SUCCESS_WITH_RETURN(exec_cd(get_home_dir()))}
-        else if (command_name.size() == 2) { IS_SUCCESS_WITH_RETURN(exec_cd(command_name[1]))}
-        else { return FAILURE; }
-        break;
+        if      (command_name.size() == 1) { return get_exit_status(exec_cd(get_home_dir()));       }
+        else if (command_name.size() == 2) { return get_exit_status(exec_cd(command_name.c_str(1))); }
+        else                               { return EXIT_FAILURE;                                    }
       }
 
-      case CMD_PWD: {
-        IS_SUCCESS_WITH_RETURN(exec_pwd())
-        break;
-      }
+      case CMD_PWD:        return get_exit_status(exec_pwd(os));
+      case CMD_SET:        return get_exit_status(exec_set(os));
+      case CMD_HASH:       return get_exit_status(exec_hash(os));
+      case CMD_PARSECACHE: return get_exit_status(exec_parsecache(os));
+      case CMD_HISTORY:    return get_exit_status(exec_history(os));
+      case CMD_STATS:      return get_exit_status(exec_stats(os));
+      case CMD_ECHO:       return builtin_commands::exec_echo(command_name, os);
+      case CMD_PRINTF:     return builtin_commands::exec_printf(command_name, os);
+      case CMD_TEST:       return builtin_commands::exec_test(command_name);
+      case CMD_TRUE:       return EXIT_SUCCESS;
+      case CMD_FALSE:      return EXIT_FAILURE;
+      case CMD_EXIT:       return builtin_commands::exec_exit(command_name, last_status);
+      case CMD_CAT:        return builtin_commands::exec_cat(command_name, is, os);
+      case CMD_GREP:       return text_builtins::exec_grep(command_name, is, os);
+      case CMD_WC:         return text_builtins::exec_wc(command_name, is, os);
+      case CMD_CUT:        return text_builtins::exec_cut(command_name, is, os);
+      case CMD_HEAD:       return text_builtins::exec_head(command_name, is, os);
+      case CMD_TAIL:       return text_builtins::exec_tail(command_name, is, os);
+
+      default:
+        print_err(std::cerr, ERR_WRONG_INPUT);
+        return EXIT_FAILURE;
+    }
+  }
 
-      case CMD_SET: {
-        IS_SUCCESS_WITH_RETURN(exec_set())
-        break;
-      }
+  /* Checks if command of given type is executed by 'exec_builtin' */
+  static bool is_builtin(command_type type)
+  {
+    switch (type)
+    {
+      case CMD_CD:   case CMD_PWD:    case CMD_SET:  case CMD_HASH: case CMD_PARSECACHE: case CMD_HISTORY:
+      case CMD_STATS:
+      case CMD_ECHO: case CMD_PRINTF: case CMD_TEST: case CMD_TRUE: case CMD_FALSE: case CMD_EXIT:
+        return true;
 
-      case CMD_OUT:
-      {
-        IS_SUCCESS_WITH_RETURN(io_redirect())
-        exec_bash_command(command_name);
-        break;
-      }
+      default:
+        return false;
+    }
+  }
 
-      case CMD_TIME:
-      {
-        print_err(std::cerr, ERR_WRONG_INPUT);
+  /* Checks if builtin of given type can run on a thread beside the shell:
+   * it does not change or read shell state (history is locked by itself) and reads nothing from standard input */
+  static bool is_thread_safe_builtin(command_type type)
+  {
+    switch (type)
+    {
+      case CMD_PWD: case CMD_SET: case CMD_ECHO: case CMD_PRINTF: case CMD_TEST: case CMD_TRUE: case CMD_FALSE:
+      case CMD_EXIT: case CMD_CAT: case CMD_GREP: case CMD_WC: case CMD_CUT: case CMD_HEAD: case CMD_TAIL:
+      case CMD_HISTORY:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  /* Checks if command of given type is an utility (like 'cat') which has builtin implementation
+   * used only on pipeline threads. External utility is executed in other cases */
+  static bool is_utility_builtin(command_type type)
+  {
+    switch (type)
+    {
+      case CMD_CAT: case CMD_GREP: case CMD_WC: case CMD_CUT: case CMD_HEAD: case CMD_TAIL:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  /* Checks if utility builtin can replace external utility: all options are supported, and
+   * its input is bounded - it comes from the previous pipeline stage, files or redirection, not from the terminal */
+  bool is_utility_builtin_usable(bool has_stage_input) const
+  {
+    bool is_supported = false, reads_input = true;
+    switch (cmd_type)
+    {
+      case CMD_CAT:
+        is_supported = builtin_commands::is_cat_supported(command_name);
+        reads_input = (command_name.size() == 1);
         break;
-      }
+
+      case CMD_GREP: is_supported = text_builtins::is_grep_supported(command_name, reads_input); break;
+      case CMD_WC:   is_supported = text_builtins::is_wc_supported(command_name, reads_input);   break;
+      case CMD_CUT:  is_supported = text_builtins::is_cut_supported(command_name, reads_input);  break;
+      case CMD_HEAD: is_supported = text_builtins::is_head_supported(command_name, reads_input); break;
+      case CMD_TAIL: is_supported = text_builtins::is_tail_supported(command_name, reads_input); break;
+
+      default:
+        return false;
     }
 
-    return SUCCESS;
+    return is_supported && (has_stage_input || !input_file_name.empty() || !reads_input);
+  }
+
+  /* Converts error code of builtin to its exit status */
+  static int get_exit_status(ERR_CODE err_code)
+  {
+    return (err_code == SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   /* Obtains i\o redirection */
@@ -349,24 +397,26 @@ public:
 
     if (!output_file_name.empty())
     {
-      fd_out = open(output_file_name.c_str(), O_WRONLY | O_TRUNC | O_CREAT, S_IWRITE | S_IREAD);
+      fd_out = open(output_file_name.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, S_IWRITE | S_IREAD);
       if (fd_out == -1)
       {
         print_err(std::cerr, ERR_FILE_OPEN);
         ADD_LOG_WITH_RETURN(ERR_FILE_OPEN, 3);
       }
       dup2(fd_out, STDOUT_FILENO);
+      close(fd_out);
     }
 
     if (!input_file_name.empty())
     {
-      fd_in = open(input_file_name.c_str(), O_RDONLY);
+      fd_in = open(input_file_name.c_str(), O_RDONLY | O_CLOEXEC, 0);
       if (fd_in == -1)
       {
         print_err(std::cerr, ERR_FILE_OPEN);
         ADD_LOG_WITH_RETURN(ERR_FILE_OPEN, 3);
       }
       dup2(fd_in, STDIN_FILENO);
+      close(fd_in);
     }
 
     return SUCCESS;
@@ -381,49 +431,307 @@ public:
       ADD_LOG_WITH_RETURN(ERR_FILE_DIR_EXIST, 0);
     }
 
+    cd_count.fetch_add(1, std::memory_order_relaxed);
     return SUCCESS;
   }
 
   /* Executes 'pwd' - prints name of current/working directory */
-  static ERR_CODE exec_pwd()
+  static ERR_CODE exec_pwd(std::ostream &os)
   {
     errno = 0;
     std::string curr_dir;
     curr_dir = get_curr_dir();
     if (errno != 0)
     {
-      kill(getpid(), SIGINT);
+      perror("pwd");
       ADD_LOG_WITH_RETURN(FAILURE, 3);
     }
 
-    std::cout << curr_dir << std::endl;
+    os << curr_dir << std::endl;
+    return SUCCESS;
+  }
+
+  /* Resolves external command location through the shell-wide command location cache.
+   * Prints error message if command is not found */
+  ERR_CODE resolve_exec_path()
+  {
+    if (command_name.empty())
+    {
+      return ERR_WRONG_INPUT;
+    }
+
+    if (path_cache::instance().resolve(command_name.c_str(0), exec_path) != SUCCESS)
+    {
+      std::cerr << command_name[0] << ": command not found" << std::endl;
+      ADD_LOG_WITH_RETURN(ERR_FILE_DIR_EXIST, 3);
+    }
+
+    return SUCCESS;
+  }
+
+  /* Executes 'hash' - shows remembered command locations, 'hash -r' forgets them, 'hash name...' remembers given commands */
+  ERR_CODE exec_hash(std::ostream &os)
+  {
+    path_cache &cache = path_cache::instance();
+
+    if (command_name.size() == 1)
+    {
+      cache.print(os);
+      return SUCCESS;
+    }
+
+    ERR_CODE err_code = SUCCESS;
+    for (size_t i = 1; i < command_name.size(); i++)
+    {
+      if (command_name[i] == "-r")
+      {
+        cache.clear();
+        continue;
+      }
+
+      std::pmr::string full_path;
+      if (cache.resolve(command_name.c_str(i), full_path) != SUCCESS)
+      {
+        std::cerr << "hash: " << command_name[i] << ": not found" << std::endl;
+        err_code = ERR_FILE_DIR_EXIST;
+      }
+    }
+
+    return err_code;
+  }
+
+  /* Executes 'parsecache' - shows parsed command line cache counters, '-r' empties the cache and resets them */
+  ERR_CODE exec_parsecache(std::ostream &os)
+  {
+    pipeline_cache &cache = pipeline_cache::instance();
+
+    if (command_name.size() == 1)
+    {
+      cache.print(os);
+      return SUCCESS;
+    }
+
+    if (command_name.size() == 2 && command_name[1] == "-r")
+    {
+      cache.clear();
+      return SUCCESS;
+    }
+
+    std::cerr << "parsecache: usage: parsecache [-r]" << std::endl;
+    return FAILURE;
+  }
+
+  /* Executes 'history' - shows the last entries ('history [-v] [count]', all by default)
+   * or entries containing text, the newest first ('history [-v] -s text'). '-v' adds time, duration, status and directory */
+  ERR_CODE exec_history(std::ostream &os)
+  {
+    command_history &history = command_history::instance();
+    bool is_verbose = (command_name.size() > 1 && command_name[1] == "-v");
+    size_t arg = is_verbose ? 2 : 1;
+
+    if (command_name.size() == arg)
+    {
+      history.print(os, SIZE_MAX, is_verbose);
+      return SUCCESS;
+    }
+
+    if (command_name.size() == arg + 2 && command_name[arg] == "-s")
+    {
+      history.print_matches(os, command_name[arg + 1], is_verbose);
+      return SUCCESS;
+    }
+
+    char *count_end = nullptr;
+    unsigned long count = strtoul(command_name.c_str(arg), &count_end, 10);
+    if (command_name.size() == arg + 1 && *command_name.c_str(arg) != '\0' && *count_end == '\0')
+    {
+      history.print(os, count, is_verbose);
+      return SUCCESS;
+    }
+
+    std::cerr << "history: usage: history [-v] [count] | history [-v] -s text" << std::endl;
+    return FAILURE;
+  }
+
+  /* Executes 'stats' - shows latency statistics of lines by their first command: 'stats [-H] [--json]'.
+   * '-H' shows statistics of history entries instead of this shell's lines, '-r' forgets the measurements */
+  ERR_CODE exec_stats(std::ostream &os)
+  {
+    bool is_json = false, from_history = false;
+    for (size_t i = 1; i < command_name.size(); i++)
+    {
+      if (command_name[i] == "--json")
+      {
+        is_json = true;
+      }
+      else if (command_name[i] == "-H")
+      {
+        from_history = true;
+      }
+      else if (command_name[i] == "-r" && command_name.size() == 2)
+      {
+        command_stats::instance().clear();
+        return SUCCESS;
+      }
+      else
+      {
+        std::cerr << "stats: usage: stats [-H] [--json] | stats -r" << std::endl;
+        return FAILURE;
+      }
+    }
+
+    command_stats history_stats;
+    if (from_history)
+    {
+      command_history::instance().open(); // history is not opened by scripts
+      history_stats.add_history(command_history::instance());
+    }
+
+    const command_stats &stats = from_history ? history_stats : command_stats::instance();
+    if (is_json) { stats.print_json(os); }
+    else         { stats.print(os);      }
     return SUCCESS;
   }
 
   /* Executes 'set' - shows all shell-variables and environment variables */
-  static ERR_CODE exec_set()
+  static ERR_CODE exec_set(std::ostream &os)
   {
     for (int i = 0; environ[i] != nullptr; i++)
     {
-      std::cout << environ[i] << std::endl;
+      os << environ[i] << '\n';
+    }
+
+    return SUCCESS;
+  }
+
+  /* Spawns external command in a new process without copying the shell (posix_spawn).
+   * Command location must be resolved with 'resolve_exec_path' and argument array built with 'prepare_argv' beforehand.
+   * Standard streams of the child are connected to given descriptors, then '<'/'>' redirections are applied.
+   * Redirection files are opened by the shell, so that a failed open is reported as by the forked backend.
+   *
+   * @param fd_in  - descriptor to become standard input of the command or -1 to leave it untouched
+   * @param fd_out - descriptor to become standard output of the command or -1 to leave it untouched
+   * @param pgid   - process group to put the command in: 0 - new group, -1 - process group of the shell
+   * @param pid    - reference to the variable where child process id is to be written */
+  ERR_CODE spawn(int fd_in, int fd_out, pid_t pgid, pid_t &pid) const
+  {
+    if (command_name.empty())
+    {
+      print_err(std::cerr, ERR_WRONG_INPUT);
+      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 3);
+    }
+
+    int file_out = -1,
+        file_in  = -1;
+
+    if (!output_file_name.empty())
+    {
+      file_out = open(output_file_name.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, S_IWRITE | S_IREAD);
+      if (file_out == -1)
+      {
+        print_err(std::cerr, ERR_FILE_OPEN);
+        ADD_LOG_WITH_RETURN(ERR_FILE_OPEN, 3);
+      }
+    }
+    if (!input_file_name.empty())
+    {
+      file_in = open(input_file_name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+      if (file_in == -1)
+      {
+        if (file_out != -1)
+        {
+          close(file_out);
+        }
+        print_err(std::cerr, ERR_FILE_OPEN);
+        ADD_LOG_WITH_RETURN(ERR_FILE_OPEN, 7);
+      }
+    }
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+
+    // redirection files replace pipe ends, as in the forked child
+    if (file_in != -1 || fd_in != -1)
+    {
+      posix_spawn_file_actions_adddup2(&file_actions, (file_in != -1) ? file_in : fd_in, STDIN_FILENO);
+    }
+    if (file_out != -1 || fd_out != -1)
+    {
+      posix_spawn_file_actions_adddup2(&file_actions, (file_out != -1) ? file_out : fd_out, STDOUT_FILENO);
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    sigset_t default_signals = get_job_control_signals(),
+             empty_mask;
+    sigemptyset(&empty_mask);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    posix_spawnattr_setsigmask(&attr, &empty_mask);
+    if (pgid != -1)
+    {
+      flags |= POSIX_SPAWN_SETPGROUP;
+      posix_spawnattr_setpgroup(&attr, pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    char *const *argv = command_name.get_argv();
+    int err = posix_spawn(&pid, exec_path.c_str(), &file_actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&attr);
+    if (file_in != -1)
+    {
+      close(file_in);
+    }
+    if (file_out != -1)
+    {
+      close(file_out);
+    }
+
+    if (err != 0)
+    {
+      std::cerr << argv[0] << ": " << strerror(err) << std::endl;
+      ADD_LOG_WITH_RETURN(FAILURE, 14);
     }
 
     return SUCCESS;
   }
 
-  static void exec_bash_command(const std::vector<std::string> &command_name)
+  /* Returns set of signals ignored by the shell, which must be restored to default in commands:
+   * stop signals ignored by interactive shell and SIGPIPE */
+  static sigset_t get_job_control_signals()
+  {
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTSTP);
+    sigaddset(&signals, SIGTTIN);
+    sigaddset(&signals, SIGTTOU);
+    sigaddset(&signals, SIGPIPE);
+
+    return signals;
+  }
+
+  /* Replaces process image with external command. Falls back to '$PATH' search if location was not resolved */
+  static void exec_bash_command(const std::pmr::string &exec_path, char *const *argv)
   {
     errno = 0;
-    std::vector<char*> v;
 
-    v.reserve(command_name.size());
-    for (const auto &s : command_name)
+    if (argv[0] == nullptr)
+    {
+      _exit(EXIT_FAILURE);
+    }
+
+    if (exec_path.empty())
+    {
+      execvp(argv[0], argv);
+    }
+    else
     {
-      v.push_back((char *)s.c_str());
+      execve(exec_path.c_str(), argv, environ);
     }
-    v.push_back(nullptr);
-    execvp(v[0], &v[0]);
-    perror(v[0]);      // TODO: error message and new intro_line print sequence is not determined
+    perror(argv[0]);      // TODO: error message and new intro_line print sequence is not determined
     kill(getpid(), SIGKILL);
   }
 
@@ -0,0 +1 @@
+#include "command_lexer.h"
@@ -0,0 +1,255 @@
+#ifndef MICROSHA_COMMAND_LEXER_H
+#define MICROSHA_COMMAND_LEXER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <cstdio>
+
+#include "error_functions.h"
+
+/* Token kinds */
+enum token_kind
+{
+  TOKEN_WORD,       // word without quoting
+  TOKEN_QUOTED,     // word containing quotes or escapes
+  TOKEN_PIPE,       // '|'
+  TOKEN_INPUT,      // '<'
+  TOKEN_OUTPUT,     // '>'
+  TOKEN_BACKGROUND  // '&'
+};
+
+/* Command line token. Text is a view into the original line, quotes are not removed */
+struct token
+{
+  token_kind kind = TOKEN_WORD;
+  std::string_view text;
+  bool has_glob = false;   // word contains unquoted '*', '?' or '['
+  bool has_dollar = false; // word contains '$' outside single quotes
+};
+
+/* Single pass command line lexer.
+ * Words are split by unquoted spaces, tabs and operators, so redirections need no spaces around ('cat<in').
+ * Quoting:
+ * - '\' outside quotes makes the next character literal;
+ * - '...' makes everything literal up to the next single quote;
+ * - "..." makes everything literal except '$', and '\' quotes only '$', '"', '\' there.
+ * Tokens refer to the line buffer, so the line must outlive them. Word text is copied only
+ * when quote removal or '$?' substitution changes it ('cook_word'). */
+class command_lexer
+{
+public:
+  /* Splits line into tokens.
+   *
+   * @param line   - command line
+   * @param tokens - vector where tokens are to be appended
+   *
+   * @return 'SUCCESS' or 'ERR_WRONG_INPUT' if line has unterminated quote */
+  static ERR_CODE tokenize(std::string_view line, std::pmr::vector<token> &tokens)
+  {
+    size_t pos = 0;
+
+    while (pos < line.size())
+    {
+      char c = line[pos];
+
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+      {
+        pos++;
+        continue;
+      }
+
+      token tok;
+      if (get_operator_kind(c, tok.kind))
+      {
+        tok.text = line.substr(pos, 1);
+        tokens.push_back(tok);
+        pos++;
+        continue;
+      }
+
+      IS_SUCCESS_WITH_RETURN(read_word(line, pos, tok))
+      tokens.push_back(tok);
+    }
+
+    return SUCCESS;
+  }
+
+  /* Returns word value with quotes removed and '$?' replaced by 'last_status'.
+   * Unchanged word is returned as view into the line, otherwise 'storage' is filled and its view is returned */
+  static std::string_view cook_word(const token &tok, std::pmr::string &storage, int last_status)
+  {
+    if (tok.kind == TOKEN_WORD && !tok.has_dollar)
+    {
+      return tok.text;
+    }
+
+    storage.clear();
+    unquote(tok.text, storage, last_status, false);
+    return storage;
+  }
+
+  /* Returns word as filename pattern: quotes are removed, quoted pattern meta-symbols are escaped with '\' */
+  static std::string get_glob_pattern(const token &tok, int last_status)
+  {
+    std::string pattern;
+
+    unquote(tok.text, pattern, last_status, true);
+    return pattern;
+  }
+
+private:
+  /* Checks if character is an operator and writes its kind */
+  static bool get_operator_kind(char c, token_kind &kind)
+  {
+    switch (c)
+    {
+      case '|': kind = TOKEN_PIPE;       return true;
+      case '<': kind = TOKEN_INPUT;      return true;
+      case '>': kind = TOKEN_OUTPUT;     return true;
+      case '&': kind = TOKEN_BACKGROUND; return true;
+      default:                           return false;
+    }
+  }
+
+  /* Reads word starting at line[pos] and moves 'pos' behind it */
+  static ERR_CODE read_word(std::string_view line, size_t &pos, token &tok)
+  {
+    size_t start = pos;
+    token_kind dummy_kind;
+    tok.kind = TOKEN_WORD;
+
+    while (pos < line.size())
+    {
+      char c = line[pos];
+
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || get_operator_kind(c, dummy_kind))
+      {
+        break;
+      }
+
+      switch (c)
+      {
+        case '\\':
+          tok.kind = TOKEN_QUOTED;
+          pos += (pos + 1 < line.size()) ? 2 : 1;
+          continue;
+
+        case '\'':
+        {
+          tok.kind = TOKEN_QUOTED;
+          size_t close_pos = line.find('\'', pos + 1);
+          if (close_pos == std::string_view::npos)
+          {
+            std::cerr << "Unterminated single quote" << std::endl;
+            ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 3);
+          }
+          pos = close_pos + 1;
+          continue;
+        }
+
+        case '"':
+        {
+          tok.kind = TOKEN_QUOTED;
+          for (pos++; pos < line.size() && line[pos] != '"'; pos++)
+          {
+            tok.has_dollar = tok.has_dollar || line[pos] == '$';
+            if (line[pos] == '\\' && pos + 1 < line.size())
+            {
+              pos++;
+            }
+          }
+          if (pos >= line.size())
+          {
+            std::cerr << "Unterminated double quote" << std::endl;
+            ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 8);
+          }
+          pos++;
+          continue;
+        }
+
+        case '*':
+        case '?':
+        case '[':
+          tok.has_glob = true;
+          break;
+
+        case '$':
+          tok.has_dollar = true;
+          break;
+
+        default:
+          break;
+      }
+
+      pos++;
+    }
+
+    tok.text = line.substr(start, pos - start);
+    return SUCCESS;
+  }
+
+  /* Appends word value to 'value': removes quotes, replaces '$?'.
+   * If 'escape_meta' is set, quoted pattern meta-symbols and '\' are written with '\' before them */
+  template <typename String>
+  static void unquote(std::string_view word, String &value, int last_status, bool escape_meta)
+  {
+    auto put_quoted = [&value, escape_meta](char c)
+    {
+      if (escape_meta && (c == '*' || c == '?' || c == '[' || c == '\\'))
+      {
+        value += '\\';
+      }
+      value += c;
+    };
+
+    char quote = 0;
+    for (size_t i = 0; i < word.size(); i++)
+    {
+      char c = word[i];
+
+      if (quote == '\'')
+      {
+        if (c == '\'') { quote = 0; }
+        else           { put_quoted(c); }
+      }
+      else if (c == '$' && i + 1 < word.size() && word[i + 1] == '?')
+      {
+        char status[16];
+        value.append(status, snprintf(status, sizeof(status), "%d", last_status));
+        i++;
+      }
+      else if (quote == '"')
+      {
+        if (c == '"')
+        {
+          quote = 0;
+        }
+        else if (c == '\\' && i + 1 < word.size() &&
+                 (word[i + 1] == '$' || word[i + 1] == '"' || word[i + 1] == '\\'))
+        {
+          put_quoted(word[++i]);
+        }
+        else
+        {
+          put_quoted(c);
+        }
+      }
+      else if (c == '\'' || c == '"')
+      {
+        quote = c;
+      }
+      else if (c == '\\' && i + 1 < word.size())
+      {
+        put_quoted(word[++i]);
+      }
+      else
+      {
+        value += c;
+      }
+    }
+  }
+};
+
+#endif //MICROSHA_COMMAND_LEXER_H
@@ -2,31 +2,103 @@
 #define MICROSHA_COMMAND_PIPELINE_H
 
 #include <fcntl.h>
-#include <sys/times.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 
 #include <string>
 #include <vector>
-#include <deque>
+#include <array>
 #include <iomanip>
+#include <termios.h>
+#include <thread>
+#include <memory>
+#include <system_error>
 
+#include "line_arena.h"
 #include "command.h"
+#include "fd_stream.h"
+#include "spsc_ring.h"
+#include "pipeline_cache.h"
+#include "job_table.h"
+#include "child_watcher.h"
+#include "parallel_runner.h"
+#include "time_report.h"
+#include "command_stats.h"
 
 #define READ_END 0
 #define WRITE_END 1
 
+#define EXIT_SYNTAX_ERROR 2
+#define EXIT_NOT_FOUND 127
+
+/* Process creation backends for pipeline stages */
+enum spawn_backend
+{
+  SPAWN_FORK, // fork() a copy of the shell for every stage
+  SPAWN_POSIX // posix_spawn() external commands with file actions, fork() only shell builtins
+};
+
+/* Numbers of child processes created by the shell for pipeline stages */
+struct process_counts
+{
+  size_t forks = 0;  // forked copies of the shell
+  size_t spawns = 0; // external commands started by posix_spawn
+};
+
 /* Class obtaining command pipeline
  * Pipeline have following pattern : command_1 (< is) | command_2 | ... | command_k (> os) -
  * only first command can have external input stream, and only last command can have external output */
 class command_pipeline
 {
 private:
-  std::deque<command> command_queue;
+  line_arena arena;                // memory of the current command line, it is freed by 'clear_pipeline'
+  std::vector<command> command_queue;
+  spawn_backend backend = get_default_backend();
+  int last_status = EXIT_SUCCESS; // exit status of the last executed pipeline
+  std::string pipeline_line;      // command line of the pipeline without background mark
+  bool is_background = false;     // pipeline is to be run in background ('&' at the end of line)
+  job_table jobs;
+  child_watcher watcher;
+  bool job_control = false;       // every pipeline gets own process group and terminal while in foreground
+  pid_t shell_pgid = 0;
+  double timeout_sec = 0;         // deadline of the foreground pipeline set by 'timeout' prefix, 0 - no deadline
+  std::vector<int> stage_status;  // exit statuses of the last foreground pipeline commands
+  std::vector<stage_usage> last_usage; // resource usage of the last foreground pipeline commands
+  bool is_timed = false;          // pipeline is run by 'time': forked stages are waited for until they 'exec'
+  bool count_events = false;      // pipeline is run by 'time -c': every stage gets perf_event counters
+  std::vector<perf_counters> stage_counters; // counters of process stages of the foreground pipeline
+  job foreground_job;             // job of the current foreground pipeline, its buffers are reused
+  bool exit_requested = false;    // 'exit' was executed by the shell
+  process_counts created;         // processes created for pipeline stages since the shell start
+
+  /* Pipeline builtin running on a shell thread instead of a forked child */
+  struct builtin_stage
+  {
+    command cmd;                        // copy of the stage command, it outlives the command line if the job is stopped
+    size_t index;                       // stage number in the pipeline
+    int fd_in;                          // pipe end to read from, -1 - no input
+    int fd_out;                         // pipe end to write to, -1 - standard output of the shell
+    std::shared_ptr<spsc_ring> ring_in; // ring from the previous stage running on thread, used instead of 'fd_in'
+    std::shared_ptr<spsc_ring> ring_out;
+    int status = EXIT_SUCCESS;
+    stage_usage usage;
+    bool count_events = false;          // builtin thread counts its perf_events
+    std::thread thread;
+
+    builtin_stage(const command &stage_cmd, size_t stage_index, int stage_fd_in, int stage_fd_out) :
+      cmd(stage_cmd), index(stage_index), fd_in(stage_fd_in), fd_out(stage_fd_out)
+    {
+    }
+  };
+  std::vector<std::shared_ptr<builtin_stage>> builtin_stages; // builtin threads of the foreground pipeline
 
 public:
-  /* Default class constructor */
+  /* Class constructor. Writing to a pipe without readers must fail with EPIPE instead of killing the shell,
+   * since pipeline builtins write from shell threads. Commands get default SIGPIPE action back */
   command_pipeline()
-  =default;
+  {
+    signal(SIGPIPE, SIG_IGN);
+  }
 
   /* Default class destructor */
   ~command_pipeline()
@@ -34,72 +106,188 @@ public:
     clear_pipeline();
   }
 
-  /* Reset pipeline
+  /* Reset pipeline. Parsed structure of the line is taken from the cache if the line was seen before
    * Note : if command_line is empty 'SUCCESS' is returned */
   ERR_CODE reset_pipeline(const std::string &command_line)
   {
     clear_pipeline();
+    is_background = false;
+    pipeline_line.clear();
 
-    std::vector<std::string> splitted_cmd_line;
-    split_string_by_token(command_line, '|', splitted_cmd_line);
-
-    // check if number of external i\o ( </> ) points fits the pattern in the description of class
-    if (check_cmd_line_IO_pattern(command_line, splitted_cmd_line) != SUCCESS)
+    pipeline_cache &cache = pipeline_cache::instance();
+    const parsed_pipeline *parsed = cache.find(command_line);
+    if (parsed == nullptr)
     {
-      print_err(std::cerr, ERR_WRONG_INPUT);
-      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 2);
+      parsed_pipeline &new_parsed = cache.add(command_line);
+      if (parse_line(new_parsed) != SUCCESS)
+      {
+        cache.forget(new_parsed);
+        last_status = EXIT_SYNTAX_ERROR;
+        ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 3);
+      }
+      parsed = &new_parsed;
     }
 
-    // insert all command bases into deque. "command" class object are constructed on-place
-    for(auto &curr_cmd_base : splitted_cmd_line)
+    is_background = parsed->is_background;
+    pipeline_line.assign(parsed->pipeline_line.data(), parsed->pipeline_line.size());
+
+    // insert all commands into queue. "command" class object are constructed on-place from tokens between '|'.
+    // words with pattern meta-symbols or '$?' are expanded here, so it is done on every run of the line
+    const token *tokens = parsed->tokens.data();
+    size_t cmd_begin = 0;
+    command_queue.reserve(parsed->command_ends.size());
+    for (size_t cmd_end : parsed->command_ends)
     {
       ERR_CODE err_code = SUCCESS; // TODO: ask if it is optimized by compiler and is it OK to write it here
-      command_queue.emplace_back(curr_cmd_base, err_code);
+      command_queue.emplace_back(tokens + cmd_begin, tokens + cmd_end, last_status, err_code, &arena);
 
       if (err_code != SUCCESS)
       {
         clear_pipeline();
+        last_status = EXIT_SYNTAX_ERROR;
         ADD_LOG_WITH_RETURN(err_code, 0);
       }
+
+      cmd_begin = cmd_end + 1;
     }
 
     return SUCCESS;
   }
 
-  /* Checks if command line fits the IO pattern(<,> position and number) in the description of class.
-   * Note:
-   * - function does not check if 'command_line' parameter fits 'splitted_command_line' parameter;
-   * - if command_line is empty 'SUCCESS' is returned. */
-  ERR_CODE check_cmd_line_IO_pattern(const std::string &command_line, const std::vector<std::string> &splitted_command_line)
+  /* Splits 'parsed.line' into tokens, checks them and finds pipeline commands */
+  static ERR_CODE parse_line(parsed_pipeline &parsed)
   {
-    if (command_line.empty())
+    parsed.tokens.clear();
+    parsed.command_ends.clear();
+    parsed.pipeline_line = {};
+    parsed.is_background = false;
+
+    IS_SUCCESS_WITH_RETURN(command_lexer::tokenize(parsed.line, parsed.tokens))
+
+    // '&' at the end of line runs pipeline in background
+    if (!parsed.tokens.empty() && parsed.tokens.back().kind == TOKEN_BACKGROUND)
+    {
+      parsed.is_background = true;
+      parsed.tokens.pop_back();
+    }
+    if (parsed.tokens.empty())
     {
       return SUCCESS;
     }
 
-    auto
-      input_points_num  = std::count(command_line.begin(), command_line.end(), '<'),
-      output_points_num = std::count(command_line.begin(), command_line.end(), '>'),
-      input_points_num_in_front = std::count(splitted_command_line.front().begin(), splitted_command_line.front().end(), '<'),
-      output_points_num_in_back = std::count(splitted_command_line.back().begin() , splitted_command_line.back().end() , '>');
+    const char *line_begin = parsed.tokens.front().text.data(),
+               *line_end   = parsed.tokens.back().text.data() + parsed.tokens.back().text.size();
+    parsed.pipeline_line = std::string_view(line_begin, line_end - line_begin);
 
-    if (!(input_points_num  == input_points_num_in_front && input_points_num  <= 1 &&
-          output_points_num == output_points_num_in_back && output_points_num <= 1))
+    // check if number of external i\o ( </> ) points fits the pattern in the description of class
+    if (check_cmd_line_IO_pattern(parsed.tokens) != SUCCESS)
     {
-      return FAILURE;
+      print_err(std::cerr, ERR_WRONG_INPUT);
+      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 4);
     }
 
+    for (size_t i = 0; i < parsed.tokens.size(); i++)
+    {
+      if (parsed.tokens[i].kind == TOKEN_PIPE)
+      {
+        parsed.command_ends.push_back(i);
+      }
+    }
+    parsed.command_ends.push_back(parsed.tokens.size());
+
     return SUCCESS;
   }
 
-  /* Clear pipeline */
+  /* Checks if command line tokens fit the IO pattern(<,> position and number) in the description of class.
+   * '&' is allowed only at the end of line, so it must be removed before the check.
+   * Note : if there are no tokens 'SUCCESS' is returned */
+  static ERR_CODE check_cmd_line_IO_pattern(const std::pmr::vector<token> &tokens)
+  {
+    size_t pipes_num = 0, input_points_num = 0, output_points_num = 0;
+
+    for (const auto &tok : tokens)
+    {
+      switch (tok.kind)
+      {
+        case TOKEN_PIPE:
+          pipes_num++;
+          break;
+
+        case TOKEN_INPUT:
+          // only the first command can have external input
+          if (pipes_num > 0 || ++input_points_num > 1)
+          {
+            return FAILURE;
+          }
+          break;
+
+        case TOKEN_OUTPUT:
+          output_points_num++;
+          break;
+
+        case TOKEN_BACKGROUND:
+          return FAILURE;
+
+        default:
+          break;
+      }
+    }
+
+    // only the last command can have external output
+    for (size_t i = tokens.size(), pipes_after = 0; i-- > 0;)
+    {
+      if (tokens[i].kind == TOKEN_PIPE)
+      {
+        pipes_after++;
+      }
+      else if (tokens[i].kind == TOKEN_OUTPUT && (pipes_after > 0 || output_points_num > 1))
+      {
+        return FAILURE;
+      }
+    }
+
+    return SUCCESS;
+  }
+
+  /* Clear pipeline. All memory of the command line is freed at once */
   void clear_pipeline()
   {
     command_queue.clear();
+    arena.reset();
   }
 
-  /* Obtains command pipeline work */
+  /* Obtains command pipeline work. Wall and CPU time of foreground lines are added to 'stats' of the first command */
   ERR_CODE exec()
+  {
+    if (command_queue.empty() || command_queue.front().command_name.empty() || is_background)
+    {
+      return exec_line();
+    }
+
+    std::string name(command_queue.front().command_name[0]);
+    rusage start_self{}, start_children{}, stop_self{}, stop_children{};
+    timespec start{}, stop{};
+    getrusage(RUSAGE_SELF, &start_self);
+    getrusage(RUSAGE_CHILDREN, &start_children);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ERR_CODE err_code = exec_line();
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    getrusage(RUSAGE_SELF, &stop_self);
+    getrusage(RUSAGE_CHILDREN, &stop_children);
+
+    rusage self = time_report::get_usage_diff(stop_self, start_self),
+      children = time_report::get_usage_diff(stop_children, start_children);
+    double cpu = time_report::get_seconds(self.ru_utime) + time_report::get_seconds(self.ru_stime) +
+                 time_report::get_seconds(children.ru_utime) + time_report::get_seconds(children.ru_stime);
+    command_stats::instance().add(name, time_report::get_seconds(start, stop), cpu, last_status);
+
+    return err_code;
+  }
+
+  /* Executes parsed line without measuring it. 'time' and 'timeout' run their pipelines with it */
+  ERR_CODE exec_line()
   {
     // empty command queue obtain
     if (command_queue.empty())
@@ -114,86 +302,759 @@ public:
       return SUCCESS;
     }
 
+    // obtain timeout command
+    if (command_queue.front().cmd_type == CMD_TIMEOUT)
+    {
+      IS_SUCCESS_WITH_RETURN(exec_with_timeout())
+      return SUCCESS;
+    }
+
     // execute pipeline
     auto &front_cmd = command_queue.front();
 
-    if (front_cmd.cmd_type == CMD_CD) // it has no output information and can not be part of pipeline
+    if (front_cmd.cmd_type == CMD_CD || // it has no output information and can not be part of pipeline
+        (command::is_builtin(front_cmd.cmd_type) && command_queue.size() == 1 && !is_background))
+    {
+      return exec_in_shell(front_cmd);
+    }
+
+    if (front_cmd.cmd_type == CMD_JOBS || front_cmd.cmd_type == CMD_FG ||
+        front_cmd.cmd_type == CMD_BG   || front_cmd.cmd_type == CMD_WAIT) // operate on job table of the shell
     {
-      IS_SUCCESS_WITH_RETURN(front_cmd.exec())
+      IS_SUCCESS_WITH_RETURN(exec_job_builtin(front_cmd))
       return SUCCESS;
     }
 
-    // creating pipes for pipeline. TODO : explore pipe work and may be ask how to make it work with only one pipe
-    std::vector<int[2]> pipe_array(command_queue.size() - 1);
-    for (auto &s : pipe_array)
+    // foreground builtins run on threads, they are started when all children are created.
+    // Utilities with builtin implementation become external commands where the builtin can not replace them
+    std::pmr::vector<char> in_thread(command_queue.size(), false, &arena);
+    for (size_t i = 0; i < command_queue.size(); i++)
     {
-      if (pipe2(s, O_CLOEXEC) != 0)
+      command &cmd = command_queue[i];
+      if (command::is_utility_builtin(cmd.cmd_type) &&
+          (is_background || command_queue.size() == 1 || !cmd.is_utility_builtin_usable(i > 0)))
+      {
+        cmd.cmd_type = CMD_OUT;
+      }
+      in_thread[i] = !is_background && command::is_thread_safe_builtin(cmd.cmd_type);
+    }
+
+    // creating pipes for pipeline. Stages both running on threads are connected by in-memory ring instead
+    std::pmr::vector<std::array<int, 2>> pipe_array(command_queue.size() - 1, {-1, -1}, &arena);
+    std::pmr::vector<std::shared_ptr<spsc_ring>> ring_array(command_queue.size() - 1, &arena);
+    for (size_t i = 0; i < pipe_array.size(); i++)
+    {
+      if (in_thread[i] && in_thread[i + 1])
+      {
+        ring_array[i] = std::make_shared<spsc_ring>();
+      }
+      else if (pipe2(pipe_array[i].data(), O_CLOEXEC) != 0)
       {
         std::cerr << "Can not open pipe\n";
+        close_pipes(pipe_array);
+        last_status = EXIT_FAILURE;
         ADD_LOG_WITH_RETURN(FAILURE, 3);
       }
     }
 
-    // connect created pipes so as they constitute pipeline, create child process and execute command in it
-    for (int i = 0; i < command_queue.size(); i++)
+    // background job without terminal control must not read shell input
+    int null_fd = -1;
+    if (is_background && !job_control)
+    {
+      null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    // buffered output must not be duplicated into forked children
+    std::cout.flush();
+
+    // connect created pipes so as they constitute pipeline and start every command as a child process.
+    // Background pipelines, pipelines with deadline and all pipelines under job control get own process group
+    // led by the first command
+    job &new_job = foreground_job;
+    new_job.id = 0;
+    new_job.state = JOB_RUNNING;
+    new_job.is_interrupted = false;
+    new_job.pids.clear();
+    new_job.command_line = pipeline_line;
+    new_job.status = EXIT_NOT_FOUND;
+    new_job.stage_pids.assign(command_queue.size(), -1);
+    new_job.stage_status.assign(command_queue.size(), EXIT_NOT_FOUND);
+    new_job.usage.assign(command_queue.size(), stage_usage{});
+    stage_counters.clear();
+    stage_counters.resize((count_events && !is_background) ? command_queue.size() : 0);
+    pid_t pgid = (job_control || is_background || timeout_sec > 0) ? 0 : -1;
+
+    for (size_t i = 0; i < command_queue.size(); i++)
     {
-      pid_t pid = fork();
+      int fd_in  = (i > 0)                        ? pipe_array[i - 1][READ_END] : null_fd,
+          fd_out = (i < command_queue.size() - 1) ? pipe_array[i][WRITE_END]    : -1;
+      pid_t pid = -1;
+
+      // pipe ends given to builtin thread are closed by it
+      if (in_thread[i])
+      {
+        auto stage = std::make_shared<builtin_stage>(command_queue[i], i, fd_in, fd_out);
+        stage->usage.kind = STAGE_THREAD;
+        stage->count_events = count_events;
+        if (i > 0)
+        {
+          stage->ring_in = ring_array[i - 1];
+          pipe_array[i - 1][READ_END] = -1;
+        }
+        if (i < command_queue.size() - 1)
+        {
+          stage->ring_out = ring_array[i];
+          pipe_array[i][WRITE_END] = -1;
+        }
+        builtin_stages.push_back(std::move(stage));
+        continue;
+      }
 
-      if (pid == 0) // child
+      stage_usage &usage = new_job.usage[i];
+      clock_gettime(CLOCK_MONOTONIC, &usage.start);
+      ERR_CODE launch_code = launch_stage(command_queue[i], fd_in, fd_out, pgid, pid);
+      if (launch_code == ERR_FILE_OPEN)
+      {
+        // redirection failed as it does in a forked child: command was found, but could not run
+        new_job.stage_status[i] = EXIT_FAILURE;
+      }
+      else if (launch_code == SUCCESS)
       {
-        if (command_queue.size() == 1) // no pipeline is required, that is why no pipes were create. just exec one cmd
+        clock_gettime(CLOCK_MONOTONIC, &usage.ready);
+        usage.pid = pid;
+        (uses_spawn(command_queue[i]) ? created.spawns : created.forks)++;
+        if (!stage_counters.empty())
         {
-          command_queue.front().exec();
+          stage_counters[i].open(pid);
         }
-        else if (i == 0)
+        if (pgid == 0)
         {
-          dup2(pipe_array[i][WRITE_END], STDOUT_FILENO);
-          close(pipe_array[i][READ_END]);
-          command_queue[i].exec();
+          pgid = pid;
         }
-        else if (i > 0 && i < (command_queue.size() - 1))
+        new_job.pids.push_back(pid);
+        new_job.stage_pids[i] = pid;
+      }
+    }
+    new_job.pgid = (pgid > 0) ? pgid : 0;
+    start_builtin_stages();
+
+    // close pipes. All of them are O_CLOEXEC, so children keep only the ends connected to their stdin/stdout
+    close_pipes(pipe_array);
+    if (null_fd != -1)
+    {
+      close(null_fd);
+    }
+
+    if (new_job.pids.empty() && builtin_stages.empty())
+    {
+      stage_status = new_job.stage_status;
+      last_usage = new_job.usage;
+      last_status = new_job.stage_status.back();
+      return FAILURE;
+    }
+
+    if (is_background)
+    {
+      job &bg_job = jobs.add(std::move(new_job));
+      std::cout << "[" << bg_job.id << "] " << bg_job.pgid << std::endl;
+      last_status = EXIT_SUCCESS;
+      return SUCCESS;
+    }
+
+    wait_foreground(new_job);
+    return SUCCESS;
+  }
+
+  /* Waits for job in foreground. Under job control the job owns the terminal while running.
+   * Pipeline exit status is the status of its last command. Stopped job is moved into job table */
+  void wait_foreground(job &fg_job)
+  {
+    if (job_control && fg_job.pgid > 0)
+    {
+      tcsetpgrp(STDIN_FILENO, fg_job.pgid);
+    }
+
+    watcher.wait_job(fg_job, timeout_sec);
+
+    if (job_control)
+    {
+      tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+
+    for (size_t i = 0; i < stage_counters.size() && i < fg_job.usage.size(); i++)
+    {
+      fg_job.usage[i].counters = stage_counters[i].read_values();
+    }
+    stage_counters.clear();
+
+    finish_builtin_stages(fg_job);
+
+    if (fg_job.state == JOB_STOPPED)
+    {
+      job &stopped_job = jobs.add(std::move(fg_job));
+      std::cout << std::endl;
+      job_table::print_job(std::cout, stopped_job);
+      last_status = 128 + SIGTSTP;
+      return;
+    }
+
+    stage_status = fg_job.stage_status;
+    last_usage = fg_job.usage;
+    last_status = fg_job.status;
+  }
+
+  /* Executes job control builtins: 'jobs', 'fg [job]', 'bg [job]', 'wait [job]' */
+  ERR_CODE exec_job_builtin(const command &cmd)
+  {
+    std::string job_spec = (cmd.command_name.size() > 1) ? std::string(cmd.command_name[1]) : "";
+    last_status = EXIT_SUCCESS;
+    jobs.update();
+
+    if (cmd.cmd_type == CMD_JOBS)
+    {
+      jobs.print(std::cout);
+      jobs.report_done(std::cout);
+      return SUCCESS;
+    }
+
+    if (cmd.cmd_type == CMD_WAIT && job_spec.empty())
+    {
+      // wait for every running job, stopped ones can not finish by themselves
+      std::vector<int> running_ids;
+      for (const auto &j : jobs.get_jobs())
+      {
+        if (j.state == JOB_RUNNING)
         {
-          dup2(pipe_array[i - 1][READ_END], STDIN_FILENO);
-          dup2(pipe_array[i][WRITE_END], STDOUT_FILENO);
+          running_ids.push_back(j.id);
+        }
+      }
 
-          close(pipe_array[i - 1][WRITE_END]);
-          close(pipe_array[i][READ_END]);
-          command_queue[i].exec();
+      for (int id : running_ids)
+      {
+        job *j = jobs.find(std::to_string(id));
+        watcher.wait_job(*j, 0, false);
+        if (watcher.was_interrupted())
+        {
+          last_status = 128 + SIGINT;
+          break;
         }
-        else // if (i == (command_queue.size() - 1))
+
+        last_status = j->status;
+        if (j->state == JOB_DONE)
         {
-          dup2(pipe_array[i - 1][READ_END], STDIN_FILENO);
-          close(pipe_array[i - 1][WRITE_END]);\
-          command_queue[i].exec();
+          jobs.take(id);
         }
       }
-      else // if (pid != 0) - parent
+      return SUCCESS;
+    }
+
+    job *j = jobs.find(job_spec);
+    if (j == nullptr)
+    {
+      std::cerr << cmd.command_name[0] << ": " << (job_spec.empty() ? "current" : job_spec) << ": no such job" << std::endl;
+      last_status = EXIT_FAILURE;
+      ADD_LOG_WITH_RETURN(FAILURE, 4);
+    }
+
+    switch (cmd.cmd_type)
+    {
+      case CMD_FG:
       {
-        if (i == (command_queue.size() - 1))
+        std::cout << j->command_line << std::endl;
+        job fg_job = jobs.take(j->id);
+        job_table::continue_job(fg_job);
+        wait_foreground(fg_job);
+        break;
+      }
+
+      case CMD_BG:
+      {
+        job_table::continue_job(*j);
+        std::cout << "[" << j->id << "] " << j->command_line << " &" << std::endl;
+        break;
+      }
+
+      case CMD_WAIT:
+      {
+        watcher.wait_job(*j, 0, false);
+        last_status = (j->state == JOB_STOPPED) ? 128 + SIGTSTP : j->status;
+        if (watcher.was_interrupted())
         {
-          // close pipes
-          for(auto &pipe : pipe_array)
-          {
-            // TODO : pipes correct close obtain
-            close(pipe[READ_END]);
-            close(pipe[WRITE_END]);
-          }
+          last_status = 128 + SIGINT;
+        }
+        if (j->state == JOB_DONE)
+        {
+          jobs.take(j->id);
+        }
+        break;
+      }
 
-          // collect all child processes end
-          for (int j = 0; j < command_queue.size(); j++)
-          {
-            wait(nullptr);
-          }
+      default:
+        break;
+    }
+
+    return SUCCESS;
+  }
+
+  /* Returns exit statuses of the last foreground pipeline commands in pipeline order */
+  const std::vector<int> &get_stage_status() const
+  {
+    return stage_status;
+  }
+
+  /* Returns true if SIGINT was received while the last foreground pipeline was running */
+  bool was_interrupted() const
+  {
+    return watcher.was_interrupted();
+  }
+
+  /* Reads pending shell signals without blocking. Returns true if SIGINT was among them */
+  bool consume_interrupt()
+  {
+    return watcher.consume_interrupt();
+  }
+
+  /* Reaps finished background jobs without blocking and reports them */
+  void report_jobs(std::ostream &os)
+  {
+    if (jobs.size() == 0)
+    {
+      return;
+    }
+
+    jobs.update();
+    jobs.report_done(os);
+  }
+
+  /* Enables job control if shell input is a terminal: shell ignores terminal stop signals,
+   * becomes a process group leader and takes terminal */
+  void enable_job_control()
+  {
+    if (!isatty(STDIN_FILENO))
+    {
+      return;
+    }
+
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    setpgid(0, 0);
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = true;
+  }
+
+  /* Returns exit status of the last executed pipeline */
+  int get_last_status() const
+  {
+    return last_status;
+  }
+
+  /* Returns number of background and stopped jobs */
+  size_t get_job_count() const
+  {
+    return jobs.size();
+  }
+
+  /* Returns numbers of processes created for pipeline stages */
+  const process_counts &get_process_counts() const
+  {
+    return created;
+  }
+
+  /* Returns true if 'exit' builtin finished the shell */
+  bool is_exit_requested() const
+  {
+    return exit_requested;
+  }
+
+  /* Executes builtin in the shell process. '<'/'>' redirections are applied to shell standard streams
+   * and undone after the builtin finishes */
+  ERR_CODE exec_in_shell(command &cmd)
+  {
+    std::cout.flush();
+
+    stage_usage usage;
+    usage.kind = STAGE_SHELL;
+    clock_gettime(CLOCK_MONOTONIC, &usage.start);
+    usage.ready = usage.start;
+    rusage start_usage = time_report::get_thread_usage();
+    perf_counters counters;
+    if (count_events)
+    {
+      counters.open(0);
+    }
+
+    int saved_in  = cmd.input_file_name.empty()  ? -1 : fcntl(STDIN_FILENO,  F_DUPFD_CLOEXEC, 10),
+        saved_out = cmd.output_file_name.empty() ? -1 : fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+
+    int status = EXIT_FAILURE;
+    if (cmd.io_redirect() == SUCCESS)
+    {
+      status = cmd.exec_builtin(std::cin, std::cout, last_status);
+      std::cout.flush();
+    }
+    std::cout.clear();
+
+    if (saved_in != -1)
+    {
+      dup2(saved_in, STDIN_FILENO);
+      close(saved_in);
+    }
+    if (saved_out != -1)
+    {
+      dup2(saved_out, STDOUT_FILENO);
+      close(saved_out);
+    }
+
+    if (cmd.cmd_type == CMD_EXIT && builtin_commands::get_exit_permission(cmd.command_name))
+    {
+      exit_requested = true;
+    }
+
+    usage.usage = time_report::get_usage_diff(time_report::get_thread_usage(), start_usage);
+    clock_gettime(CLOCK_MONOTONIC, &usage.end);
+    usage.counters = counters.read_values();
+    usage.is_finished = true;
+    last_usage.assign(1, usage);
+
+    stage_status.assign(1, status);
+    last_status = status;
+    return (status == EXIT_SUCCESS) ? SUCCESS : FAILURE;
+  }
+
+  /* Starts threads of pipeline builtins. Builtin runs synchronously if thread can not be created */
+  void start_builtin_stages()
+  {
+    for (auto &stage : builtin_stages)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &stage->usage.start);
+      try
+      {
+        stage->thread = std::thread([stage]() { stage->status = run_builtin_stage(*stage); });
+      }
+      catch (const std::system_error &)
+      {
+        stage->status = run_builtin_stage(*stage);
+      }
+    }
+  }
+
+  /* Waits for pipeline builtin threads and writes their exit statuses into the job.
+   * Threads of stopped job are detached: they may be blocked by a stopped reader */
+  void finish_builtin_stages(job &fg_job)
+  {
+    for (auto &stage : builtin_stages)
+    {
+      if (!stage->thread.joinable())
+      {
+        fg_job.stage_status[stage->index] = stage->status;
+        fg_job.usage[stage->index] = stage->usage;
+      }
+      else if (fg_job.state == JOB_STOPPED)
+      {
+        stage->thread.detach();
+        fg_job.stage_status[stage->index] = EXIT_SUCCESS;
+      }
+      else
+      {
+        stage->thread.join();
+        fg_job.stage_status[stage->index] = stage->status;
+        fg_job.usage[stage->index] = stage->usage;
+      }
+    }
+
+    if (!builtin_stages.empty() && !fg_job.stage_status.empty())
+    {
+      fg_job.status = fg_job.stage_status.back();
+
+      // builtin thread never sees SIGINT: pipeline ending with it is reported as killed by SIGINT if the shell
+      // got SIGINT or, when the job owns the terminal, another command of the job was killed by it
+      bool is_interrupted = watcher.was_interrupted() || fg_job.is_interrupted;
+      if (builtin_stages.back()->index + 1 == fg_job.stage_status.size() && is_interrupted &&
+          fg_job.state != JOB_STOPPED)
+      {
+        fg_job.status = 128 + SIGINT;
+      }
+    }
+    builtin_stages.clear();
+  }
+
+  /* Runs pipeline builtin with input and output connected to its pipe ends, rings or redirected files.
+   * Closes pipe ends and rings of the stage when builtin finishes. Returns exit status */
+  static int run_builtin_stage(builtin_stage &stage)
+  {
+    command &cmd = stage.cmd;
+    int fd_in = stage.fd_in, fd_out = stage.fd_out, status = EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &stage.usage.ready);
+    rusage start_usage = time_report::get_thread_usage();
+    perf_counters counters;
+    if (stage.count_events)
+    {
+      counters.open(0);
+    }
+
+    if (!cmd.input_file_name.empty())
+    {
+      fd_in = open(cmd.input_file_name.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd_in == -1)
+      {
+        print_err(std::cerr, ERR_FILE_OPEN);
+        cmd.cmd_type = CMD_OUT; // nothing is to be executed
+      }
+    }
+
+    if (!cmd.output_file_name.empty())
+    {
+      fd_out = open(cmd.output_file_name.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, S_IWRITE | S_IREAD);
+      if (fd_out == -1)
+      {
+        print_err(std::cerr, ERR_FILE_OPEN);
+        cmd.cmd_type = CMD_OUT;
+      }
+    }
+
+    if (cmd.cmd_type != CMD_OUT)
+    {
+      std::unique_ptr<std::istream> is;
+      std::unique_ptr<std::ostream> os;
+
+      if (stage.ring_in != nullptr) { is = std::make_unique<ring_istream>(*stage.ring_in); }
+      else                          { is = std::make_unique<fd_istream>(fd_in);            }
+      if (stage.ring_out != nullptr) { os = std::make_unique<ring_ostream>(*stage.ring_out);                          }
+      else                           { os = std::make_unique<fd_ostream>((fd_out == -1) ? STDOUT_FILENO : fd_out); }
+
+      status = cmd.exec_builtin(*is, *os, EXIT_SUCCESS);
+      os.reset(); // buffered output is written before the write end is closed
+    }
+
+    if (fd_in != -1)
+    {
+      close(fd_in);
+    }
+    if (fd_out != -1)
+    {
+      close(fd_out);
+    }
+    if (stage.ring_in != nullptr)
+    {
+      stage.ring_in->close_read();
+    }
+    if (stage.ring_out != nullptr)
+    {
+      stage.ring_out->close_write();
+    }
+
+    stage.usage.usage = time_report::get_usage_diff(time_report::get_thread_usage(), start_usage);
+    clock_gettime(CLOCK_MONOTONIC, &stage.usage.end);
+    stage.usage.counters = counters.read_values();
+    stage.usage.is_finished = true;
+    return status;
+  }
+
+  /* Closes pipe ends which are not given away (set to -1) */
+  static void close_pipes(std::pmr::vector<std::array<int, 2>> &pipe_array)
+  {
+    for (auto &pipe : pipe_array)
+    {
+      close_pipes(pipe.data());
+    }
+  }
+
+  /* Closes ends of one pipe which are not given away (set to -1) */
+  static void close_pipes(int pipe[2])
+  {
+    for (int i = READ_END; i <= WRITE_END; i++)
+    {
+      if (pipe[i] != -1)
+      {
+        close(pipe[i]);
+        pipe[i] = -1;
+      }
+    }
+  }
+
+  /* Starts one pipeline stage as a child process with standard streams connected to given descriptors.
+   * External commands are spawned without copying the shell unless 'SPAWN_FORK' backend is chosen;
+   * shell builtins always need a forked copy of the shell.
+   *
+   * @param cmd    - command to be executed
+   * @param fd_in  - descriptor to become standard input of the stage or -1 to leave it untouched
+   * @param fd_out - descriptor to become standard output of the stage or -1 to leave it untouched
+   * @param pgid   - process group to put the stage in: 0 - new group, -1 - process group of the shell
+   * @param pid    - reference to the variable where child process id is to be written */
+  ERR_CODE launch_stage(command &cmd, int fd_in, int fd_out, pid_t pgid, pid_t &pid) const
+  {
+    if (cmd.cmd_type == CMD_OUT)
+    {
+      // location is resolved in the shell process, so that it is remembered for the next commands
+      IS_SUCCESS_WITH_RETURN(cmd.resolve_exec_path())
+    }
+
+    // argument array is built in the shell, so forked child does not touch copied memory before 'exec'
+    cmd.command_name.prepare_argv();
+
+    if (uses_spawn(cmd))
+    {
+      return cmd.spawn(fd_in, fd_out, pgid, pid);
+    }
+
+    return fork_stage(cmd, fd_in, fd_out, pgid, pid);
+  }
+
+  /* Checks if stage is started by posix_spawn instead of forking the shell */
+  bool uses_spawn(const command &cmd) const
+  {
+    return backend == SPAWN_POSIX && cmd.cmd_type == CMD_OUT;
+  }
+
+  /* Forks the shell and executes command in the child. Child never returns to the shell loop.
+   * Timed pipeline waits until the child closes its copy of a close-on-exec pipe - by 'exec' or, for builtins,
+   * by 'close_cloexec_fds' - so that spawn latency is measured as with 'posix_spawn' */
+  ERR_CODE fork_stage(command &cmd, int fd_in, int fd_out, pid_t pgid, pid_t &pid) const
+  {
+    int ready_pipe[2] = {-1, -1};
+    if (is_timed && pipe2(ready_pipe, O_CLOEXEC) != 0)
+    {
+      ready_pipe[READ_END] = ready_pipe[WRITE_END] = -1;
+    }
+
+    pid = fork();
+
+    if (pid == -1)
+    {
+      perror("fork");
+      close_pipes(ready_pipe);
+      ADD_LOG_WITH_RETURN(FAILURE, 6);
+    }
+
+    if (pid != 0 && ready_pipe[READ_END] != -1)
+    {
+      close(ready_pipe[WRITE_END]);
+      char byte;
+      while (read(ready_pipe[READ_END], &byte, 1) == -1 && errno == EINTR)
+      {
+      }
+      close(ready_pipe[READ_END]);
+    }
+
+    if (pid != 0 && pgid != -1) // parent. Group is set by both processes, so it exists before anyone relies on it
+    {
+      setpgid(pid, (pgid == 0) ? pid : pgid);
+    }
+
+    if (pid == 0) // child
+    {
+      if (pgid != -1)
+      {
+        setpgid(0, pgid);
+      }
+
+      sigset_t default_signals = command::get_job_control_signals();
+      for (int sig = 1; sig < NSIG; sig++)
+      {
+        if (sigismember(&default_signals, sig) == 1)
+        {
+          signal(sig, SIG_DFL);
         }
       }
+
+      sigset_t empty_mask;
+      sigemptyset(&empty_mask);
+      sigprocmask(SIG_SETMASK, &empty_mask, nullptr);
+
+      if (fd_in != -1)
+      {
+        dup2(fd_in, STDIN_FILENO);
+      }
+      if (fd_out != -1)
+      {
+        dup2(fd_out, STDOUT_FILENO);
+      }
+      close_cloexec_fds();
+
+      int status = (cmd.cmd_type == CMD_PARALLEL) ? exec_parallel(cmd) : cmd.exec();
+
+      std::cout.flush();
+      _exit(status);
     }
 
     return SUCCESS;
   }
 
-  /* Initiates pipeline execution removing measuring time and removing 'time' command from command queue
-   * Note : function does not obtain situation when time containing variable are overfilled and so on.
-   * TODO : ask is function should do queue empty-check and check if first element of command name is 'time' */
+  /* Closes descriptors marked close-on-exec as 'exec' would do.
+   * Builtin executed in forked copy of the shell must not keep pipe ends of other stages open */
+  static void close_cloexec_fds()
+  {
+    DIR *fd_dir = opendir("/proc/self/fd");
+    if (fd_dir == nullptr)
+    {
+      return;
+    }
+
+    std::vector<int> cloexec_fds;
+    for (dirent *d = readdir(fd_dir); d != nullptr; d = readdir(fd_dir))
+    {
+      int fd = atoi(d->d_name);
+      if (fd > STDERR_FILENO && fd != dirfd(fd_dir) && (fcntl(fd, F_GETFD) & FD_CLOEXEC) != 0)
+      {
+        cloexec_fds.push_back(fd);
+      }
+    }
+    closedir(fd_dir);
+
+    for (int fd : cloexec_fds)
+    {
+      close(fd);
+    }
+  }
+
+  /* Executes 'parallel' builtin in forked copy of the shell. Command instances are started as pipeline stages.
+   * Returns exit status of the builtin */
+  int exec_parallel(command &cmd) const
+  {
+    ERR_CODE err_code = SUCCESS;
+    std::vector<std::string> args = cmd.command_name.to_strings(1);
+    parallel_runner runner(args,
+                           [this](command &instance_cmd, int fd_in, int fd_out, pid_t &pid)
+                           {
+                             return launch_stage(instance_cmd, fd_in, fd_out, -1, pid);
+                           },
+                           err_code);
+
+    if (err_code != SUCCESS || cmd.io_redirect() != SUCCESS)
+    {
+      return EXIT_SYNTAX_ERROR;
+    }
+
+    return runner.run();
+  }
+
+  /* Returns backend chosen by 'MICROSHA_SPAWN' environment variable ("fork" or "spawn"). Default is 'SPAWN_POSIX' */
+  static spawn_backend get_default_backend()
+  {
+    const char *backend_name = getenv("MICROSHA_SPAWN");
+
+    if (backend_name != nullptr && strcmp(backend_name, "fork") == 0)
+    {
+      return SPAWN_FORK;
+    }
+    return SPAWN_POSIX;
+  }
+
+  /* Sets process creation backend for external commands */
+  void set_backend(spawn_backend new_backend)
+  {
+    backend = new_backend;
+  }
+
+  /* Initiates pipeline execution removing measuring time and removing 'time [-c] [-v | --json]' prefix from command queue.
+   * Real time is measured by monotonic clock, user and sys time is that of the shell and its reaped children.
+   * '-v' adds the table of pipeline stages, '--json' prints everything as one JSON object.
+   * '-c' counts perf_events (cycles, instructions, cache and branch misses, page faults...) of the pipeline -
+   * by counters of the shell inherited by its new threads and children - and of every stage */
   ERR_CODE exec_with_time()
   {
     if (command_queue.empty() || command_queue.front().cmd_type != CMD_TIME)
@@ -201,33 +1062,123 @@ public:
       return ERR_WRONG_INPUT;
     }
 
-    // remove 'time' mark from the first command of the queue front
+    // remove 'time' mark and its options from the first command of the queue front
     auto &front_command = command_queue.front();
-    front_command.command_name.erase(front_command.command_name.begin());
-    front_command.cmd_type = (command_queue.empty()) ? CMD_OUT : command::get_command_type(front_command.command_name[0]);
+    auto &args = front_command.command_name;
+    time_format format = TIME_SHORT;
+    time_measure measure;
+    args.erase_front(1);
+    while (!args.empty() && args[0].size() > 1 && args[0][0] == '-')
+    {
+      if      (args[0] == "-v")     { format = TIME_VERBOSE;   }
+      else if (args[0] == "--json") { format = TIME_JSON;      }
+      else if (args[0] == "-c")     { measure.is_counted = true; }
+      else if (args[0] != "--")
+      {
+        std::cerr << "Usage : time [-c] [-v | --json] command" << std::endl;
+        last_status = EXIT_SYNTAX_ERROR;
+        ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 4);
+      }
+
+      bool is_end = (args[0] == "--");
+      args.erase_front(1);
+      if (is_end)
+      {
+        break;
+      }
+    }
+    front_command.cmd_type = (args.empty()) ? CMD_OUT : command::get_command_type(args[0]);
 
     // initiate execution of left pipeline commands with time check
-    auto cps = sysconf(_SC_CLK_TCK); // clicks per second
-    tms start{}, stop{};
-    clock_t start_real_time = times(&start);
-    exec();
-    clock_t stop_real_time = times(&stop);
+    for (const auto &cmd : command_queue)
+    {
+      measure.names.push_back(get_command_line(cmd));
+    }
+
+    rusage start_self{}, start_children{}, stop_self{}, stop_children{};
+    timespec start{}, stop{};
+    last_usage.clear();
+    getrusage(RUSAGE_SELF, &start_self);
+    getrusage(RUSAGE_CHILDREN, &start_children);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    perf_counters counters;
+    if (measure.is_counted)
+    {
+      counters.open(0);
+    }
+
+    is_timed = true;
+    count_events = measure.is_counted;
+    exec_line();
+    is_timed = false;
+    count_events = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    getrusage(RUSAGE_SELF, &stop_self);
+    getrusage(RUSAGE_CHILDREN, &stop_children);
+
+    rusage self = time_report::get_usage_diff(stop_self, start_self),
+           children = time_report::get_usage_diff(stop_children, start_children);
+    measure.real = time_report::get_seconds(start, stop);
+    measure.user = time_report::get_seconds(self.ru_utime) + time_report::get_seconds(children.ru_utime);
+    measure.sys  = time_report::get_seconds(self.ru_stime) + time_report::get_seconds(children.ru_stime);
+    measure.status = last_status;
+    measure.stages = last_usage;
+    measure.stage_status = stage_status;
+    measure.counters = counters.read_values();
 
     // print time values
-    std::cout.setf(std::ios::fixed);
-    std::cout << std::setprecision(3)
-      << "real : " << get_time_in_sec(stop_real_time - start_real_time, cps) << "s" << std::endl
-      << "user : " << get_time_in_sec((stop.tms_utime + stop.tms_cutime) - (start.tms_utime + start.tms_cutime), cps) << "s" << std::endl
-      << "sys  : " << get_time_in_sec((stop.tms_stime + stop.tms_cstime) - (start.tms_stime + start.tms_cstime), cps) << "s" << std::endl;
-    std::cout.unsetf(std::ios::fixed);
+    time_report::print(std::cout, measure, format);
+    std::cout.flush();
 
     return SUCCESS;
   }
 
-  /* Returns time between 'start' and 'stop', which are given in clock_t, in seconds */
-  static long double get_time_in_sec(clock_t time, long clocks_per_second)
+  /* Returns command line of pipeline command: its arguments separated by spaces */
+  static std::string get_command_line(const command &cmd)
+  {
+    std::string line;
+
+    for (size_t i = 0; i < cmd.command_name.size(); i++)
+    {
+      line += (i > 0) ? " " : "";
+      line += cmd.command_name[i];
+    }
+
+    return line;
+  }
+
+  /* Initiates pipeline execution with deadline removing 'timeout seconds' prefix from command queue.
+   * Pipeline running past deadline gets SIGTERM, and SIGKILL one second later. Its exit status is 124 then */
+  ERR_CODE exec_with_timeout()
   {
-    return (long double)time / clocks_per_second;
+    if (command_queue.empty() || command_queue.front().cmd_type != CMD_TIMEOUT)
+    {
+      return ERR_WRONG_INPUT;
+    }
+
+    auto &front_command = command_queue.front();
+    auto &args = front_command.command_name;
+    char *number_end = nullptr;
+    double seconds = (args.size() > 2) ? strtod(args.c_str(1), &number_end) : 0;
+
+    if (number_end == nullptr || *number_end != '\0' || seconds <= 0)
+    {
+      std::cerr << "Usage : timeout seconds command" << std::endl;
+      last_status = EXIT_TIMEOUT + 1;
+      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 4);
+    }
+
+    // remove 'timeout' prefix from the first command of the queue front
+    args.erase_front(2);
+    front_command.cmd_type = command::get_command_type(args[0]);
+
+    timeout_sec = seconds;
+    ERR_CODE err_code = exec_line();
+    timeout_sec = 0;
+
+    return err_code;
   }
 };
 
@@ -0,0 +1,293 @@
+#ifndef MICROSHA_COMMAND_STATS_H
+#define MICROSHA_COMMAND_STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <ostream>
+
+#include "time_report.h"
+#include "history.h"
+
+#define LATENCY_SUB_BUCKET_BITS 4  // 16 buckets per power of two: quantiles are within 1/16 of the value
+#define LATENCY_MAX_EXPONENT 40    // values are limited by 2^40 microseconds (12 days)
+#define STATS_MAX_COMMANDS 256     // later command names are counted as "(other)"
+
+/* Log-bucket histogram of microsecond values (as HdrHistogram): values below 16 have own buckets, every next
+ * power of two range is split into 16 equal buckets. Memory grows only up to the bucket of the largest value -
+ * about 1.2 KiB for values of an hour - and does not depend on the number of values */
+class latency_histogram
+{
+private:
+  std::vector<uint32_t> counts;
+  uint64_t count = 0;
+  uint64_t min_value = UINT64_MAX, max_value = 0;
+  double total = 0; // sum of values in seconds
+
+public:
+  /* Adds value in seconds */
+  void add(double seconds)
+  {
+    auto value = (uint64_t)std::max(seconds * 1e6, 0.0);
+    value = std::min(value, (uint64_t)1 << LATENCY_MAX_EXPONENT);
+
+    size_t index = get_bucket(value);
+    if (index >= counts.size())
+    {
+      counts.resize(index + 1);
+    }
+    counts[index]++;
+    count++;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+    total += seconds;
+  }
+
+  /* Returns value in seconds below which 'q' (0..1) of values are. Result is the middle of its bucket */
+  double get_quantile(double q) const
+  {
+    if (count == 0)
+    {
+      return 0;
+    }
+
+    auto rank = (uint64_t)std::max(std::ceil(q * (double)count), 1.0);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+      {
+        uint64_t low = get_bucket_low(i), width = get_bucket_low(i + 1) - low;
+        uint64_t value = std::clamp(low + width / 2, min_value, max_value);
+        return (double)value * 1e-6;
+      }
+    }
+    return (double)max_value * 1e-6;
+  }
+
+  /* Returns number of values */
+  uint64_t get_count() const
+  {
+    return count;
+  }
+
+  /* Returns sum of values in seconds */
+  double get_total() const
+  {
+    return total;
+  }
+
+  /* Returns the largest value in seconds */
+  double get_max() const
+  {
+    return (double)max_value * 1e-6;
+  }
+
+private:
+  /* Returns bucket index of value */
+  static size_t get_bucket(uint64_t value)
+  {
+    const uint64_t sub_buckets = 1 << LATENCY_SUB_BUCKET_BITS;
+    if (value < sub_buckets)
+    {
+      return value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    uint64_t sub = (value >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (sub_buckets - 1);
+    return (exponent - LATENCY_SUB_BUCKET_BITS + 1) * sub_buckets + sub;
+  }
+
+  /* Returns the smallest value of bucket */
+  static uint64_t get_bucket_low(size_t index)
+  {
+    const uint64_t sub_buckets = 1 << LATENCY_SUB_BUCKET_BITS;
+    if (index < sub_buckets)
+    {
+      return index;
+    }
+
+    int exponent = (int)(index / sub_buckets) + LATENCY_SUB_BUCKET_BITS - 1;
+    return (sub_buckets + index % sub_buckets) << (exponent - LATENCY_SUB_BUCKET_BITS);
+  }
+};
+
+/* Statistics of one command */
+struct command_record
+{
+  uint64_t failures = 0;     // lines with non-zero exit status
+  latency_histogram wall;    // real time of lines
+  latency_histogram cpu;     // user and sys time of the shell and children reaped during lines
+};
+
+/* Per-command latency statistics of executed lines ('stats' builtin). Lines are counted by the name of their
+ * first command. Wall and CPU time are measured around 'command_pipeline::exec', background lines are not counted */
+class command_stats
+{
+private:
+  std::unordered_map<std::string, command_record> records;
+
+public:
+  /* Default class constructor */
+  command_stats()
+  =default;
+
+  /* Default class destructor */
+  ~command_stats()
+  =default;
+
+  command_stats(const command_stats &) = delete;
+  command_stats &operator=(const command_stats &) = delete;
+
+  /* Returns shell-wide statistics instance */
+  static command_stats &instance()
+  {
+    static command_stats stats;
+    return stats;
+  }
+
+  /* Adds line measurements.
+   *
+   * @param name   - command name, directories are dropped
+   * @param wall   - real time in seconds
+   * @param cpu    - user and sys time in seconds, negative if unknown
+   * @param status - exit status */
+  void add(std::string_view name, double wall, double cpu, int status)
+  {
+    command_record &record = get_record(name);
+    record.wall.add(wall);
+    if (cpu >= 0)
+    {
+      record.cpu.add(cpu);
+    }
+    record.failures += (status != EXIT_SUCCESS);
+  }
+
+  /* Forgets all measurements ('stats -r') */
+  void clear()
+  {
+    records.clear();
+  }
+
+  /* Adds durations and exit statuses of history entries. CPU time is not kept in history */
+  void add_history(command_history &history)
+  {
+    history.for_each([this](std::string_view line, double duration, int status)
+                     {
+                       size_t name_begin = line.find_first_not_of(" \t");
+                       if (name_begin != std::string_view::npos)
+                       {
+                         size_t name_end = std::min(line.find_first_of(" \t|<>&", name_begin), line.size());
+                         add(line.substr(name_begin, name_end - name_begin), duration, -1, status);
+                       }
+                     });
+  }
+
+  /* Prints table of commands sorted by total time: count, failures, total time, wall time quantiles
+   * and CPU time median */
+  void print(std::ostream &os) const
+  {
+    char line[256];
+    snprintf(line, sizeof(line), "%-20s %8s %6s %12s %10s %10s %10s %13s %13s\n", "command", "count", "fail",
+             "total, s", "p50, ms", "p90, ms", "p99, ms", "cpu p50, ms", "cpu total, s");
+    os << line;
+
+    for (const auto *entry : get_sorted())
+    {
+      const command_record &record = entry->second;
+      snprintf(line, sizeof(line), "%-20s %8llu %6llu %12.3f %10.3f %10.3f %10.3f ", entry->first.c_str(),
+               (unsigned long long)record.wall.get_count(), (unsigned long long)record.failures, record.wall.get_total(),
+               record.wall.get_quantile(0.5) * 1e3, record.wall.get_quantile(0.9) * 1e3, record.wall.get_quantile(0.99) * 1e3);
+      os << line;
+
+      if (record.cpu.get_count() > 0)
+      {
+        snprintf(line, sizeof(line), "%13.3f %13.3f\n", record.cpu.get_quantile(0.5) * 1e3, record.cpu.get_total());
+      }
+      else
+      {
+        snprintf(line, sizeof(line), "%13s %13s\n", "-", "-");
+      }
+      os << line;
+    }
+  }
+
+  /* Prints statistics as one JSON object line sorted as the table. Times are in seconds, "cpu" is null if unknown */
+  void print_json(std::ostream &os) const
+  {
+    os << "{\"commands\":[";
+
+    bool is_first = true;
+    for (const auto *entry : get_sorted())
+    {
+      const command_record &record = entry->second;
+      os << (is_first ? "{\"name\":" : ",{\"name\":");
+      time_report::write_json_string(os, entry->first);
+      os << ",\"count\":" << record.wall.get_count() << ",\"failures\":" << record.failures << ",\"wall\":";
+      write_json_histogram(os, record.wall);
+      os << ",\"cpu\":";
+      if (record.cpu.get_count() > 0) { write_json_histogram(os, record.cpu); }
+      else                            { os << "null";                         }
+      os << "}";
+      is_first = false;
+    }
+
+    os << "]}" << std::endl;
+  }
+
+private:
+  /* Returns record of command. Names over the limit share one record */
+  command_record &get_record(std::string_view name)
+  {
+    size_t slash = name.rfind('/');
+    if (slash != std::string_view::npos && slash + 1 < name.size())
+    {
+      name.remove_prefix(slash + 1);
+    }
+
+    std::string key(name);
+    auto record = records.find(key);
+    if (record != records.end())
+    {
+      return record->second;
+    }
+
+    return records[(records.size() < STATS_MAX_COMMANDS) ? key : "(other)"];
+  }
+
+  /* Returns records sorted by total wall time, the largest first */
+  std::vector<const std::pair<const std::string, command_record> *> get_sorted() const
+  {
+    std::vector<const std::pair<const std::string, command_record> *> sorted;
+    sorted.reserve(records.size());
+    for (const auto &entry : records)
+    {
+      sorted.push_back(&entry);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](const auto *a, const auto *b)
+              {
+                return a->second.wall.get_total() > b->second.wall.get_total();
+              });
+    return sorted;
+  }
+
+  /* Writes total, quantiles and maximum of histogram as JSON object */
+  static void write_json_histogram(std::ostream &os, const latency_histogram &histogram)
+  {
+    char values[256];
+    snprintf(values, sizeof(values), "{\"total\":%.6f,\"p50\":%.6f,\"p90\":%.6f,\"p99\":%.6f,\"max\":%.6f}",
+             histogram.get_total(), histogram.get_quantile(0.5), histogram.get_quantile(0.9),
+             histogram.get_quantile(0.99), histogram.get_max());
+    os << values;
+  }
+};
+
+#endif //MICROSHA_COMMAND_STATS_H
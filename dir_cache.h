@@ -0,0 +1,300 @@
+#ifndef MICROSHA_DIR_CACHE_H
+#define MICROSHA_DIR_CACHE_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+
+#define DIR_CACHE_DEFAULT_BUDGET_KB 16384
+#define GETDENTS_BUFFER_SIZE (1 << 16)
+
+/* Directory entry kept in the listing */
+struct dir_entry
+{
+  std::string name;
+  unsigned char type; // 'd_type' value. Never 'DT_UNKNOWN' in listings: it is resolved by 'fstatat' when listing is read
+  ino_t ino;          // 'd_ino' value
+};
+
+/* Directory content sorted by name */
+struct dir_listing
+{
+  std::vector<dir_entry> entries;
+  size_t memory_size = 0; // approximate number of bytes held by the listing
+};
+
+/* Shell-wide cache of directory listings for filename expansion.
+ * Listings are keyed by directory device and inode, so every path leading to the directory shares one listing.
+ * Every cached directory has an inotify watch: any entry creation, removal or rename, or removal of
+ * the directory itself, drops the listing. Watch is added before the directory is read, so changes made
+ * while it is being read are noticed too. Pending events are applied by 'sync' once before every expansion.
+ * Least recently used listings are evicted when the total size exceeds the budget
+ * set by 'MICROSHA_DIR_CACHE_KB' environment variable (default 16 MiB, 0 disables the cache). */
+class dir_cache
+{
+private:
+  /* Directory identity */
+  struct dir_key
+  {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const dir_key &other) const { return dev == other.dev && ino == other.ino; }
+  };
+
+  struct dir_key_hash
+  {
+    size_t operator()(const dir_key &key) const { return std::hash<ino_t>()(key.ino) * 31 + key.dev; }
+  };
+
+  /* Cached listing */
+  struct cache_entry
+  {
+    std::shared_ptr<const dir_listing> listing;
+    int watch = -1;
+    std::list<dir_key>::iterator lru_pos; // position in 'lru', the most recently used listing is the first
+  };
+
+  std::mutex lock;
+  int inotify_fd = -1;
+  size_t budget = 0;
+  size_t used = 0;
+  std::unordered_map<dir_key, cache_entry, dir_key_hash> entries;
+  std::unordered_map<int, dir_key> watches;
+  std::list<dir_key> lru;
+
+public:
+  /* Class constructor. Reads budget and creates inotify instance */
+  dir_cache()
+  {
+    const char *budget_kb = getenv("MICROSHA_DIR_CACHE_KB");
+    budget = (size_t)((budget_kb == nullptr) ? DIR_CACHE_DEFAULT_BUDGET_KB : strtoul(budget_kb, nullptr, 10)) * 1024;
+
+    if (budget > 0)
+    {
+      inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+  }
+
+  /* Class destructor */
+  ~dir_cache()
+  {
+    if (inotify_fd != -1)
+    {
+      close(inotify_fd);
+    }
+  }
+
+  dir_cache(const dir_cache &) = delete;
+  dir_cache &operator=(const dir_cache &) = delete;
+
+  /* Returns shell-wide cache instance */
+  static dir_cache &instance()
+  {
+    static dir_cache cache;
+    return cache;
+  }
+
+  /* Drops listings of directories changed since the last call */
+  void sync()
+  {
+    if (inotify_fd == -1)
+    {
+      return;
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    ssize_t read_size;
+    std::lock_guard<std::mutex> guard(lock);
+
+    while ((read_size = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+      for (ssize_t offset = 0; offset < read_size;)
+      {
+        auto *event = (inotify_event *)(buffer + offset);
+        offset += (ssize_t)sizeof(inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+          drop_all();
+          continue;
+        }
+
+        auto watch = watches.find(event->wd);
+        if (watch != watches.end())
+        {
+          drop(watch->second, (event->mask & IN_IGNORED) == 0);
+        }
+      }
+    }
+  }
+
+  /* Returns cached listing of directory with given identity or nullptr */
+  std::shared_ptr<const dir_listing> find(dev_t dev, ino_t ino)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto entry = entries.find({dev, ino});
+    if (entry == entries.end())
+    {
+      return nullptr;
+    }
+
+    lru.splice(lru.begin(), lru, entry->second.lru_pos);
+    return entry->second.listing;
+  }
+
+  /* Returns listing of opened directory from the cache. If it is not cached and 'read_if_missing' is set,
+   * reads the directory and caches it, otherwise returns nullptr.
+   * Directory identity is written to 'dev' and 'ino' */
+  std::shared_ptr<const dir_listing> get(int dir_fd, dev_t &dev, ino_t &ino, bool read_if_missing)
+  {
+    struct stat st{};
+    if (fstat(dir_fd, &st) != 0)
+    {
+      return read_if_missing ? read_listing(dir_fd) : nullptr;
+    }
+    dev = st.st_dev;
+    ino = st.st_ino;
+
+    if (inotify_fd == -1)
+    {
+      return read_if_missing ? read_listing(dir_fd) : nullptr;
+    }
+
+    std::shared_ptr<const dir_listing> listing = find(dev, ino);
+    if (listing != nullptr || !read_if_missing)
+    {
+      return listing;
+    }
+
+    // "/proc/self/fd" link lets inotify watch exactly the opened directory
+    std::string fd_path = "/proc/self/fd/" + std::to_string(dir_fd);
+    int watch = inotify_add_watch(inotify_fd, fd_path.c_str(),
+                                  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                  IN_ONLYDIR);
+    listing = read_listing(dir_fd);
+
+    if (watch != -1)
+    {
+      insert({dev, ino}, watch, listing);
+    }
+    return listing;
+  }
+
+  /* Reads directory content in large 'getdents64' batches and sorts it by name */
+  static std::shared_ptr<const dir_listing> read_listing(int dir_fd)
+  {
+    /* 'getdents64' record */
+    struct linux_dirent64
+    {
+      ino64_t        d_ino;
+      off64_t        d_off;
+      unsigned short d_reclen;
+      unsigned char  d_type;
+      char           d_name[];
+    };
+
+    auto listing = std::make_shared<dir_listing>();
+    std::unique_ptr<char[]> buffer(new char[GETDENTS_BUFFER_SIZE]);
+
+    long read_size;
+    while ((read_size = syscall(SYS_getdents64, dir_fd, buffer.get(), GETDENTS_BUFFER_SIZE)) > 0)
+    {
+      for (long offset = 0; offset < read_size;)
+      {
+        auto *d = (linux_dirent64 *)(buffer.get() + offset);
+        offset += d->d_reclen;
+
+        if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+        {
+          continue;
+        }
+
+        unsigned char type = d->d_type;
+        if (type == DT_UNKNOWN)
+        {
+          struct stat st{};
+          type = (fstatat(dir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) ? (unsigned char)IFTODT(st.st_mode)
+                                                                              : (unsigned char)DT_REG;
+        }
+
+        listing->entries.push_back({d->d_name, type, (ino_t)d->d_ino});
+        listing->memory_size += sizeof(dir_entry) + listing->entries.back().name.capacity();
+      }
+    }
+
+    std::sort(listing->entries.begin(), listing->entries.end(),
+              [](const dir_entry &a, const dir_entry &b) { return a.name < b.name; });
+    return listing;
+  }
+
+private:
+  /* Adds listing to the cache evicting least recently used ones to fit the budget */
+  void insert(const dir_key &key, int watch, const std::shared_ptr<const dir_listing> &listing)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (listing->memory_size > budget || entries.count(key) != 0)
+    {
+      if (entries.count(key) == 0)
+      {
+        inotify_rm_watch(inotify_fd, watch);
+      }
+      return;
+    }
+
+    while (used + listing->memory_size > budget && !lru.empty())
+    {
+      drop(lru.back(), true);
+    }
+
+    lru.push_front(key);
+    entries[key] = {listing, watch, lru.begin()};
+    watches[watch] = key;
+    used += listing->memory_size;
+  }
+
+  /* Removes listing from the cache. Watch is removed too unless the kernel already did it */
+  void drop(dir_key key, bool remove_watch)
+  {
+    auto entry = entries.find(key);
+    if (entry == entries.end())
+    {
+      return;
+    }
+
+    if (remove_watch)
+    {
+      inotify_rm_watch(inotify_fd, entry->second.watch);
+    }
+    watches.erase(entry->second.watch);
+    lru.erase(entry->second.lru_pos);
+    used -= entry->second.listing->memory_size;
+    entries.erase(entry);
+  }
+
+  /* Removes all listings */
+  void drop_all()
+  {
+    while (!lru.empty())
+    {
+      drop(lru.back(), true);
+    }
+  }
+};
+
+#endif //MICROSHA_DIR_CACHE_H
@@ -0,0 +1 @@
+#include "dir_walker.h"
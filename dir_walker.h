@@ -0,0 +1,505 @@
+#ifndef MICROSHA_DIR_WALKER_H
+#define MICROSHA_DIR_WALKER_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <system_error>
+
+#include "string_funcitons.h"
+#include "glob_pattern.h"
+#include "dir_cache.h"
+
+#define WALKER_MAX_THREADS 8
+
+/* Filename pattern expansion walker.
+ * Pattern is split into '/' components, and every directory to be scanned for the next component is a task:
+ * - directories are opened with 'openat' relative to the parent descriptor, full paths are never resolved;
+ * - directory listings are taken from 'dir_cache', which reads them in large 'getdents64' batches;
+ *   'fstatat' is called only for symbolic links;
+ * - components without meta-symbols are checked with one 'fstatat' instead of reading the directory;
+ * - tasks are run by a work-stealing pool: every worker takes its own newest task and steals the oldest task
+ *   of another worker when its queue is empty. Helper threads are started only when there is more than
+ *   one directory to scan. Workers without tasks sleep until a task is pushed or the walk is over, so a worker
+ *   blocked on a slow directory does not keep the others spinning.
+ * '**' component matches zero or more directories. Symbolic links to directories are followed, but '**' never
+ * descends into a directory which is already an ancestor of the walk (same device and inode), so link loops end.
+ * Matches are streamed to a callback as soon as they are found; only pending directories are kept in memory.
+ * 'expand' collects them and returns them sorted, so result does not depend on scheduling. */
+class dir_walker
+{
+private:
+  /* Directory reached by the walk. It is opened only when its listing is not cached or it has to be stat'ed.
+   * Handle keeps its parent alive: descriptor of the parent is needed to open the directory by name,
+   * and the parent chain is the list of ancestors used to detect loops */
+  struct dir_handle
+  {
+    std::shared_ptr<dir_handle> parent; // nullptr for the starting directory
+    std::string name;                   // directory name relative to parent
+    dev_t dev = 0;                      // identity, known after the directory is scanned or from parent listing
+    ino_t ino = 0;
+    bool is_id_known = false;
+    bool is_descent = false;            // entered by '**' descent, so it is checked for loops
+
+    std::once_flag open_flag;
+    int fd = -1;
+
+    dir_handle(std::shared_ptr<dir_handle> parent, std::string name) :
+      parent(std::move(parent)), name(std::move(name)) {}
+
+    ~dir_handle()
+    {
+      if (fd != -1)
+      {
+        close(fd);
+      }
+    }
+
+    /* Opens directory on the first call. Returns descriptor or -1 */
+    int get_fd()
+    {
+      std::call_once(open_flag, [this]()
+      {
+        int parent_fd = (parent == nullptr) ? AT_FDCWD : parent->get_fd();
+        fd = openat(parent_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      });
+      return fd;
+    }
+  };
+
+  /* Directory to be scanned for pattern component */
+  struct walk_task
+  {
+    std::shared_ptr<dir_handle> dir;
+    std::string path;     // directory path to prefix matched names with
+    size_t component = 0; // index of pattern component to be matched in the directory
+  };
+
+  /* Task queue of one worker */
+  struct worker_queue
+  {
+    std::mutex lock;
+    std::deque<walk_task> tasks;
+  };
+
+  std::vector<std::string> component_texts;
+  std::vector<glob_pattern> component_patterns;
+  std::vector<bool> component_has_meta;
+  std::vector<bool> component_is_globstar;
+  bool has_globstar = false;
+  bool dirs_only = false; // pattern ends with '/'
+  std::string start_path; // "/" for absolute patterns, empty otherwise
+
+  std::vector<worker_queue> queues;
+  std::atomic<size_t> pending_tasks{0}; // tasks queued or being scanned
+  std::atomic<size_t> queued_tasks{0};  // tasks waiting in queues
+  std::atomic<size_t> idle_workers{0};
+  std::mutex idle_lock;
+  std::condition_variable work_ready;   // a task is queued or all tasks are done
+  std::vector<std::thread> helpers;
+  bool are_helpers_started = false; // helpers are started once, even if some of them could not be created
+
+  std::mutex match_lock;
+  std::function<void(const std::string &)> match_callback;
+
+public:
+  /* Class constructor. Splits pattern into components */
+  explicit dir_walker(const std::string &pattern) :
+    queues(get_threads_num())
+  {
+    std::vector<std::string> components;
+    split_string_by_token(pattern, '/', components);
+
+    for (auto &component : components)
+    {
+      if (component.empty()) { continue; }
+
+      // '**/**' is the same as '**'
+      bool is_globstar = (component == "**");
+      if (is_globstar && !component_is_globstar.empty() && component_is_globstar.back()) { continue; }
+
+      has_globstar = has_globstar || is_globstar;
+      component_is_globstar.push_back(is_globstar);
+      component_patterns.emplace_back(component);
+      component_has_meta.push_back(glob_pattern::has_meta(component));
+      component_texts.push_back(std::move(component));
+    }
+
+    dirs_only = (!pattern.empty() && pattern.back() == '/');
+    start_path = (!pattern.empty() && pattern[0] == '/') ? "/" : "";
+  }
+
+  /* Default class destructor */
+  ~dir_walker()
+  =default;
+
+  dir_walker(const dir_walker &) = delete;
+  dir_walker &operator=(const dir_walker &) = delete;
+
+  /* Returns sorted pathnames matching the pattern */
+  std::vector<std::string> expand()
+  {
+    std::vector<std::string> matches;
+
+    walk([&matches](const std::string &match) { matches.push_back(match); });
+    std::sort(matches.begin(), matches.end());
+
+    return matches;
+  }
+
+  /* Walks directory tree calling 'on_match' for every matched pathname in the order they are found.
+   * Calls are serialized, but may come from different threads */
+  void walk(std::function<void(const std::string &)> on_match)
+  {
+    if (component_texts.empty())
+    {
+      return;
+    }
+    match_callback = std::move(on_match);
+    dir_cache::instance().sync();
+
+    walk_task root;
+    root.dir = std::make_shared<dir_handle>(nullptr, start_path.empty() ? "." : start_path);
+    root.path = start_path;
+    push_task(0, std::move(root));
+
+    run_worker(0);
+    for (auto &helper : helpers)
+    {
+      helper.join();
+    }
+    helpers.clear();
+    are_helpers_started = false;
+    match_callback = nullptr;
+  }
+
+private:
+  /* Returns number of workers */
+  static size_t get_threads_num()
+  {
+    size_t cpu_num = std::thread::hardware_concurrency();
+    return std::max<size_t>(1, std::min<size_t>(cpu_num, WALKER_MAX_THREADS));
+  }
+
+  /* Adds task to the worker queue */
+  void push_task(size_t worker, walk_task &&task)
+  {
+    pending_tasks++;
+    {
+      std::lock_guard<std::mutex> guard(queues[worker].lock);
+      queues[worker].tasks.push_back(std::move(task));
+    }
+    queued_tasks++;
+
+    // sleeping worker registers itself before checking 'queued_tasks', so either it sees the task or it is woken
+    if (idle_workers > 0)
+    {
+      std::lock_guard<std::mutex> guard(idle_lock);
+      work_ready.notify_one();
+    }
+  }
+
+  /* Takes the newest own task or steals the oldest task of another worker. Returns false if there are none */
+  bool pop_task(size_t worker, walk_task &task)
+  {
+    {
+      std::lock_guard<std::mutex> guard(queues[worker].lock);
+      if (!queues[worker].tasks.empty())
+      {
+        task = std::move(queues[worker].tasks.back());
+        queues[worker].tasks.pop_back();
+        queued_tasks--;
+        return true;
+      }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+      auto &victim = queues[(worker + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tasks.empty())
+      {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued_tasks--;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /* Runs tasks until all of them are done. Worker 0 starts helpers when there is work to share */
+  void run_worker(size_t worker)
+  {
+    walk_task task;
+
+    while (pending_tasks > 0)
+    {
+      if (!pop_task(worker, task))
+      {
+        wait_for_task();
+        continue;
+      }
+
+      scan_dir(worker, task);
+      task = walk_task();
+      if (--pending_tasks == 0)
+      {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        work_ready.notify_all();
+      }
+
+      if (worker == 0 && !are_helpers_started && queues.size() > 1 && pending_tasks > 1)
+      {
+        start_helpers();
+      }
+    }
+  }
+
+  /* Sleeps until a task is queued or all tasks are done */
+  void wait_for_task()
+  {
+    std::unique_lock<std::mutex> lock(idle_lock);
+    idle_workers++;
+    work_ready.wait(lock, [this]() { return queued_tasks > 0 || pending_tasks == 0; });
+    idle_workers--;
+  }
+
+  /* Starts helper workers. If a thread can not be created, the walk goes on with the started ones:
+   * tasks are pushed only to queues of running workers, so none of them is left behind */
+  void start_helpers()
+  {
+    are_helpers_started = true;
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+      try
+      {
+        helpers.emplace_back(&dir_walker::run_worker, this, i);
+      }
+      catch (const std::system_error &)
+      {
+        break;
+      }
+    }
+  }
+
+  /* Matches task directory entries against the task component.
+   * Listing of directory which identity is known from the parent listing is served by cache without any syscall */
+  void scan_dir(size_t worker, const walk_task &task)
+  {
+    dir_handle &dir = *task.dir;
+    size_t component = task.component;
+    bool is_literal = !component_has_meta[component] && !component_is_globstar[component];
+
+    std::shared_ptr<const dir_listing> listing;
+    if (dir.is_id_known)
+    {
+      listing = dir_cache::instance().find(dir.dev, dir.ino);
+    }
+
+    if (listing == nullptr)
+    {
+      // identity from parent listing may belong to a mount point, so the real one is always taken from descriptor
+      if (dir.get_fd() == -1)
+      {
+        return;
+      }
+      listing = dir_cache::instance().get(dir.fd, dir.dev, dir.ino, !is_literal);
+      dir.is_id_known = true;
+    }
+
+    if (dir.is_descent && is_loop(dir))
+    {
+      return;
+    }
+
+    if (component_is_globstar[component])
+    {
+      scan_globstar_dir(worker, task, listing);
+      return;
+    }
+
+    if (is_literal)
+    {
+      match_literal(worker, task, component, listing);
+      return;
+    }
+
+    const glob_pattern &pattern = component_patterns[component];
+    bool need_type = (component + 1 < component_texts.size() || dirs_only);
+
+    for (const auto &entry : listing->entries)
+    {
+      if (!is_visible(entry.name, component) || !pattern.match(entry.name.c_str(), entry.name.size()))
+      {
+        continue;
+      }
+
+      // directory is needed to go deeper, otherwise any file matches
+      bool is_dir = need_type && is_dir_entry(dir, entry);
+      add_entry(worker, task, component, entry, is_dir);
+    }
+  }
+
+  /* Scans directory for '**' component. Every visible subdirectory is scanned for the same '**' later,
+   * and the directory itself is matched against the next component ('**' matches zero directories) */
+  void scan_globstar_dir(size_t worker, const walk_task &task, const std::shared_ptr<const dir_listing> &listing)
+  {
+    size_t next = task.component + 1;
+    bool is_last = (next == component_texts.size());
+
+    if (!is_last && !component_has_meta[next])
+    {
+      match_literal(worker, task, next, listing);
+    }
+
+    // trailing '**' matching zero directories gives the directory it starts from, as "a/" for "a/**"
+    if (is_last && !task.dir->is_descent && !task.path.empty())
+    {
+      report_match(task.path);
+    }
+
+    for (const auto &entry : listing->entries)
+    {
+      bool is_dir = is_dir_entry(*task.dir, entry);
+
+      if (is_last)
+      {
+        // trailing '**' matches every visible entry of the tree
+        if (is_visible(entry.name, task.component) && (is_dir || !dirs_only))
+        {
+          report_match(task.path + entry.name);
+        }
+      }
+      else if (component_has_meta[next] && is_visible(entry.name, next) &&
+               component_patterns[next].match(entry.name.c_str(), entry.name.size()))
+      {
+        add_entry(worker, task, next, entry, is_dir);
+      }
+
+      if (is_dir && is_visible(entry.name, task.component))
+      {
+        push_subdir(worker, task, task.component, entry);
+      }
+    }
+  }
+
+  /* Matches component without meta-symbols: looks the name up in the listing if it is given,
+   * otherwise (and for '.' and '..') checks the file with 'fstatat' */
+  void match_literal(size_t worker, const walk_task &task, size_t component,
+                     const std::shared_ptr<const dir_listing> &listing)
+  {
+    const std::string &name = component_texts[component];
+
+    if (listing == nullptr || name == "." || name == "..")
+    {
+      // followed name may be a link, so subdirectory identity stays unknown
+      struct stat st{};
+      if (fstatat(task.dir->get_fd(), name.c_str(), &st, 0) == 0)
+      {
+        add_entry(worker, task, component, {name, DT_UNKNOWN, 0}, S_ISDIR(st.st_mode));
+      }
+      return;
+    }
+
+    auto entry = std::lower_bound(listing->entries.begin(), listing->entries.end(), name,
+                                  [](const dir_entry &e, const std::string &n) { return e.name < n; });
+    if (entry != listing->entries.end() && entry->name == name)
+    {
+      add_entry(worker, task, component, *entry, is_dir_entry(*task.dir, *entry));
+    }
+  }
+
+  /* Records matched entry or schedules its scan for the next component */
+  void add_entry(size_t worker, const walk_task &task, size_t component, const dir_entry &entry, bool is_dir)
+  {
+    if (component + 1 == component_texts.size())
+    {
+      if (is_dir || !dirs_only)
+      {
+        report_match(task.path + entry.name);
+      }
+      return;
+    }
+
+    if (is_dir)
+    {
+      push_subdir(worker, task, component + 1, entry);
+    }
+  }
+
+  /* Schedules scan of subdirectory for pattern component. Identity of real (not linked) subdirectory
+   * is known from the listing, so its cached listing can be used without opening it.
+   * Only '**' descent (the same component scanned again) can come back to an ancestor without end:
+   * literal components such as '.' and '..' may name an ancestor on purpose */
+  void push_subdir(size_t worker, const walk_task &task, size_t component, const dir_entry &entry)
+  {
+    walk_task child;
+    child.dir = std::make_shared<dir_handle>(task.dir, entry.name);
+    child.dir->is_descent = (component == task.component);
+    if (entry.type == DT_DIR)
+    {
+      child.dir->dev = task.dir->dev;
+      child.dir->ino = entry.ino;
+      child.dir->is_id_known = true;
+    }
+    child.path = task.path + entry.name + "/";
+    child.component = component;
+    push_task(worker, std::move(child));
+  }
+
+  /* Passes matched pathname to the callback */
+  void report_match(const std::string &match)
+  {
+    std::lock_guard<std::mutex> guard(match_lock);
+    match_callback(match);
+  }
+
+  /* Checks if directory entered by '**' is its own ancestor (the walk came back through a symbolic link) */
+  static bool is_loop(const dir_handle &dir)
+  {
+    for (const dir_handle *a = dir.parent.get(); a != nullptr; a = a->parent.get())
+    {
+      if (a->is_id_known && a->dev == dir.dev && a->ino == dir.ino)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* Checks if entry is not hidden from component: dot names are matched only by components starting with '.'.
+   * Listings never contain '.' and '..' */
+  bool is_visible(const std::string &name, size_t component) const
+  {
+    return name[0] != '.' || component_texts[component][0] == '.';
+  }
+
+  /* Checks if entry is a directory or a symbolic link to directory */
+  static bool is_dir_entry(dir_handle &dir, const dir_entry &entry)
+  {
+    if (entry.type != DT_LNK)
+    {
+      return entry.type == DT_DIR;
+    }
+
+    struct stat st{};
+    return fstatat(dir.get_fd(), entry.name.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode);
+  }
+};
+
+#endif //MICROSHA_DIR_WALKER_H
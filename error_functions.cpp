@@ -1,136 +1,172 @@
 #include "error_functions.h"
 
 /***
- * Creates new log text file
+ * Returns error description for the log by enum value
  *
- * @param const char * log_file_name - log file name
- *
- * @return error code. It can occur because of problems with creating/opening log file.
+ * @param const ERR_CODE &code - error code
  */
-enum ERR_CODE start_log( const char * log_file_name )
+static const char *get_log_description(const ERR_CODE &code)
 {
-  FILE *log_file;
-
-  if((log_file = fopen(LOG_FILE_NAME, "w")) == nullptr)
+  switch(code)
   {
-    printf("ERROR in '%s' file:\n \tSomething is wrong with creating/opening log file on line %i\n", __FILE__, __LINE__);
-    return ERR_FILE_OPEN;
-  }
+    case SUCCESS:
+      return "Everything is OK";
 
-  fprintf(log_file, "Logging start\n\n");
+    case FAILURE:
+      return "Function failed to do its purpose";
 
-  fclose(log_file);
+    case ERR_FILE_OPEN:
+      return "Could not open file";
 
-  return SUCCESS;
+    case ERR_FILE_OPERATE:
+      return "Error while working with file";
+
+    case ERR_UNEXP_EOF:
+      return "Unexpected end of file while reading file";
+
+    case ERR_ALLOC:
+      return "Memory allocation error";
+
+    case ERR_EXCESS_ALLOC:
+      return "Trying to alloc memory by pointer which was already used for memory allocation";
+
+    case ERR_NULL_PARAM:
+      return "nullptr is given as function in param";
+
+    case ERR_NULL_ATTRIB:
+      return "class contains NULL attribute, but must not";
+
+    case ERR_STAT:
+      return "'stat()' function failure error";
+
+    case ERR_FUNC_IMPL:
+      return "function implementation error";
+
+    case ERR_OVERFLOW:
+      return "array overflow";
+
+    case ERR_UNDERFLOW:
+      return "array underflow";
+
+    case ERR_FRONT_CANARY:
+      return "structure front canary defect";
+
+    case ERR_BACK_CANARY:
+      return "structure back canary defect";
+
+    case ERR_HASH_BREAK:
+      return "hash function value defect";
+
+    case ERR_WRONG_INPUT:
+      return "Wrong input format";
+
+    case ERR_FILE_DIR_EXIST:
+      return "File or directory does not exist";
+
+    default:
+      return "Unknown error code";
+  }
 }
 
 /***
- * Adds error information to log file
- *
- * @param const char * log_file_name - log file name
- * @param enum ERR_CODE code - code of error
- * @param const char * source_file_name - source code file name where mistake probably occurred
- * @param int curr_line - line of code, where error occurred
+ * Returns error code name by enum value
  *
- * @return error code. It can occur because of problems with writing/existence of log file.
+ * @param const ERR_CODE &code - error code
  */
-enum ERR_CODE add_log( const char * log_file_name, enum ERR_CODE code, const char * source_file_name, int curr_line )
+const char *get_err_name(const ERR_CODE &code)
 {
-  FILE *log_file;
-
-  if((log_file = fopen(LOG_FILE_NAME, "w")) == nullptr)
-  {
-    printf("ERROR in '%s' file:\n \tSomething is wrong with opening log file on line %i\n", source_file_name, curr_line);
-    return ERR_FILE_OPEN;
-  }
-
-  fprintf(log_file, "Error file : line - %s : %i\n\t", source_file_name, curr_line);
-
   switch(code)
   {
     case SUCCESS:
-      fprintf(log_file, "Everything is OK\n\n");
-      break;
+      return "SUCCESS";
 
     case FAILURE:
-      fprintf(log_file, "Function failed to do its purpose\n\n");
-      break;
+      return "FAILURE";
 
     case ERR_FILE_OPEN:
-      fprintf(log_file, "Could not open file\n\n");
-      break;
+      return "ERR_FILE_OPEN";
 
     case ERR_FILE_OPERATE:
-      fprintf(log_file, "Error while working with file\n\n");
-      break;
+      return "ERR_FILE_OPERATE";
 
     case ERR_UNEXP_EOF:
-      fprintf(log_file, "Unexpected end of file while reading file\n\n");
-      break;
+      return "ERR_UNEXP_EOF";
 
     case ERR_ALLOC:
-      fprintf(log_file, "Memory allocation error\n\n");
-      break;
+      return "ERR_ALLOC";
 
     case ERR_EXCESS_ALLOC:
-      fprintf(log_file, "Trying to alloc memory by pointer which was already used for memory allocation\n\n");
-      break;
+      return "ERR_EXCESS_ALLOC";
 
     case ERR_NULL_PARAM:
-      fprintf(log_file, "nullptr is given as function in param\n\n");
-      break;
+      return "ERR_NULL_PARAM";
 
     case ERR_NULL_ATTRIB:
-      fprintf(log_file, "class contains NULL attribute, but must not\n\n");
-      break;
+      return "ERR_NULL_ATTRIB";
 
     case ERR_STAT:
-      fprintf(log_file, "'stat()' function failure error\n\n");
-      break;
+      return "ERR_STAT";
 
     case ERR_FUNC_IMPL:
-      fprintf(log_file, "function implementation error\n\n");
-      break;
+      return "ERR_FUNC_IMPL";
 
     case ERR_OVERFLOW:
-      fprintf(log_file, "array overflow\n\n");
-      break;
+      return "ERR_OVERFLOW";
 
     case ERR_UNDERFLOW:
-      fprintf(log_file, "array underflow\n\n");
-      break;
+      return "ERR_UNDERFLOW";
 
     case ERR_FRONT_CANARY:
-      fprintf(log_file, "structure front canary defect\n\n");
-      break;
+      return "ERR_FRONT_CANARY";
 
     case ERR_BACK_CANARY:
-      fprintf(log_file, "structure back canary defect\n\n");
-      break;
+      return "ERR_BACK_CANARY";
 
     case ERR_HASH_BREAK:
-      fprintf(log_file, "hash function value defect\n\n");
-      break;
+      return "ERR_HASH_BREAK";
 
     case ERR_WRONG_INPUT:
-      fprintf(log_file, "Wrong input format\n\n");
-      break;
+      return "ERR_WRONG_INPUT";
 
     case ERR_FILE_DIR_EXIST:
-      fprintf(log_file, "File or directory does not exist\n\n");
-      break;
-
+      return "ERR_FILE_DIR_EXIST";
 
     default:
-      fprintf(log_file, "Unknown error code\n\n");
-      break;
+      return "UNKNOWN";
   }
+}
 
-  fclose(log_file);
-
+/***
+ * Adds log start record. Log file is not truncated: records of previous runs are kept
+ *
+ * @return error code. Logging itself can not fail here: file problems are found by the log flusher.
+ */
+enum ERR_CODE start_log( void )
+{
+  logger::instance().add(LOG_INFO, SUCCESS, get_err_name(SUCCESS), "Logging start", __FILE__, __LINE__);
   return SUCCESS;
 }
 
+/***
+ * Adds error record to the shell log (see 'logger').
+ * 'SUCCESS' is logged with debug level, 'FAILURE' - with warning level, other codes - with error level
+ *
+ * @param enum ERR_CODE code - code of error
+ * @param const char * source_file_name - source code file name where mistake probably occurred (string literal)
+ * @param int curr_line - line of code, where error occurred
+ *
+ * @return error code. 'FAILURE' if the record was dropped because the log queue is full.
+ */
+enum ERR_CODE add_log( enum ERR_CODE code, const char * source_file_name, int curr_line )
+{
+  log_level level = (code == SUCCESS) ? LOG_DEBUG : (code == FAILURE) ? LOG_WARNING : LOG_ERROR;
+
+  if (!logger::instance().add(level, code, get_err_name(code), get_log_description(code), source_file_name, curr_line))
+  {
+    return FAILURE;
+  }
+  return SUCCESS;
+}
 
 /***
  * Prints error description by enum value
@@ -1,4 +1,4 @@
-#ifndef ONEGIN_ERROR_FUNCITONS_H
+#ifndef ONEGIN_ERROR_FUNCTIONS_H
 #define ONEGIN_ERROR_FUNCTIONS_H
 
 /***
@@ -10,7 +10,7 @@
 #include <cstdio>
 #include <cassert>
 
-#define LOG_FILE_NAME "log_out.txt"
+#include "logger.h"
 
 /***
  * Adds log with the type of error, name of file, and line where it happened
@@ -20,7 +20,7 @@
  * 					   to   the line where the error occurred
  */
 #define ADD_LOG(err_type, offset)\
-	add_log(LOG_FILE_NAME, err_type, __FILE__, __LINE__ - offset)
+	add_log(err_type, __FILE__, __LINE__ - offset)
 
 /***
  * Adds log with the type of error, name of file, and line where it happened
@@ -31,7 +31,7 @@
  * 					   to   the line where the error occurred
  */
 #define ADD_LOG_WITH_RETURN(err_type, offset)\
-        add_log(LOG_FILE_NAME, err_type, __FILE__, __LINE__ - offset);\
+        add_log(err_type, __FILE__, __LINE__ - offset);\
         return err_type
 
 /***
@@ -44,7 +44,7 @@
 #define NULL_CHECK_WITH_ERR_RETURN(var)						\
 	if (var == NULL)							\
 	{									\
-	  add_log(LOG_FILE_NAME, ERR_NULL_PARAM, __FILE__, __LINE__ - 0);	\
+	  add_log(ERR_NULL_PARAM, __FILE__, __LINE__ - 0);	\
 	  return ERR_NULL_PARAM;						\
         }
 
@@ -88,25 +88,30 @@ enum ERR_CODE
 };
 
 /***
- * Creates new log text file
+ * Adds log start record. Log file is not truncated: records of previous runs are kept
  *
- * @param const char * log_file_name - log file name
- *
- * @return error code. It can occur because of problems with creating/opening log file.
+ * @return error code. Logging itself can not fail here: file problems are found by the log flusher.
  */
-enum ERR_CODE start_log( const char * log_file_name );
+enum ERR_CODE start_log( void );
 
 /***
- * Adds error information to log file
+ * Adds error record to the shell log (see 'logger').
+ * 'SUCCESS' is logged with debug level, 'FAILURE' - with warning level, other codes - with error level
  *
- * @param const char * log_file_name - log file name
  * @param enum ERR_CODE code - code of error
- * @param const char * source_file_name - source code file name where mistake probably occurred
+ * @param const char * source_file_name - source code file name where mistake probably occurred (string literal)
  * @param int curr_line - line of code, where error occurred
  *
- * @return error code. It can occur because of problems with writing/existence of log file.
+ * @return error code. 'FAILURE' if the record was dropped because the log queue is full.
+ */
+enum ERR_CODE add_log( enum ERR_CODE code, const char * source_file_name, int curr_line );
+
+/***
+ * Returns error code name by enum value
+ *
+ * @param const ERR_CODE &code - error code
  */
-enum ERR_CODE add_log( const char * log_file_name, enum ERR_CODE code, const char * source_file_name, int curr_line );
+const char *get_err_name(const ERR_CODE &code);
 
 /***
  * Prints error description by enum value
@@ -116,4 +121,4 @@ enum ERR_CODE add_log( const char * log_file_name, enum ERR_CODE code, const cha
  */
 void print_err(std::ostream &os, const ERR_CODE &code);
 
-#endif //ONEGIN_ERROR_FUNCITONS_H
+#endif //ONEGIN_ERROR_FUNCTIONS_H
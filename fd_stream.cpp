@@ -0,0 +1 @@
+#include "fd_stream.h"
@@ -0,0 +1,182 @@
+#ifndef MICROSHA_FD_STREAM_H
+#define MICROSHA_FD_STREAM_H
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
+
+#define FD_STREAM_BUFFER_SIZE (1 << 16)
+
+/* Output stream buffer writing to file descriptor. Large writes bypass the buffer.
+ * Builtins running on a shell thread write their output through it instead of 'std::cout',
+ * which belongs to the shell standard output. Failed write (e.g. EPIPE when reader finished) makes stream bad */
+class fd_streambuf : public std::streambuf
+{
+private:
+  int fd;
+  char buffer[FD_STREAM_BUFFER_SIZE];
+
+public:
+  /* Class constructor. Descriptor is not closed by the buffer */
+  explicit fd_streambuf(int new_fd) : fd(new_fd)
+  {
+    setp(buffer, buffer + sizeof(buffer));
+  }
+
+  /* Class destructor. Writes buffered data */
+  ~fd_streambuf() override
+  {
+    sync();
+  }
+
+  fd_streambuf(const fd_streambuf &) = delete;
+  fd_streambuf &operator=(const fd_streambuf &) = delete;
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (sync() != 0)
+    {
+      return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override
+  {
+    if (n < epptr() - pptr())
+    {
+      memcpy(pptr(), s, n);
+      pbump((int)n);
+      return n;
+    }
+
+    if (sync() != 0 || !write_all(s, n))
+    {
+      return 0;
+    }
+    return n;
+  }
+
+  int sync() override
+  {
+    bool is_written = write_all(pbase(), pptr() - pbase());
+    setp(buffer, buffer + sizeof(buffer));
+    return is_written ? 0 : -1;
+  }
+
+private:
+  /* Writes all bytes to the descriptor */
+  bool write_all(const char *data, size_t size) const
+  {
+    while (size > 0)
+    {
+      ssize_t written = write(fd, data, size);
+      if (written == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (written <= 0)
+      {
+        return false;
+      }
+
+      data += written;
+      size -= written;
+    }
+
+    return true;
+  }
+};
+
+/* Input stream buffer reading from file descriptor. Returns data as soon as one 'read' gives some */
+class fd_istreambuf : public std::streambuf
+{
+private:
+  int fd;
+  char buffer[FD_STREAM_BUFFER_SIZE];
+
+public:
+  /* Class constructor. Descriptor is not closed by the buffer */
+  explicit fd_istreambuf(int new_fd) : fd(new_fd)
+  {
+    setg(buffer, buffer, buffer);
+  }
+
+  fd_istreambuf(const fd_istreambuf &) = delete;
+  fd_istreambuf &operator=(const fd_istreambuf &) = delete;
+
+  /* Returns the descriptor */
+  int get_fd() const
+  {
+    return fd;
+  }
+
+protected:
+  int_type underflow() override
+  {
+    ssize_t size;
+    while ((size = read(fd, buffer, sizeof(buffer))) == -1 && errno == EINTR)
+    {
+    }
+    if (size <= 0)
+    {
+      return traits_type::eof();
+    }
+
+    setg(buffer, buffer, buffer + size);
+    return traits_type::to_int_type(*gptr());
+  }
+};
+
+/* Output stream writing to file descriptor */
+class fd_ostream : public std::ostream
+{
+private:
+  fd_streambuf buf;
+
+public:
+  /* Class constructor. Descriptor is not closed by the stream */
+  explicit fd_ostream(int fd) : std::ostream(nullptr), buf(fd)
+  {
+    rdbuf(&buf);
+  }
+
+  /* Class destructor. Writes buffered data */
+  ~fd_ostream() override
+  {
+    flush();
+  }
+};
+
+/* Input stream reading from file descriptor */
+class fd_istream : public std::istream
+{
+private:
+  fd_istreambuf buf;
+
+public:
+  /* Class constructor. Descriptor is not closed by the stream */
+  explicit fd_istream(int fd) : std::istream(nullptr), buf(fd)
+  {
+    rdbuf(&buf);
+  }
+
+  /* Returns the descriptor. Text builtins map regular files given as input instead of reading them */
+  int get_fd() const
+  {
+    return buf.get_fd();
+  }
+};
+
+#endif //MICROSHA_FD_STREAM_H
@@ -0,0 +1,133 @@
+#ifndef MICROSHA_FLAT_ARGV_H
+#define MICROSHA_FLAT_ARGV_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <algorithm>
+
+/* Command arguments stored as one block of NUL-terminated strings plus offsets of their starts.
+ * Null-terminated pointer array for 'execve' is built from the block by 'prepare_argv' in the shell,
+ * so the child only passes it to 'execve' without touching (and copying) any memory.
+ * Leading arguments can be dropped ('time', 'timeout' prefixes) without moving the block. */
+class flat_argv
+{
+private:
+  std::pmr::vector<char> block;
+  std::pmr::vector<uint32_t> offsets;
+  std::pmr::vector<char *> pointers; // 'execve' argument array, valid if 'is_prepared'
+  size_t first = 0;                  // index of the first argument not dropped
+  bool is_prepared = false;
+
+public:
+  /* Class constructor. Storage is taken from given memory resource */
+  explicit flat_argv(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+    block(resource), offsets(resource), pointers(resource)
+  {
+  }
+
+  /* Copy constructor. Only arguments not dropped are copied. Storage is taken from the default memory resource,
+   * argument array is to be built again by 'prepare_argv' */
+  flat_argv(const flat_argv &other)
+  {
+    size_t base = other.empty() ? other.block.size() : other.offsets[other.first];
+
+    block.assign(other.block.begin() + base, other.block.end());
+    for (size_t i = other.first; i < other.offsets.size(); i++)
+    {
+      offsets.push_back((uint32_t)(other.offsets[i] - base));
+    }
+  }
+
+  flat_argv(flat_argv &&other) noexcept = default;
+  flat_argv &operator=(flat_argv &&other) noexcept = default;
+
+  /* Appends argument */
+  void push_back(std::string_view arg)
+  {
+    offsets.push_back((uint32_t)block.size());
+    block.insert(block.end(), arg.begin(), arg.end());
+    block.push_back('\0');
+    is_prepared = false;
+  }
+
+  /* Drops first 'number' arguments */
+  void erase_front(size_t number)
+  {
+    first += std::min(number, size());
+    is_prepared = false;
+  }
+
+  /* Returns number of arguments */
+  size_t size() const
+  {
+    return offsets.size() - first;
+  }
+
+  /* Checks if there are no arguments */
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  /* Returns NUL-terminated argument */
+  const char *c_str(size_t index) const
+  {
+    return block.data() + offsets[first + index];
+  }
+
+  /* Returns argument */
+  std::string_view operator[](size_t index) const
+  {
+    return {c_str(index), get_length(index)};
+  }
+
+  /* Returns arguments from 'from' index as separate strings */
+  std::vector<std::string> to_strings(size_t from) const
+  {
+    std::vector<std::string> args;
+    for (size_t i = from; i < size(); i++)
+    {
+      args.emplace_back((*this)[i]);
+    }
+    return args;
+  }
+
+  /* Builds null-terminated pointer array. Must be called before the arguments are passed to a child */
+  void prepare_argv()
+  {
+    if (is_prepared)
+    {
+      return;
+    }
+
+    pointers.clear();
+    for (size_t i = first; i < offsets.size(); i++)
+    {
+      pointers.push_back(block.data() + offsets[i]);
+    }
+    pointers.push_back(nullptr);
+    is_prepared = true;
+  }
+
+  /* Returns pointer array built by 'prepare_argv' */
+  char *const *get_argv() const
+  {
+    return pointers.data();
+  }
+
+private:
+  /* Returns argument length */
+  size_t get_length(size_t index) const
+  {
+    size_t start = offsets[first + index];
+    size_t end = (first + index + 1 < offsets.size()) ? offsets[first + index + 1] : block.size();
+    return end - start - 1;
+  }
+};
+
+#endif //MICROSHA_FLAT_ARGV_H
@@ -0,0 +1 @@
+#include "glob_pattern.h"
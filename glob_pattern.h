@@ -0,0 +1,306 @@
+#ifndef MICROSHA_GLOB_PATTERN_H
+#define MICROSHA_GLOB_PATTERN_H
+
+#include <cstring>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <bitset>
+
+/* Compiled filename pattern: '*', '?', '[...]' character classes with ranges and '!'/'^' negation,
+ * '\' quotes the next character.
+ * Pattern is compiled once into a bit-parallel NFA: state i means "first i non-star tokens are matched",
+ * and every name character advances all states at once with a few word operations.
+ * So matching is linear in name length whatever stars the pattern has.
+ * Cheap rejects are tried before the NFA: minimal length, literal prefix and suffix comparison and
+ * 'memmem' search for the longest literal run of the pattern. */
+class glob_pattern
+{
+private:
+  static constexpr size_t WORD_BITS = 64;
+
+  size_t words_num = 1;                // words per state set
+  size_t tokens_num = 0;               // non-star tokens
+  bool has_star = false;
+  std::vector<uint64_t> char_masks;    // [c * words_num + w]: states entered by consuming character c
+  std::vector<uint64_t> loop_mask;     // states preceded by star, they stay active on any character
+
+  std::string prefix;                  // literal text the name must start with
+  std::string suffix;                  // literal text the name must end with (only if pattern has star)
+  std::string longest_literal;         // longest literal run the name must contain
+
+public:
+  /* Class constructor. Compiles pattern */
+  explicit glob_pattern(const std::string &pattern)
+  {
+    compile(pattern);
+  }
+
+  /* Default class destructor */
+  ~glob_pattern()
+  =default;
+
+  /* Checks if text contains pattern meta-symbols or quoting, so it can not be compared literally */
+  static bool has_meta(const std::string &text)
+  {
+    return text.find_first_of("*?[\\") != std::string::npos;
+  }
+
+  /* Checks if whole name matches the pattern */
+  bool match(const char *name) const
+  {
+    return match(name, strlen(name));
+  }
+
+  /* Checks if whole name of given length matches the pattern */
+  bool match(const char *name, size_t name_len) const
+  {
+    if (name_len < tokens_num || (!has_star && name_len != tokens_num))
+    {
+      return false;
+    }
+
+    if (memcmp(name, prefix.data(), prefix.size()) != 0 ||
+        memcmp(name + name_len - suffix.size(), suffix.data(), suffix.size()) != 0)
+    {
+      return false;
+    }
+
+    if (longest_literal.size() > prefix.size() &&
+        memmem(name, name_len, longest_literal.data(), longest_literal.size()) == nullptr)
+    {
+      return false;
+    }
+
+    if (words_num == 1)
+    {
+      return match_single_word(name, name_len);
+    }
+    return match_multi_word(name, name_len);
+  }
+
+private:
+  /* Pattern token */
+  struct token
+  {
+    std::bitset<256> chars; // accepted characters
+    bool is_literal = false;
+    char literal = 0;
+  };
+
+  /* Splits pattern into tokens and builds state masks */
+  void compile(const std::string &pattern)
+  {
+    std::vector<token> tokens;
+    std::vector<bool> star_before;
+    bool star_pending = false;
+
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+      if (pattern[i] == '*')
+      {
+        star_pending = true;
+        has_star = true;
+        continue;
+      }
+
+      token tok;
+      if (pattern[i] == '?')
+      {
+        tok.chars.set();
+      }
+      else if (pattern[i] == '[' && parse_class(pattern, i, tok.chars))
+      {
+        // 'i' is moved to the closing bracket
+      }
+      else
+      {
+        if (pattern[i] == '\\' && i + 1 < pattern.size())
+        {
+          i++;
+        }
+        tok.is_literal = true;
+        tok.literal = pattern[i];
+        tok.chars.set((unsigned char)pattern[i]);
+      }
+
+      tokens.push_back(tok);
+      star_before.push_back(star_pending);
+      star_pending = false;
+    }
+
+    tokens_num = tokens.size();
+    words_num = (tokens_num + 1 + WORD_BITS - 1) / WORD_BITS;
+    char_masks.assign(256 * words_num, 0);
+    loop_mask.assign(words_num, 0);
+
+    for (size_t i = 0; i < tokens_num; i++)
+    {
+      // consuming token i moves state i to state i + 1
+      size_t state = i + 1;
+      for (size_t c = 0; c < 256; c++)
+      {
+        if (tokens[i].chars.test(c))
+        {
+          char_masks[c * words_num + state / WORD_BITS] |= (uint64_t)1 << (state % WORD_BITS);
+        }
+      }
+      if (star_before[i])
+      {
+        loop_mask[i / WORD_BITS] |= (uint64_t)1 << (i % WORD_BITS);
+      }
+    }
+    if (star_pending)
+    {
+      loop_mask[tokens_num / WORD_BITS] |= (uint64_t)1 << (tokens_num % WORD_BITS);
+    }
+
+    collect_literals(tokens, star_before);
+  }
+
+  /* Parses '[...]' class starting at pattern[pos]. On success moves 'pos' to ']' and returns true,
+   * otherwise '[' is an ordinary character. '\' quotes the next class character */
+  static bool parse_class(const std::string &pattern, size_t &pos, std::bitset<256> &chars)
+  {
+    size_t i = pos + 1;
+    bool negate = (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^'));
+    if (negate)
+    {
+      i++;
+    }
+
+    std::bitset<256> set;
+    // ']' right after '[' or '[!' is a class member
+    for (bool first = true; i < pattern.size() && (first || pattern[i] != ']'); i++, first = false)
+    {
+      auto low = (unsigned char)read_class_char(pattern, i);
+      if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+      {
+        i += 2;
+        auto high = (unsigned char)read_class_char(pattern, i);
+        for (unsigned c = low; c <= high; c++)
+        {
+          set.set(c);
+        }
+      }
+      else
+      {
+        set.set(low);
+      }
+    }
+
+    if (i >= pattern.size())
+    {
+      return false;
+    }
+
+    chars = negate ? ~set : set;
+    chars.reset(0);
+    pos = i;
+    return true;
+  }
+
+  /* Returns class character at pattern[pos]. Quoted character moves 'pos' to itself */
+  static char read_class_char(const std::string &pattern, size_t &pos)
+  {
+    if (pattern[pos] == '\\' && pos + 1 < pattern.size())
+    {
+      pos++;
+    }
+    return pattern[pos];
+  }
+
+  /* Collects literal prefix, suffix and the longest literal run used for cheap rejects */
+  void collect_literals(const std::vector<token> &tokens, const std::vector<bool> &star_before)
+  {
+    for (size_t i = 0; i < tokens.size() && !star_before[i] && tokens[i].is_literal; i++)
+    {
+      prefix += tokens[i].literal;
+    }
+
+    if (has_star)
+    {
+      for (size_t i = tokens.size(); i-- > 0 && tokens[i].is_literal && loop_mask_bit(i + 1) == 0;)
+      {
+        suffix.insert(suffix.begin(), tokens[i].literal);
+        if (star_before[i])
+        {
+          break;
+        }
+      }
+    }
+
+    std::string run;
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      if (star_before[i] || !tokens[i].is_literal)
+      {
+        run.clear();
+      }
+      if (tokens[i].is_literal)
+      {
+        run += tokens[i].literal;
+        if (run.size() > longest_literal.size())
+        {
+          longest_literal = run;
+        }
+      }
+    }
+  }
+
+  /* Returns loop bit of state */
+  uint64_t loop_mask_bit(size_t state) const
+  {
+    return loop_mask[state / WORD_BITS] & ((uint64_t)1 << (state % WORD_BITS));
+  }
+
+  /* NFA run for patterns with less than 64 tokens */
+  bool match_single_word(const char *name, size_t name_len) const
+  {
+    uint64_t states = 1, loop = loop_mask[0];
+    const uint64_t accept = (uint64_t)1 << tokens_num;
+
+    for (size_t i = 0; i < name_len && states != 0; i++)
+    {
+      // final state of pattern ending with star can not be left, the rest of name does not matter
+      if ((states & accept & loop) != 0)
+      {
+        return true;
+      }
+      states = ((states << 1) & char_masks[(unsigned char)name[i]]) | (states & loop);
+    }
+
+    return (states & accept) != 0;
+  }
+
+  /* NFA run for long patterns: state set spans several words */
+  bool match_multi_word(const char *name, size_t name_len) const
+  {
+    std::vector<uint64_t> states(words_num, 0);
+    states[0] = 1;
+
+    for (size_t i = 0; i < name_len; i++)
+    {
+      const uint64_t *mask = &char_masks[(unsigned char)name[i] * words_num];
+      uint64_t carry = 0, any = 0;
+
+      for (size_t w = 0; w < words_num; w++)
+      {
+        uint64_t shifted = (states[w] << 1) | carry;
+        carry = states[w] >> (WORD_BITS - 1);
+        states[w] = (shifted & mask[w]) | (states[w] & loop_mask[w]);
+        any |= states[w];
+      }
+
+      if (any == 0)
+      {
+        return false;
+      }
+    }
+
+    return (states[tokens_num / WORD_BITS] & ((uint64_t)1 << (tokens_num % WORD_BITS))) != 0;
+  }
+};
+
+#endif //MICROSHA_GLOB_PATTERN_H
@@ -0,0 +1 @@
+#include "history.h"
@@ -0,0 +1,603 @@
+#ifndef MICROSHA_HISTORY_H
+#define MICROSHA_HISTORY_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <ostream>
+#include <system_error>
+
+#include "error_functions.h"
+
+#define HISTORY_FILE_NAME ".microsha_history" // in the home directory
+#define HISTORY_INDEX_BATCH 65536             // records indexed by the background thread between lock releases
+
+/* Persistent command history shared by all shell instances.
+ * Every line is one record of the history file ('MICROSHA_HISTORY', default "~/.microsha_history", empty disables it):
+ *   "<unix time>\t<duration, s>\t<exit status>\t<cwd>\t<line>\n"
+ * where '\\', tab and newline of cwd and line are escaped. Records are appended with one 'write' to the file
+ * opened with O_APPEND, so concurrent shells never mix their records. The file is memory-mapped, not read into
+ * strings: an entry is the position of its record, and the index maps every three bytes (trigram) of a line
+ * to the numbers of entries containing them, delta encoded. Substring search takes entries of the rarest trigram
+ * of the text and compares only them. Index is built by a background thread started with 'open' and is extended
+ * with records of this or other shells at every query */
+class command_history
+{
+private:
+  /* Entry position in the mapped file */
+  struct history_entry
+  {
+    uint64_t start;       // record offset
+    uint32_t line_offset; // line field offset from the record start
+    uint32_t line_size;   // escaped line size
+  };
+
+  /* Ascending entry numbers containing one trigram, varint encoded differences */
+  struct posting_list
+  {
+    std::vector<uint8_t> deltas;
+    uint32_t last = 0;
+    uint32_t count = 0;
+  };
+
+  int fd = -1;
+  const char *map = nullptr;
+  size_t map_size = 0;
+  size_t indexed_size = 0; // file bytes parsed into entries: complete records only
+  std::vector<history_entry> entries;
+  std::unordered_map<uint32_t, posting_list> trigrams;
+  std::vector<uint32_t> line_trigrams; // scratch buffer of one line
+
+  std::mutex mutex;
+  std::condition_variable indexed;
+  bool is_indexing = false;         // background thread has not indexed the file yet
+  std::unique_ptr<std::thread> indexer;
+
+public:
+  /* Class constructor. History is off until 'open' */
+  command_history()
+  {
+    // background thread does not exist in the forked child: it indexes the rest itself when asked
+    pthread_atfork([]() { instance().mutex.lock(); },
+                   []() { instance().mutex.unlock(); },
+                   []() { instance().after_fork_child(); });
+  }
+
+  /* Class destructor */
+  ~command_history()
+  {
+    if (indexer != nullptr)
+    {
+      indexer->join();
+    }
+    if (map != nullptr)
+    {
+      munmap((void *)map, map_size);
+    }
+    if (fd != -1)
+    {
+      close(fd);
+    }
+  }
+
+  command_history(const command_history &) = delete;
+  command_history &operator=(const command_history &) = delete;
+
+  /* Returns shell-wide history instance */
+  static command_history &instance()
+  {
+    static command_history history;
+    return history;
+  }
+
+  /* Opens history file and starts indexing it on a background thread. Returns 'FAILURE' if history is disabled */
+  ERR_CODE open()
+  {
+    std::string file_name = get_file_name();
+    if (file_name.empty() || fd != -1)
+    {
+      return FAILURE;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    fd = ::open(file_name.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+      ADD_LOG_WITH_RETURN(ERR_FILE_OPEN, 3);
+    }
+
+    try
+    {
+      is_indexing = true;
+      indexer = std::make_unique<std::thread>([this]() { run_indexer(); });
+    }
+    catch (const std::system_error &)
+    {
+      is_indexing = false; // the first query indexes the file
+    }
+
+    return SUCCESS;
+  }
+
+  /* Appends line record. Empty lines are not kept.
+   *
+   * @param line     - executed command line
+   * @param cwd      - directory the line was executed in
+   * @param duration - execution time in seconds
+   * @param status   - exit status */
+  void add(std::string_view line, std::string_view cwd, double duration, int status)
+  {
+    if (fd == -1 || line.find_first_not_of(" \t") == std::string_view::npos)
+    {
+      return;
+    }
+
+    char fields[64];
+    int size = snprintf(fields, sizeof(fields), "%lld\t%.3f\t%d\t", (long long)time(nullptr), duration, status);
+
+    std::string record(fields, size);
+    append_escaped(record, cwd);
+    record += '\t';
+    append_escaped(record, line);
+    record += '\n';
+
+    // one write: O_APPEND places the whole record at the end of file even if other shells write too
+    if (write(fd, record.data(), record.size()) != (ssize_t)record.size())
+    {
+      ADD_LOG(ERR_FILE_OPERATE, 2);
+    }
+  }
+
+  /* Returns number of entries */
+  size_t size()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+    return entries.size();
+  }
+
+  /* Replaces history reference at the beginning of line with the referenced entry:
+   * "!!" - the last entry, "!n" - entry number n, "!-n" - n-th entry from the end,
+   * "!prefix" - the last entry starting with prefix, "!?text[?]" - the last entry containing text.
+   * Returns 'ERR_WRONG_INPUT' and prints error if entry is not found. 'is_expanded' is set if line was changed */
+  ERR_CODE expand(std::string &line, bool &is_expanded)
+  {
+    is_expanded = false;
+    if (line.size() < 2 || line[0] != '!' || line[1] == ' ' || line[1] == '\t' || line[1] == '=')
+    {
+      return SUCCESS;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+
+    size_t event_end = 0;
+    long found = -1;
+    if (line[1] == '?')
+    {
+      event_end = line.find('?', 2);
+      std::string_view text(line.data() + 2, std::min(event_end, line.size()) - 2);
+      event_end = (event_end == std::string::npos) ? line.size() : event_end + 1;
+      found = find_locked(text, entries.size(), false);
+    }
+    else
+    {
+      event_end = std::min(line.find_first_of(" \t", 1), line.size());
+      std::string_view event(line.data() + 1, event_end - 1);
+      char *number_end = nullptr;
+      long number = strtol(event.data(), &number_end, 10);
+
+      if (event == "!")
+      {
+        found = (long)entries.size() - 1;
+      }
+      else if (number_end == event.data() + event.size())
+      {
+        found = (number > 0) ? number - 1 : (long)entries.size() + number;
+        found = (found >= 0 && found < (long)entries.size() && number != 0) ? found : -1;
+      }
+      else
+      {
+        found = find_locked(event, entries.size(), true);
+      }
+    }
+
+    if (found < 0)
+    {
+      std::cerr << "microsha: " << line.substr(0, event_end) << ": event not found" << std::endl;
+      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 0);
+    }
+
+    line.replace(0, event_end, get_line(entries[found]));
+    is_expanded = true;
+    return SUCCESS;
+  }
+
+  /* Returns number (from 1) of the newest entry before entry number 'before' containing 'text', 0 if there is none.
+   * 'before' equal to 0 searches from the newest entry. Repeated calls with the returned number step back
+   * through matches as reverse search does */
+  size_t find(std::string_view text, size_t before)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+    size_t end = (before == 0) ? entries.size() : std::min(before - 1, entries.size());
+    return (size_t)(find_locked(text, end, false) + 1);
+  }
+
+  /* Returns line of entry number 'number' (from 1) or empty string */
+  std::string get(size_t number)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+    return (number > 0 && number <= entries.size()) ? get_line(entries[number - 1]) : std::string();
+  }
+
+  /* Prints the last 'count' entries with their numbers, with time, duration, exit status and directory if 'is_verbose' */
+  void print(std::ostream &os, size_t count, bool is_verbose)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+
+    for (size_t i = (entries.size() > count) ? entries.size() - count : 0; i < entries.size(); i++)
+    {
+      print_entry(os, i, is_verbose);
+    }
+  }
+
+  /* Prints entries containing 'text', the newest first */
+  void print_matches(std::ostream &os, std::string_view text, bool is_verbose)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+
+    std::vector<uint32_t> found;
+    search_locked(text, entries.size(), SIZE_MAX, false, found);
+    for (uint32_t i : found)
+    {
+      print_entry(os, i, is_verbose);
+    }
+  }
+
+  /* Calls 'func(line, duration, status)' for every entry, the oldest first. Line is given escaped */
+  template <typename Func>
+  void for_each(Func func)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sync(lock);
+
+    for (const history_entry &entry : entries)
+    {
+      // "<unix time>\t<duration>\t<status>\t" at the record start
+      const char *record = map + entry.start;
+      char *field_end = nullptr;
+      strtoll(record, &field_end, 10);
+      double duration = strtod(field_end, &field_end);
+      auto status = (int)strtol(field_end, &field_end, 10);
+      func(std::string_view(record + entry.line_offset, entry.line_size), duration, status);
+    }
+  }
+
+private:
+  /* Returns history file name */
+  static std::string get_file_name()
+  {
+    const char *file_name = getenv("MICROSHA_HISTORY");
+    if (file_name != nullptr)
+    {
+      return file_name;
+    }
+
+    const char *home = getenv("HOME");
+    return (home == nullptr || *home == '\0') ? std::string() : std::string(home) + "/" HISTORY_FILE_NAME;
+  }
+
+  /* Background thread: indexes file content in batches, so that forks and 'add' wait for one batch at most */
+  void run_indexer()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (remap() && index_records(HISTORY_INDEX_BATCH))
+    {
+      lock.unlock();
+      std::this_thread::yield();
+      lock.lock();
+    }
+
+    is_indexing = false;
+    indexed.notify_all();
+  }
+
+  /* Waits for the background thread and indexes records appended since the last query */
+  void sync(std::unique_lock<std::mutex> &lock)
+  {
+    indexed.wait(lock, [this]() { return !is_indexing; });
+    if (remap())
+    {
+      index_records(SIZE_MAX);
+    }
+  }
+
+  /* Maps the file again if it grew. Index is dropped if the file was truncated. Returns false if there is no file */
+  bool remap()
+  {
+    struct stat st{};
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+      return false;
+    }
+
+    auto size = (size_t)st.st_size;
+    if (size < indexed_size)
+    {
+      entries.clear();
+      trigrams.clear();
+      indexed_size = 0;
+    }
+
+    if (size == map_size || size == 0)
+    {
+      return map != nullptr || size == 0;
+    }
+
+    void *new_map = (map == nullptr) ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                                     : mremap((void *)map, map_size, size, MREMAP_MAYMOVE);
+    if (new_map == MAP_FAILED)
+    {
+      ADD_LOG(ERR_FILE_OPERATE, 4);
+      if (map != nullptr)
+      {
+        munmap((void *)map, map_size);
+      }
+      map = nullptr;
+      map_size = indexed_size = 0;
+      entries.clear();
+      trigrams.clear();
+      return false;
+    }
+
+    map = (const char *)new_map;
+    map_size = size;
+    return true;
+  }
+
+  /* Parses up to 'limit' complete records after the indexed part of the map. Returns true if more records remain */
+  bool index_records(size_t limit)
+  {
+    const char *map_end = map + map_size;
+
+    for (size_t count = 0; count < limit && indexed_size < map_size; count++)
+    {
+      const char *record = map + indexed_size;
+      auto record_end = (const char *)memchr(record, '\n', map_end - record);
+      if (record_end == nullptr)
+      {
+        return false; // record is being written by other shell
+      }
+      indexed_size = record_end + 1 - map;
+
+      // line is the fifth field
+      const char *line = record;
+      for (int field = 0; field < 4 && line != nullptr; field++)
+      {
+        line = (const char *)memchr(line, '\t', record_end - line);
+        line = (line == nullptr) ? nullptr : line + 1;
+      }
+      if (line == nullptr || entries.size() == UINT32_MAX)
+      {
+        continue; // damaged record
+      }
+
+      entries.push_back({(uint64_t)(record - map), (uint32_t)(line - record), (uint32_t)(record_end - line)});
+      add_trigrams((uint32_t)(entries.size() - 1), line, record_end - line);
+    }
+
+    return indexed_size < map_size && memchr(map + indexed_size, '\n', map_size - indexed_size) != nullptr;
+  }
+
+  /* Adds entry to the lists of every distinct trigram of its line */
+  void add_trigrams(uint32_t id, const char *line, size_t size)
+  {
+    line_trigrams.clear();
+    for (size_t i = 0; i + 3 <= size; i++)
+    {
+      line_trigrams.push_back(get_trigram(line + i));
+    }
+    std::sort(line_trigrams.begin(), line_trigrams.end());
+    line_trigrams.erase(std::unique(line_trigrams.begin(), line_trigrams.end()), line_trigrams.end());
+
+    for (uint32_t trigram : line_trigrams)
+    {
+      posting_list &list = trigrams[trigram];
+      uint32_t delta = id - list.last;
+      while (delta >= 0x80)
+      {
+        list.deltas.push_back((uint8_t)(delta | 0x80));
+        delta >>= 7;
+      }
+      list.deltas.push_back((uint8_t)delta);
+      list.last = id;
+      list.count++;
+    }
+  }
+
+  /* Returns index of the newest entry before index 'before' containing (or starting with) 'text', -1 if there is none */
+  long find_locked(std::string_view text, size_t before, bool is_prefix)
+  {
+    std::vector<uint32_t> found;
+    search_locked(text, before, 1, is_prefix, found);
+    return found.empty() ? -1 : (long)found[0];
+  }
+
+  /* Writes up to 'limit' indexes of entries before index 'before' containing (or starting with) 'text', the newest first */
+  void search_locked(std::string_view text, size_t before, size_t limit, bool is_prefix, std::vector<uint32_t> &found)
+  {
+    std::string pattern;
+    append_escaped(pattern, text);
+
+    auto matches = [&](uint32_t i)
+    {
+      const char *line = map + entries[i].start + entries[i].line_offset;
+      size_t size = entries[i].line_size;
+      return is_prefix ? (size >= pattern.size() && memcmp(line, pattern.data(), pattern.size()) == 0)
+                       : memmem(line, size, pattern.data(), pattern.size()) != nullptr;
+    };
+
+    if (pattern.size() < 3)
+    {
+      for (size_t i = before; i-- > 0 && found.size() < limit;)
+      {
+        if (matches((uint32_t)i))
+        {
+          found.push_back((uint32_t)i);
+        }
+      }
+      return;
+    }
+
+    // only entries of the rarest trigram may contain the text
+    const posting_list *rarest = nullptr;
+    for (size_t i = 0; i + 3 <= pattern.size(); i++)
+    {
+      auto list = trigrams.find(get_trigram(pattern.data() + i));
+      if (list == trigrams.end())
+      {
+        return;
+      }
+      if (rarest == nullptr || list->second.count < rarest->count)
+      {
+        rarest = &list->second;
+      }
+    }
+
+    std::vector<uint32_t> candidates;
+    candidates.reserve(rarest->count);
+    uint32_t id = 0;
+    for (size_t i = 0; i < rarest->deltas.size();)
+    {
+      uint32_t delta = 0;
+      for (int shift = 0; i < rarest->deltas.size(); shift += 7)
+      {
+        uint8_t byte = rarest->deltas[i++];
+        delta |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+          break;
+        }
+      }
+      id += delta;
+      candidates.push_back(id);
+    }
+
+    for (auto i = std::lower_bound(candidates.begin(), candidates.end(), (uint32_t)std::min(before, (size_t)UINT32_MAX));
+         i != candidates.begin() && found.size() < limit;)
+    {
+      --i;
+      if (matches(*i))
+      {
+        found.push_back(*i);
+      }
+    }
+  }
+
+  /* Prints entry with its number */
+  void print_entry(std::ostream &os, size_t i, bool is_verbose)
+  {
+    char number[32];
+    snprintf(number, sizeof(number), "%5zu  ", i + 1);
+    os << number;
+
+    if (is_verbose)
+    {
+      // "<unix time>\t<duration>\t<status>\t<cwd>\t" before the line
+      const char *record = map + entries[i].start;
+      char *field_end = nullptr;
+      time_t start_time = (time_t)strtoll(record, &field_end, 10);
+      double duration = strtod(field_end, &field_end);
+      long status = strtol(field_end, &field_end, 10);
+      const char *cwd = field_end + 1;
+      const char *line = record + entries[i].line_offset;
+
+      char fields[96];
+      tm local_time{};
+      localtime_r(&start_time, &local_time);
+      size_t size = strftime(fields, sizeof(fields), "%Y-%m-%d %H:%M:%S", &local_time);
+      snprintf(fields + size, sizeof(fields) - size, "  %9.3fs  %3ld  ", duration, status);
+      os << fields << unescape(std::string_view(cwd, std::max(line - 1, cwd) - cwd)) << "  ";
+    }
+
+    os << get_line(entries[i]) << '\n';
+  }
+
+  /* Returns unescaped line of entry */
+  std::string get_line(const history_entry &entry) const
+  {
+    return unescape(std::string_view(map + entry.start + entry.line_offset, entry.line_size));
+  }
+
+  /* Child after fork: there is no indexing thread, its object must not be joined here */
+  void after_fork_child()
+  {
+    (void)indexer.release();
+    is_indexing = false;
+    mutex.unlock();
+  }
+
+  /* Returns trigram key of three bytes */
+  static uint32_t get_trigram(const char *bytes)
+  {
+    return (uint32_t)(uint8_t)bytes[0] << 16 | (uint32_t)(uint8_t)bytes[1] << 8 | (uint8_t)bytes[2];
+  }
+
+  /* Appends text with '\\', tab and newline escaped */
+  static void append_escaped(std::string &out, std::string_view text)
+  {
+    for (char c : text)
+    {
+      switch (c)
+      {
+        case '\\': out += "\\\\"; break;
+        case '\t': out += "\\t";  break;
+        case '\n': out += "\\n";  break;
+        default:   out += c;      break;
+      }
+    }
+  }
+
+  /* Returns text with escapes of 'append_escaped' replaced */
+  static std::string unescape(std::string_view text)
+  {
+    std::string out;
+    out.reserve(text.size());
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+      if (text[i] != '\\' || i + 1 == text.size())
+      {
+        out += text[i];
+        continue;
+      }
+
+      i++;
+      out += (text[i] == 't') ? '\t' : (text[i] == 'n') ? '\n' : text[i];
+    }
+    return out;
+  }
+};
+
+#endif //MICROSHA_HISTORY_H
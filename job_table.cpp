@@ -0,0 +1 @@
+#include "job_table.h"
\ No newline at end of file
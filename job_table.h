@@ -0,0 +1,308 @@
+#ifndef MICROSHA_JOB_TABLE_H
+#define MICROSHA_JOB_TABLE_H
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include "error_functions.h"
+#include "perf_counters.h"
+
+/* Job states */
+enum job_state
+{
+  JOB_RUNNING, // at least one process of the job is running
+  JOB_STOPPED, // job was stopped by signal and can be continued by 'fg' or 'bg'
+  JOB_DONE     // all processes of the job finished
+};
+
+/* Kinds of pipeline stage execution */
+enum stage_kind
+{
+  STAGE_PROCESS, // child process
+  STAGE_THREAD,  // builtin on a shell thread
+  STAGE_SHELL    // builtin in the shell itself
+};
+
+/* Resource usage of one pipeline stage. Times are CLOCK_MONOTONIC points:
+ * 'start' - stage creation was started, 'ready' - stage began to run its command ('exec' for processes),
+ * 'end' - stage finished (process was reaped). Usage of a process comes from 'wait4', so it includes its
+ * waited-for descendants; usage of a builtin is that of its thread */
+struct stage_usage
+{
+  stage_kind kind = STAGE_PROCESS;
+  pid_t pid = -1;
+  timespec start{}, ready{}, end{};
+  rusage usage{};
+  perf_values counters;        // perf_event counters, collected by 'time -c' only
+  bool is_finished = false;
+};
+
+/* Pipeline started by the shell */
+struct job
+{
+  int id = 0;                    // job number, 0 if job is not in the table
+  pid_t pgid = 0;                // process group of the job, 0 if it shares process group with the shell
+  std::vector<pid_t> pids;       // job processes which are not reaped yet
+  std::vector<pid_t> stage_pids; // processes of pipeline commands in pipeline order, -1 if command was not started
+  std::vector<int> stage_status; // exit statuses of pipeline commands
+  std::vector<stage_usage> usage; // resource usage of pipeline commands
+  int status = EXIT_SUCCESS;     // job exit status - exit status of the last pipeline command
+  job_state state = JOB_RUNNING;
+  bool is_interrupted = false;   // a command of the job was killed by SIGINT
+  std::string command_line;
+};
+
+/* Table of background and stopped jobs */
+class job_table
+{
+private:
+  std::vector<job> jobs; // sorted by job number
+
+public:
+  /* Default class constructor */
+  job_table()
+  =default;
+
+  /* Default class destructor */
+  ~job_table()
+  =default;
+
+  /* Inserts job into the table. Job keeps its number if it already has one.
+   * Returns reference to the inserted job */
+  job &add(job &&new_job)
+  {
+    if (new_job.id == 0)
+    {
+      new_job.id = jobs.empty() ? 1 : jobs.back().id + 1;
+    }
+
+    auto place = std::lower_bound(jobs.begin(), jobs.end(), new_job.id,
+                                  [](const job &j, int id) { return j.id < id; });
+    return *jobs.insert(place, std::move(new_job));
+  }
+
+  /* Removes job from the table and returns it */
+  job take(int id)
+  {
+    auto it = std::find_if(jobs.begin(), jobs.end(), [id](const job &j) { return j.id == id; });
+    job taken = std::move(*it);
+    jobs.erase(it);
+
+    return taken;
+  }
+
+  /* Finds job by specification: "%n" or "n" - job number, empty, "%%" or "%+" - the most recent job.
+   * Returns nullptr if there is no such job */
+  job *find(const std::string &job_spec)
+  {
+    if (jobs.empty())
+    {
+      return nullptr;
+    }
+
+    if (job_spec.empty() || job_spec == "%%" || job_spec == "%+")
+    {
+      return &jobs.back();
+    }
+
+    char *spec_end = nullptr;
+    const char *spec_number = job_spec.c_str() + (job_spec[0] == '%' ? 1 : 0);
+    long id = strtol(spec_number, &spec_end, 10);
+    if (spec_end == spec_number || *spec_end != '\0')
+    {
+      return nullptr;
+    }
+
+    for (auto &j : jobs)
+    {
+      if (j.id == id)
+      {
+        return &j;
+      }
+    }
+    return nullptr;
+  }
+
+  /* Returns number of jobs in the table */
+  size_t size() const
+  {
+    return jobs.size();
+  }
+
+  /* Returns all jobs of the table */
+  std::vector<job> &get_jobs()
+  {
+    return jobs;
+  }
+
+  /* Collects state changes of all jobs without blocking */
+  void update()
+  {
+    for (auto &j : jobs)
+    {
+      for (size_t i = 0; i < j.pids.size();)
+      {
+        int status = 0;
+        pid_t pid = j.pids[i];
+        rusage usage{};
+        pid_t res = wait4(pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage);
+
+        if (res == 0)
+        {
+          i++;
+          continue;
+        }
+
+        if (res == -1 && errno == EINTR)
+        {
+          continue;
+        }
+
+        if (res != -1 && WIFSTOPPED(status))
+        {
+          j.state = JOB_STOPPED;
+          i++;
+        }
+        else if (res != -1 && WIFCONTINUED(status))
+        {
+          j.state = JOB_RUNNING;
+          i++;
+        }
+        else
+        {
+          finish_process(j, pid, (res == -1) ? 0 : status, (res == -1) ? nullptr : &usage);
+        }
+      }
+
+      if (j.pids.empty())
+      {
+        j.state = JOB_DONE;
+      }
+    }
+  }
+
+  /* Prints finished jobs and removes them from the table */
+  void report_done(std::ostream &os)
+  {
+    for (auto it = jobs.begin(); it != jobs.end();)
+    {
+      if (it->state == JOB_DONE)
+      {
+        print_job(os, *it);
+        it = jobs.erase(it);
+      }
+      else
+      {
+        it++;
+      }
+    }
+  }
+
+  /* Prints all jobs ('jobs' builtin) */
+  void print(std::ostream &os) const
+  {
+    for (const auto &j : jobs)
+    {
+      print_job(os, j);
+    }
+  }
+
+  /* Prints job state line */
+  static void print_job(std::ostream &os, const job &j)
+  {
+    os << "[" << j.id << "]  ";
+    switch (j.state)
+    {
+      case JOB_RUNNING:
+        os << "Running";
+        break;
+
+      case JOB_STOPPED:
+        os << "Stopped";
+        break;
+
+      case JOB_DONE:
+        if (j.status == EXIT_SUCCESS) { os << "Done"; }
+        else                          { os << "Exit " << j.status; }
+        break;
+    }
+    os << "\t" << j.command_line << std::endl;
+  }
+
+  /* Sends SIGCONT to stopped job and marks it running */
+  static void continue_job(job &j)
+  {
+    if (j.state == JOB_STOPPED)
+    {
+      if (j.pgid > 0)
+      {
+        kill(-j.pgid, SIGCONT);
+      }
+      else
+      {
+        for (pid_t pid : j.pids)
+        {
+          kill(pid, SIGCONT);
+        }
+      }
+    }
+    j.state = JOB_RUNNING;
+  }
+
+  /* Converts 'waitpid' status to shell exit status: exit code or 128 + signal number */
+  static int decode_wait_status(int status)
+  {
+    if (WIFSIGNALED(status))
+    {
+      return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+  }
+
+  /* Removes reaped process from the job and records its exit status and resource usage given by 'wait4' */
+  static void finish_process(job &j, pid_t pid, int status, const rusage *usage = nullptr)
+  {
+    auto live_pid = std::find(j.pids.begin(), j.pids.end(), pid);
+    if (live_pid != j.pids.end())
+    {
+      j.pids.erase(live_pid);
+    }
+
+    for (size_t i = 0; i < j.stage_pids.size(); i++)
+    {
+      if (j.stage_pids[i] == pid)
+      {
+        j.stage_status[i] = decode_wait_status(status);
+        j.is_interrupted = j.is_interrupted || (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT);
+        if (i < j.usage.size())
+        {
+          stage_usage &stage = j.usage[i];
+          clock_gettime(CLOCK_MONOTONIC, &stage.end);
+          stage.is_finished = true;
+          if (usage != nullptr)
+          {
+            stage.usage = *usage;
+          }
+        }
+      }
+    }
+
+    if (!j.stage_status.empty())
+    {
+      j.status = j.stage_status.back();
+    }
+  }
+};
+
+#endif //MICROSHA_JOB_TABLE_H
@@ -0,0 +1 @@
+#include "line_arena.h"
@@ -0,0 +1,101 @@
+#ifndef MICROSHA_LINE_ARENA_H
+#define MICROSHA_LINE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include <algorithm>
+
+#define LINE_ARENA_CHUNK_SIZE (16 * 1024)
+
+/* Bump allocator for objects living while one command line is parsed and executed.
+ * Allocation only moves a pointer inside the current chunk, deallocation does nothing,
+ * and 'reset' frees everything at once by rewinding to the first chunk.
+ * Chunks are kept between lines, so after the first lines there are no 'malloc' calls at all.
+ * Arena is not thread-safe. */
+class line_arena : public std::pmr::memory_resource
+{
+private:
+  /* Memory chunk */
+  struct chunk
+  {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  std::vector<chunk> chunks;
+  size_t chunk_index = 0; // chunk allocations are served from
+  size_t offset = 0;      // first free byte of the current chunk
+
+public:
+  /* Class constructor. Allocates the first chunk */
+  line_arena()
+  {
+    chunks.push_back({std::unique_ptr<char[]>(new char[LINE_ARENA_CHUNK_SIZE]), LINE_ARENA_CHUNK_SIZE});
+  }
+
+  /* Default class destructor */
+  ~line_arena() override
+  =default;
+
+  line_arena(const line_arena &) = delete;
+  line_arena &operator=(const line_arena &) = delete;
+
+  /* Frees all allocations. Objects allocated from the arena must not be used after it */
+  void reset()
+  {
+    chunk_index = 0;
+    offset = 0;
+  }
+
+  /* Returns number of bytes in all chunks */
+  size_t get_capacity() const
+  {
+    size_t capacity = 0;
+    for (const auto &c : chunks)
+    {
+      capacity += c.size;
+    }
+    return capacity;
+  }
+
+protected:
+  void *do_allocate(size_t bytes, size_t alignment) override
+  {
+    while (true)
+    {
+      chunk &current = chunks[chunk_index];
+      auto base = (uintptr_t)current.data.get();
+      size_t aligned = ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+
+      if (aligned + bytes <= current.size)
+      {
+        offset = aligned + bytes;
+        return current.data.get() + aligned;
+      }
+
+      // next kept chunk, or a new one big enough for the request
+      chunk_index++;
+      offset = 0;
+      if (chunk_index == chunks.size())
+      {
+        size_t size = std::max<size_t>(LINE_ARENA_CHUNK_SIZE, bytes + alignment);
+        chunks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+      }
+    }
+  }
+
+  void do_deallocate(void *, size_t, size_t) override
+  {
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+#endif //MICROSHA_LINE_ARENA_H
@@ -0,0 +1 @@
+#include "line_editor.h"
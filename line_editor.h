@@ -0,0 +1,596 @@
+#ifndef MICROSHA_LINE_EDITOR_H
+#define MICROSHA_LINE_EDITOR_H
+
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "command.h"
+
+#define EDITOR_MAX_COMPLETIONS 10000 // candidates taken at most
+#define EDITOR_ASK_COMPLETIONS 100   // more candidates are listed only after confirmation
+#define EDITOR_SHELL_META " \t\\'\"|<>&$*?[" // symbols escaped in completed words
+
+/* Line editor of the interactive shell. Terminal is in raw mode only while a line is read.
+ * Keys: arrows, Home/End, Ctrl-A/E/B/F - cursor movement; Backspace, Delete, Ctrl-D/K/U/W - deletion;
+ * Up/Down, Ctrl-P/N - history entries; Ctrl-R - reverse history search; Ctrl-L - clear screen;
+ * Ctrl-C - drop the line; Ctrl-D on empty line - end of input.
+ * Tab completes the word before the cursor: the first word of a command from builtins and '$PATH' executables
+ * (prefix tree of 'path_cache', so directories are not read on every key), other words - from file names
+ * found by filename expansion of "<word>*" (listing cache of 'dir_cache'). The second Tab lists the candidates.
+ * If standard input or output is not a terminal, lines are read with 'getline' */
+class line_editor
+{
+private:
+  termios cooked{};         // terminal modes of commands, taken at the first line
+  bool has_cooked = false;
+  const std::string *prompt_text = nullptr;
+  std::string line;
+  size_t cursor = 0;        // byte offset in 'line'
+  bool last_was_tab = false;
+  size_t history_pos = 0;   // number of history entry shown, 0 - the edited line
+  std::string edited_line;  // edited line kept while history entries are shown
+  std::string output;       // terminal output, written at once
+
+public:
+  /* Default class constructor */
+  line_editor()
+  =default;
+
+  /* Class destructor. Terminal is restored if reading was interrupted */
+  ~line_editor()
+  {
+    leave_raw_mode();
+  }
+
+  line_editor(const line_editor &) = delete;
+  line_editor &operator=(const line_editor &) = delete;
+
+  /* Prints prompt and reads line. Returns false at the end of input */
+  bool read_line(const std::string &prompt, std::string &result)
+  {
+    std::cout.flush();
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || !enter_raw_mode())
+    {
+      std::cout << prompt << std::flush;
+      return (bool)std::getline(std::cin, result);
+    }
+
+    prompt_text = &prompt;
+    line.clear();
+    cursor = 0;
+    history_pos = 0;
+    last_was_tab = false;
+    refresh();
+
+    int pending = -1; // key which finished reverse search
+    while (true)
+    {
+      int c = (pending != -1) ? pending : read_byte();
+      pending = -1;
+
+      switch (c)
+      {
+        case -1: // input is closed
+        case 4:  // Ctrl-D
+          if (c == 4 && !line.empty())
+          {
+            delete_char();
+            break;
+          }
+          leave_raw_mode();
+          if (!line.empty())
+          {
+            write_text("\n");
+            result = line;
+            return true;
+          }
+          return false;
+
+        case '\r':
+        case '\n':
+          cursor = line.size();
+          refresh();
+          leave_raw_mode();
+          write_text("\n");
+          result = line;
+          return true;
+
+        case 3: // Ctrl-C
+          leave_raw_mode();
+          write_text("^C\n");
+          result.clear();
+          return true;
+
+        case '\t':
+          complete();
+          break;
+
+        case 127: // Backspace
+        case 8:   // Ctrl-H
+          if (cursor > 0)
+          {
+            move_left();
+            delete_char();
+          }
+          break;
+
+        case 1:  cursor = 0;                 refresh(); break; // Ctrl-A
+        case 5:  cursor = line.size();       refresh(); break; // Ctrl-E
+        case 2:  move_left();                refresh(); break; // Ctrl-B
+        case 6:  move_right();               refresh(); break; // Ctrl-F
+        case 11: line.erase(cursor);         refresh(); break; // Ctrl-K
+        case 16: show_history(-1);                      break; // Ctrl-P
+        case 14: show_history(1);                       break; // Ctrl-N
+        case 18: pending = reverse_search();            break; // Ctrl-R
+
+        case 21: // Ctrl-U
+          line.erase(0, cursor);
+          cursor = 0;
+          refresh();
+          break;
+
+        case 23: // Ctrl-W
+        {
+          size_t word_start = cursor;
+          while (word_start > 0 && (line[word_start - 1] == ' ' || line[word_start - 1] == '\t'))
+          {
+            word_start--;
+          }
+          while (word_start > 0 && line[word_start - 1] != ' ' && line[word_start - 1] != '\t')
+          {
+            word_start--;
+          }
+          line.erase(word_start, cursor - word_start);
+          cursor = word_start;
+          refresh();
+          break;
+        }
+
+        case 12: // Ctrl-L
+          write_text("\x1b[H\x1b[2J");
+          refresh();
+          break;
+
+        case 27: // escape sequence
+          read_escape();
+          break;
+
+        default:
+          if ((unsigned char)c >= 32)
+          {
+            line.insert(cursor++, 1, (char)c);
+            refresh();
+          }
+          break;
+      }
+
+      last_was_tab = (c == '\t');
+    }
+  }
+
+private:
+  /* Switches terminal to byte input without echo and signals. Returns false if terminal can not be set */
+  bool enter_raw_mode()
+  {
+    if (!has_cooked)
+    {
+      if (tcgetattr(STDIN_FILENO, &cooked) == -1)
+      {
+        return false;
+      }
+      has_cooked = true;
+    }
+
+    termios raw = cooked;
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0;
+  }
+
+  /* Restores terminal modes of commands */
+  void leave_raw_mode()
+  {
+    if (has_cooked)
+    {
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+    }
+  }
+
+  /* Reads one byte. Returns -1 at the end of input */
+  static int read_byte()
+  {
+    unsigned char c = 0;
+    ssize_t size;
+    while ((size = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR)
+    {
+    }
+    return (size == 1) ? c : -1;
+  }
+
+  /* Writes text to the terminal */
+  static void write_text(std::string_view text)
+  {
+    while (!text.empty())
+    {
+      ssize_t written = write(STDOUT_FILENO, text.data(), text.size());
+      if (written == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (written <= 0)
+      {
+        return;
+      }
+      text.remove_prefix(written);
+    }
+  }
+
+  /* Redraws prompt and line and places cursor */
+  void refresh()
+  {
+    output = "\r";
+    output += *prompt_text;
+    output += line;
+    output += "\x1b[K";
+
+    size_t chars_after = count_chars(std::string_view(line).substr(cursor));
+    if (chars_after > 0)
+    {
+      output += "\x1b[" + std::to_string(chars_after) + "D";
+    }
+    write_text(output);
+  }
+
+  /* Returns number of UTF-8 characters */
+  static size_t count_chars(std::string_view text)
+  {
+    return (size_t)std::count_if(text.begin(), text.end(), [](char c) { return ((unsigned char)c & 0xc0) != 0x80; });
+  }
+
+  /* Moves cursor one character left */
+  void move_left()
+  {
+    while (cursor > 0 && (((unsigned char)line[--cursor] & 0xc0) == 0x80))
+    {
+    }
+  }
+
+  /* Moves cursor one character right */
+  void move_right()
+  {
+    if (cursor < line.size())
+    {
+      cursor++;
+    }
+    while (cursor < line.size() && (((unsigned char)line[cursor] & 0xc0) == 0x80))
+    {
+      cursor++;
+    }
+  }
+
+  /* Deletes character under cursor */
+  void delete_char()
+  {
+    size_t char_start = cursor;
+    move_right();
+    line.erase(char_start, cursor - char_start);
+    cursor = char_start;
+    refresh();
+  }
+
+  /* Applies "ESC [ ..." and "ESC O ..." key sequences */
+  void read_escape()
+  {
+    int kind = read_byte();
+    int key = read_byte();
+    if (kind != '[' && kind != 'O')
+    {
+      return;
+    }
+
+    // "ESC [ <number> ~" keys
+    if (kind == '[' && key >= '0' && key <= '9')
+    {
+      int number = key - '0';
+      for (int c = read_byte(); c != '~' && c != -1; c = read_byte())
+      {
+        number = (c >= '0' && c <= '9') ? number * 10 + c - '0' : -1;
+      }
+
+      switch (number)
+      {
+        case 1: case 7: key = 'H'; break;
+        case 4: case 8: key = 'F'; break;
+        case 3:         delete_char(); return;
+        default:        return;
+      }
+    }
+
+    switch (key)
+    {
+      case 'A': show_history(-1);                 break;
+      case 'B': show_history(1);                  break;
+      case 'C': move_right();           refresh(); break;
+      case 'D': move_left();            refresh(); break;
+      case 'H': cursor = 0;             refresh(); break;
+      case 'F': cursor = line.size();   refresh(); break;
+      default:                                    break;
+    }
+  }
+
+  /* Shows previous (-1) or next (1) history entry instead of the line. After the last entry the edited line returns */
+  void show_history(int step)
+  {
+    command_history &history = command_history::instance();
+    size_t entries = history.size();
+
+    if (history_pos == 0)
+    {
+      if (step > 0 || entries == 0)
+      {
+        return;
+      }
+      edited_line = line;
+      history_pos = entries;
+    }
+    else if (step < 0)
+    {
+      history_pos -= (history_pos > 1) ? 1 : 0;
+    }
+    else
+    {
+      history_pos = (history_pos < entries) ? history_pos + 1 : 0;
+    }
+
+    line = (history_pos == 0) ? edited_line : history.get(history_pos);
+    cursor = line.size();
+    refresh();
+  }
+
+  /* Incremental reverse search of history: typed text selects the newest entry containing it,
+   * Ctrl-R steps to older matches, Ctrl-C or Ctrl-G cancels. Other key accepts the match and is returned
+   * to be applied (-1 if there is none) */
+  int reverse_search()
+  {
+    command_history &history = command_history::instance();
+    std::string query, match;
+    size_t match_number = 0;
+
+    while (true)
+    {
+      output = "\r(reverse-i-search)`" + query + "': " + match + "\x1b[K";
+      write_text(output);
+
+      int c = read_byte();
+      if (c == 18 && match_number > 1) // Ctrl-R
+      {
+        size_t older = history.find(query, match_number);
+        if (older != 0)
+        {
+          match_number = older;
+          match = history.get(match_number);
+        }
+        continue;
+      }
+      if (c == 127 || c == 8 || (c >= 32 && c != 127))
+      {
+        if (c == 127 || c == 8)
+        {
+          query.erase(query.empty() ? 0 : query.size() - 1);
+        }
+        else
+        {
+          query += (char)c;
+        }
+        match_number = query.empty() ? 0 : history.find(query, 0);
+        match = (match_number == 0) ? "" : history.get(match_number);
+        continue;
+      }
+      if (c == 18)
+      {
+        continue;
+      }
+
+      if (c != 3 && c != 7 && match_number != 0)
+      {
+        line = match;
+        cursor = line.size();
+      }
+      refresh();
+      return (c == 3 || c == 7) ? -1 : c;
+    }
+  }
+
+  /* Completes the word before the cursor */
+  void complete()
+  {
+    size_t word_start = cursor;
+    while (word_start > 0 && strchr(" \t|<>&;", line[word_start - 1]) == nullptr)
+    {
+      word_start--;
+    }
+    std::string word = unescape_word(std::string_view(line).substr(word_start, cursor - word_start));
+
+    // the first word of a command is a command name
+    size_t before = word_start;
+    while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t'))
+    {
+      before--;
+    }
+    bool is_command = (before == 0 || strchr("|;&", line[before - 1]) != nullptr) && word.find('/') == std::string::npos;
+
+    std::vector<std::string> candidates;
+    if (is_command) { complete_command(word, candidates); }
+    else            { complete_file(word, candidates);    }
+
+    if (candidates.empty())
+    {
+      write_text("\a");
+      return;
+    }
+
+    // the longest common prefix of candidates is inserted
+    size_t common = candidates.front().size();
+    for (const auto &candidate : candidates)
+    {
+      common = std::min(common, (size_t)(std::mismatch(candidate.begin(), candidate.begin() + std::min(common, candidate.size()),
+                                                       candidates.front().begin()).first - candidate.begin()));
+    }
+
+    if (common > word.size() || candidates.size() == 1)
+    {
+      std::string insertion = escape_word(std::string_view(candidates.front()).substr(word.size(), common - word.size()));
+      if (candidates.size() == 1 && candidates.front().back() != '/')
+      {
+        insertion += ' ';
+      }
+      line.insert(cursor, insertion);
+      cursor += insertion.size();
+      refresh();
+      return;
+    }
+
+    if (!last_was_tab)
+    {
+      write_text("\a");
+      return;
+    }
+    list_candidates(candidates, !is_command);
+  }
+
+  /* Writes builtins and '$PATH' executables starting with prefix, sorted */
+  static void complete_command(const std::string &prefix, std::vector<std::string> &candidates)
+  {
+    path_cache::instance().complete(prefix, candidates, EDITOR_MAX_COMPLETIONS);
+    for (std::string_view name : command::get_builtin_names())
+    {
+      if (name.compare(0, prefix.size(), prefix) == 0)
+      {
+        candidates.emplace_back(name);
+      }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+  }
+
+  /* Writes pathnames starting with word, directories end with '/' */
+  static void complete_file(const std::string &word, std::vector<std::string> &candidates)
+  {
+    std::string pattern;
+    for (char c : word)
+    {
+      if (c == '*' || c == '?' || c == '[' || c == '\\')
+      {
+        pattern += '\\';
+      }
+      pattern += c;
+    }
+    pattern += '*';
+
+    candidates = command::expand_path_regex(pattern);
+    if (candidates.size() > EDITOR_MAX_COMPLETIONS)
+    {
+      candidates.resize(EDITOR_MAX_COMPLETIONS);
+    }
+
+    for (auto &candidate : candidates)
+    {
+      struct stat st{};
+      if (stat(candidate.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      {
+        candidate += '/';
+      }
+    }
+  }
+
+  /* Prints candidates in columns under the line, file names without directories, then redraws the line */
+  void list_candidates(const std::vector<std::string> &candidates, bool is_path)
+  {
+    write_text("\n");
+    if (candidates.size() > EDITOR_ASK_COMPLETIONS)
+    {
+      write_text("Display all " + std::to_string(candidates.size()) + " possibilities? (y or n)");
+      int answer = read_byte();
+      write_text("\n");
+      if (answer != 'y' && answer != 'Y')
+      {
+        refresh();
+        return;
+      }
+    }
+
+    std::vector<std::string_view> names;
+    size_t width = 0;
+    for (std::string_view candidate : candidates)
+    {
+      size_t slash = is_path ? candidate.rfind('/', candidate.size() - 2) : std::string_view::npos;
+      names.push_back((slash == std::string_view::npos || candidate.size() < 2) ? candidate : candidate.substr(slash + 1));
+      width = std::max(width, count_chars(names.back()) + 2);
+    }
+
+    winsize size{};
+    size_t screen_width = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) ? size.ws_col : 80;
+    size_t columns = std::max(screen_width / width, (size_t)1);
+    size_t rows = (names.size() + columns - 1) / columns;
+
+    output.clear();
+    for (size_t row = 0; row < rows; row++)
+    {
+      for (size_t column = 0; column < columns; column++)
+      {
+        size_t i = column * rows + row;
+        if (i < names.size())
+        {
+          output += names[i];
+          output.append((i + rows < names.size()) ? width - count_chars(names[i]) : 0, ' ');
+        }
+      }
+      output += '\n';
+    }
+    write_text(output);
+    refresh();
+  }
+
+  /* Returns typed word without '\' escapes */
+  static std::string unescape_word(std::string_view word)
+  {
+    std::string result;
+    for (size_t i = 0; i < word.size(); i++)
+    {
+      i += (word[i] == '\\' && i + 1 < word.size()) ? 1 : 0;
+      result += word[i];
+    }
+    return result;
+  }
+
+  /* Returns text with shell meta-symbols escaped by '\' */
+  static std::string escape_word(std::string_view text)
+  {
+    std::string result;
+    for (char c : text)
+    {
+      if (strchr(EDITOR_SHELL_META, c) != nullptr)
+      {
+        result += '\\';
+      }
+      result += c;
+    }
+    return result;
+  }
+};
+
+#endif //MICROSHA_LINE_EDITOR_H
@@ -0,0 +1 @@
+#include "logger.h"
@@ -0,0 +1,362 @@
+#ifndef MICROSHA_LOGGER_H
+#define MICROSHA_LOGGER_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <system_error>
+#include <string>
+#include <thread>
+
+#define LOG_DEFAULT_FILE_NAME "log_out.txt"
+#define LOG_QUEUE_CAPACITY 4096                // records, power of 2
+#define LOG_BATCH_DELAY_NS (20 * 1000 * 1000)  // flusher collects records of a burst for 20 ms
+#define LOG_WRITE_BATCH 64                     // records written by one 'writev'
+#define LOG_LINE_SIZE 256
+
+/* Enumeration for log record levels */
+enum log_level
+{
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARNING,
+  LOG_ERROR,
+  LOG_OFF     // threshold only: nothing is logged
+};
+
+/* Log record. Source file name is a string literal ('__FILE__'), so only the pointer is kept */
+struct log_record
+{
+  timespec time;
+  pid_t pid;
+  log_level level;
+  int code;
+  const char *code_name;
+  const char *description;
+  const char *file;
+  int line;
+};
+
+/* Asynchronous shell log. 'add' only puts a record into a bounded lock-free queue: it makes no system
+ * calls unless it has to wake the flusher thread. The flusher is started by the first record; it waits
+ * for a burst of records to end (or the queue to fill a half), then appends them to the log file with
+ * batched 'writev'. Records are kept across shell runs - the file is opened for appending.
+ * If the queue is full, records are dropped and their number is logged later.
+ * A forked child has no flusher: records queued by the parent are discarded there (the parent writes them)
+ * and the child writes its own records at once.
+ * Log path is set by 'MICROSHA_LOG' environment variable (default "log_out.txt" in the directory where the
+ * first record is written), threshold level - by 'MICROSHA_LOG_LEVEL' ("debug", "info" (default), "warning",
+ * "error", "off"). Line format: "<UTC time> pid=<pid> level=<level> code=<name>(<value>) at=<file>:<line> msg=<text>" */
+class logger
+{
+private:
+  /* Queue slot. Its sequence number tells whether the slot is free for a writer or filled for the reader */
+  struct slot
+  {
+    std::atomic<size_t> seq{0};
+    log_record record{};
+  };
+
+  std::unique_ptr<slot[]> slots;
+  alignas(64) std::atomic<size_t> tail{0};       // next slot for writers
+  alignas(64) std::atomic<size_t> head{0};       // next slot of the flusher, written by it only
+  alignas(64) std::atomic<uint32_t> wake_seq{0}; // futex word of the flusher
+  std::atomic<bool> flusher_sleeps{false};
+  std::atomic<bool> is_stopping{false};
+  std::atomic<size_t> dropped{0};
+
+  std::unique_ptr<std::thread> flusher;
+  std::atomic<bool> is_started{false};
+  std::atomic<bool> is_synchronous{false};       // records are written at once: no flusher in this process
+  log_level threshold = LOG_INFO;
+  std::string file_name;
+  int fd = -1;
+
+public:
+  /* Class constructor. Reads settings from the environment */
+  logger() : slots(new slot[LOG_QUEUE_CAPACITY])
+  {
+    for (size_t i = 0; i < LOG_QUEUE_CAPACITY; i++)
+    {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    const char *name = getenv("MICROSHA_LOG");
+    file_name = (name != nullptr && *name != '\0') ? name : LOG_DEFAULT_FILE_NAME;
+    threshold = get_level(getenv("MICROSHA_LOG_LEVEL"));
+
+    pthread_atfork(nullptr, nullptr, []() { instance().after_fork_child(); });
+  }
+
+  /* Class destructor. Writes queued records and stops the flusher */
+  ~logger()
+  {
+    if (flusher != nullptr)
+    {
+      is_stopping.store(true, std::memory_order_seq_cst);
+      wake();
+      flusher->join();
+    }
+    if (fd != -1)
+    {
+      close(fd);
+    }
+  }
+
+  logger(const logger &) = delete;
+  logger &operator=(const logger &) = delete;
+
+  /* Returns shell-wide log */
+  static logger &instance()
+  {
+    static logger log;
+    return log;
+  }
+
+  /* Adds record. Returns false if it was dropped because the queue is full */
+  bool add(log_level level, int code, const char *code_name, const char *description, const char *file, int line)
+  {
+    if (level < threshold)
+    {
+      return true;
+    }
+
+    log_record record{{}, getpid(), level, code, code_name, description, file, line};
+    clock_gettime(CLOCK_REALTIME, &record.time);
+
+    if (!is_started.exchange(true, std::memory_order_acq_rel))
+    {
+      start_flusher();
+    }
+    if (is_synchronous.load(std::memory_order_relaxed))
+    {
+      write_now(record);
+      return true;
+    }
+
+    size_t pos = tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+      slot &s = slots[pos & (LOG_QUEUE_CAPACITY - 1)];
+      auto diff = (intptr_t)(s.seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0)
+      {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          s.record = record;
+          s.seq.store(pos + 1, std::memory_order_release);
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else
+      {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    // flusher is woken by the first record of a burst and when the queue gets half full
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (flusher_sleeps.load(std::memory_order_relaxed) || pos + 1 - head.load(std::memory_order_relaxed) == LOG_QUEUE_CAPACITY / 2)
+    {
+      wake();
+    }
+    return true;
+  }
+
+  /* Parses level name. Unknown name gives the default level */
+  static log_level get_level(const char *name)
+  {
+    if (name == nullptr)                 { return LOG_INFO;    }
+    if (strcmp(name, "debug") == 0)      { return LOG_DEBUG;   }
+    if (strcmp(name, "warning") == 0)    { return LOG_WARNING; }
+    if (strcmp(name, "error") == 0)      { return LOG_ERROR;   }
+    if (strcmp(name, "off") == 0)        { return LOG_OFF;     }
+    return LOG_INFO;
+  }
+
+  /* Returns level name */
+  static const char *get_level_name(log_level level)
+  {
+    switch (level)
+    {
+      case LOG_DEBUG:   return "debug";
+      case LOG_INFO:    return "info";
+      case LOG_WARNING: return "warning";
+      default:          return "error";
+    }
+  }
+
+private:
+  /* Opens log file and starts the flusher thread. Without a thread records are written at once */
+  void start_flusher()
+  {
+    fd = open(file_name.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+    try
+    {
+      flusher = std::make_unique<std::thread>([this]() { run_flusher(); });
+    }
+    catch (const std::system_error &)
+    {
+      is_synchronous.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  /* Flusher thread: sleeps until records come, waits for the burst to end, writes everything queued */
+  void run_flusher()
+  {
+    while (true)
+    {
+      wait(nullptr);
+
+      timespec delay{0, LOG_BATCH_DELAY_NS};
+      if (!is_stopping.load(std::memory_order_acquire))
+      {
+        wait(&delay);
+      }
+
+      bool stopping = is_stopping.load(std::memory_order_acquire);
+      write_queued();
+      if (stopping)
+      {
+        return;
+      }
+    }
+  }
+
+  /* Sleeps until woken or 'timeout' passes. Without timeout sleeps only if the queue is empty */
+  void wait(const timespec *timeout)
+  {
+    uint32_t seq = wake_seq.load(std::memory_order_acquire);
+    if (timeout != nullptr)
+    {
+      syscall(SYS_futex, &wake_seq, FUTEX_WAIT_PRIVATE, seq, timeout, nullptr, 0);
+      return;
+    }
+
+    flusher_sleeps.store(true, std::memory_order_seq_cst);
+    // queue is checked again after announcing sleep, so a record added in between is not missed
+    if (!has_queued() && !is_stopping.load(std::memory_order_seq_cst))
+    {
+      syscall(SYS_futex, &wake_seq, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+    }
+    flusher_sleeps.store(false, std::memory_order_relaxed);
+  }
+
+  /* Wakes the flusher */
+  void wake()
+  {
+    wake_seq.fetch_add(1, std::memory_order_seq_cst);
+    syscall(SYS_futex, &wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+  /* Checks if the flusher has a record to take */
+  bool has_queued() const
+  {
+    size_t pos = head.load(std::memory_order_relaxed);
+    return slots[pos & (LOG_QUEUE_CAPACITY - 1)].seq.load(std::memory_order_seq_cst) == pos + 1;
+  }
+
+  /* Writes all queued records by batches */
+  void write_queued()
+  {
+    char lines[LOG_WRITE_BATCH][LOG_LINE_SIZE];
+    iovec iov[LOG_WRITE_BATCH];
+    size_t count = 0;
+
+    while (true)
+    {
+      size_t lost = dropped.exchange(0, std::memory_order_relaxed);
+      if (lost > 0)
+      {
+        int size = snprintf(lines[count], LOG_LINE_SIZE, "%zu log records dropped: queue is full\n", lost);
+        iov[count] = {lines[count], (size_t)std::min(size, LOG_LINE_SIZE - 1)};
+        count++;
+      }
+
+      for (; count < LOG_WRITE_BATCH && has_queued(); count++)
+      {
+        size_t pos = head.load(std::memory_order_relaxed);
+        slot &s = slots[pos & (LOG_QUEUE_CAPACITY - 1)];
+        iov[count] = {lines[count], format(s.record, lines[count])};
+        s.seq.store(pos + LOG_QUEUE_CAPACITY, std::memory_order_release);
+        head.store(pos + 1, std::memory_order_relaxed);
+      }
+
+      if (count == 0)
+      {
+        return;
+      }
+      if (fd != -1)
+      {
+        while (writev(fd, iov, (int)count) == -1 && errno == EINTR)
+        {
+        }
+      }
+      count = 0;
+    }
+  }
+
+  /* Writes record directly: forked child has no flusher, and its log descriptor may be closed */
+  void write_now(const log_record &record) const
+  {
+    char line[LOG_LINE_SIZE];
+    size_t size = format(record, line);
+
+    int child_fd = open(file_name.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (child_fd != -1)
+    {
+      ssize_t written = write(child_fd, line, size);
+      (void)written;
+      close(child_fd);
+    }
+  }
+
+  /* Formats record into the line of LOG_LINE_SIZE bytes. Returns its length */
+  static size_t format(const log_record &record, char *line)
+  {
+    tm utc{};
+    gmtime_r(&record.time.tv_sec, &utc);
+
+    int size = snprintf(line, LOG_LINE_SIZE,
+                        "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ pid=%d level=%s code=%s(%d) at=%s:%d msg=%s\n",
+                        utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+                        record.time.tv_nsec / 1000, (int)record.pid, get_level_name(record.level),
+                        record.code_name, record.code, record.file, record.line, record.description);
+    if (size >= LOG_LINE_SIZE)
+    {
+      line[LOG_LINE_SIZE - 2] = '\n';
+      return LOG_LINE_SIZE - 1;
+    }
+    return (size < 0) ? 0 : (size_t)size;
+  }
+
+  /* Child process keeps neither the flusher nor records of the parent */
+  void after_fork_child()
+  {
+    is_synchronous.store(true, std::memory_order_relaxed);
+    (void)flusher.release(); // the thread exists only in the parent, its object must not be joined here
+    fd = -1;
+  }
+};
+
+#endif //MICROSHA_LOGGER_H
@@ -1,10 +1,42 @@
 #include "microsha.h"
 
-int main()
+/* Usage : microsha [-e] [-c command_line | script_file]
+ *   -e - stop batch execution after the first line finished with non-zero exit status */
+int main(int argc, char *argv[])
 {
   Microsha program;
+  const char *command_text = nullptr;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "+ec:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'e':
+        program.SetStopOnError(true);
+        break;
+
+      case 'c':
+        command_text = optarg;
+        break;
+
+      default:
+        std::cerr << "Usage : " << argv[0] << " [-e] [-c command_line | script_file]" << std::endl;
+        return EXIT_SYNTAX_ERROR;
+    }
+  }
+
+  if (command_text != nullptr)
+  {
+    return program.RunCommand(command_text);
+  }
+
+  if (optind < argc)
+  {
+    return program.RunScript(argv[optind]);
+  }
 
   program.Run();
 
-  return 0;
+  return program.GetLastStatus();
 }
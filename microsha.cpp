@@ -1,40 +1,150 @@
 #include "microsha.h"
 
-int signal_value;
-
-/* SIGINT signal handler */
-static void SIGINT_handler(int sig_value)
-{
-  signal_value = sig_value;
-}
-
 /* Program execution loop */
 ERR_CODE Microsha::Run()
 {
-  command_pipeline pipeline{};
   std::string command_line{};
-  signal(SIGINT, SIGINT_handler);
+  double last_duration = 0; // execution time of the last line in seconds
+  command_history &history = command_history::instance();
+  history.open();
+  line_editor editor;
+  pipeline.enable_job_control();
 
   while (true)
   {
-    signal_value = 0;
-    command::print_intro_line(std::cout);
+    pipeline.consume_interrupt();
+    pipeline.report_jobs(std::cout);
+    const std::string &prompt_text = shell_prompt.render(command::get_cd_count(), pipeline.get_last_status(),
+                                                         last_duration, pipeline.get_job_count());
 
     //TODO: something is wrong here. Signal : sighup is thrown. But if 'break' is removed lool becomes infinite
-    if (!getline(std::cin, command_line))
+    if (!editor.read_line(prompt_text, command_line))
     {
       std::cout << std::endl;
       break;
     }
 
-    if (signal_value == SIGINT) {
+    // SIGINT is blocked in the shell, so line typed while it arrived is dropped without race with 'getline'
+    if (pipeline.consume_interrupt()) {
+      continue;
+    }
+
+    // history reference is replaced and the line is shown as it will be executed
+    bool is_expanded = false;
+    if (history.expand(command_line, is_expanded) != SUCCESS)
+    {
       continue;
     }
+    if (is_expanded)
+    {
+      std::cout << command_line << std::endl;
+    }
 
+    std::string cwd = shell_prompt.get_cwd(command::get_cd_count());
+    auto start = std::chrono::steady_clock::now();
     pipeline.reset_pipeline(command_line);
     pipeline.exec();
+    last_duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    history.add(command_line, cwd, last_duration, pipeline.get_last_status());
 
+    if (pipeline.is_exit_requested())
+    {
+      break;
+    }
   }
 
   return SUCCESS;
 }
+
+/* Executes command lines given as one text ('-c' option) without prompt */
+int Microsha::RunCommand(const std::string &command_text)
+{
+  return ExecText(command_text.data(), command_text.size());
+}
+
+/* Executes command lines of script file without prompt. The file is mapped to memory instead of stream reading */
+int Microsha::RunScript(const char *script_name)
+{
+  int fd = open(script_name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    perror(script_name);
+    ADD_LOG(ERR_FILE_OPEN, 3);
+    return EXIT_NOT_FOUND;
+  }
+
+  struct stat st{};
+  if (fstat(fd, &st) == -1)
+  {
+    perror(script_name);
+    close(fd);
+    ADD_LOG(ERR_STAT, 4);
+    return EXIT_NOT_FOUND;
+  }
+
+  if (st.st_size == 0)
+  {
+    close(fd);
+    return EXIT_SUCCESS;
+  }
+
+  void *text = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED)
+  {
+    perror(script_name);
+    ADD_LOG(ERR_FILE_OPERATE, 4);
+    return EXIT_NOT_FOUND;
+  }
+  madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+  int status = ExecText((const char *)text, st.st_size);
+
+  munmap(text, st.st_size);
+  return status;
+}
+
+/* Executes every line of text. Empty lines and lines starting with '#' are skipped */
+int Microsha::ExecText(const char *text, size_t size)
+{
+  std::string command_line{};
+  const char *text_end = text + size;
+
+  for (const char *line = text; line < text_end;)
+  {
+    auto line_end = (const char *)memchr(line, '\n', text_end - line);
+    if (line_end == nullptr)
+    {
+      line_end = text_end;
+    }
+
+    command_line.assign(line, line_end);
+    line = line_end + 1;
+
+    if (command_line.empty() || command_line[0] == '#')
+    {
+      continue;
+    }
+
+    pipeline.report_jobs(std::cout);
+    pipeline.reset_pipeline(command_line);
+    pipeline.exec();
+
+    if (pipeline.is_exit_requested())
+    {
+      break;
+    }
+
+    if (pipeline.was_interrupted() || pipeline.consume_interrupt())
+    {
+      return 128 + SIGINT;
+    }
+
+    if (stop_on_error && pipeline.get_last_status() != EXIT_SUCCESS)
+    {
+      break;
+    }
+  }
+
+  return pipeline.get_last_status();
+}
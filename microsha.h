@@ -1,12 +1,21 @@
 #ifndef MICROSHA_MICROSHA_H
 #define MICROSHA_MICROSHA_H
 
+#include <sys/mman.h>
+
+#include <chrono>
+
 #include "command_pipeline.h"
+#include "prompt.h"
+#include "line_editor.h"
 
 /* Micro shell program class declaration */
 class Microsha
 {
 private:
+  command_pipeline pipeline{};
+  prompt shell_prompt{};
+  bool stop_on_error = false;
 
 public:
   /* Default class constructor */
@@ -19,6 +28,36 @@ public:
 
   /* Program execution loop */
   ERR_CODE Run();
+
+  /* Executes command lines given as one text ('-c' option) without prompt.
+   * Returns exit status of the last executed line */
+  int RunCommand(const std::string &command_text);
+
+  /* Executes command lines of script file without prompt.
+   * Returns exit status of the last executed line or 127 if script can not be read */
+  int RunScript(const char *script_name);
+
+  /* Makes batch execution stop after the first line with non-zero exit status ('-e' option) */
+  void SetStopOnError(bool new_stop_on_error)
+  {
+    stop_on_error = new_stop_on_error;
+  }
+
+  /* Returns exit status of the last executed line */
+  int GetLastStatus() const
+  {
+    return pipeline.get_last_status();
+  }
+
+  /* Returns numbers of processes created for pipeline stages */
+  const process_counts &GetProcessCounts() const
+  {
+    return pipeline.get_process_counts();
+  }
+
+private:
+  /* Executes every line of text. Empty lines and lines starting with '#' are skipped */
+  int ExecText(const char *text, size_t size);
 };
 
 #endif //MICROSHA_MICROSHA_H
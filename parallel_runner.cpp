@@ -0,0 +1 @@
+#include "parallel_runner.h"
\ No newline at end of file
@@ -0,0 +1,370 @@
+#ifndef MICROSHA_PARALLEL_RUNNER_H
+#define MICROSHA_PARALLEL_RUNNER_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstdlib>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "command.h"
+
+#define PARALLEL_MAX_FAILED 101
+#define PARALLEL_MAX_BUFFERED 1024   // instances holding output buffers at a time
+#define PARALLEL_RESERVED_FDS 32     // descriptors left for the runner and instance launches
+
+/* 'parallel [-j N] [-k] command args... [::: items...]' builtin.
+ * Runs one command instance per item with at most N instances at a time. Item replaces every '{}'
+ * in command arguments or is appended as the last argument if there is no '{}'.
+ * Items are taken from arguments after ':::' (already glob-expanded) or from standard input lines.
+ * Output of every instance is buffered in memory file and written out as a whole when the instance finishes:
+ * in completion order, or in input order with '-k'. With '-k' finished instances keep their buffers until
+ * all earlier ones are written, so new instances are not started while too many buffers are held.
+ * Runner is executed in a forked copy of the shell, so all its children are command instances. */
+class parallel_runner
+{
+public:
+  /* Pipeline stage launch function: (command, stdin fd or -1, stdout fd or -1, pid reference) */
+  using launcher = std::function<ERR_CODE(command &, int, int, pid_t &)>;
+
+private:
+  /* Command instance state */
+  struct instance
+  {
+    pid_t pid = -1;
+    int out_fd = -1; // buffered standard output
+    int err_fd = -1; // buffered standard error
+    bool finished = false;
+  };
+
+  std::vector<std::string> cmd_template;
+  std::vector<std::string> arg_items;
+  bool items_from_stdin = true;
+  bool keep_order = false;
+  long max_jobs = 1;
+  size_t max_buffered = PARALLEL_MAX_BUFFERED; // every buffered instance holds two descriptors
+
+  launcher launch;
+  std::vector<instance> instances; // all started instances in input order
+  size_t next_to_print = 0;        // first instance which output is not written yet (for input order)
+  size_t running = 0;
+  int failed = 0;
+
+  std::string input_buffer;        // not yet split standard input data
+  bool input_eof = false;
+
+public:
+  /* Class constructor.
+   *
+   * @param args        - builtin arguments without 'parallel' word
+   * @param launch_func - function starting one command instance
+   * @param error_code  - reference to the variable where argument parsing errors are to be written or 'SUCCESS' */
+  parallel_runner(const std::vector<std::string> &args, launcher launch_func, ERR_CODE &error_code) :
+    launch(std::move(launch_func))
+  {
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    max_jobs = (cpu_num > 0) ? cpu_num : 1;
+
+    struct rlimit fd_limit{};
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY)
+    {
+      size_t free_fds = (fd_limit.rlim_cur > 2 * PARALLEL_RESERVED_FDS) ? fd_limit.rlim_cur - PARALLEL_RESERVED_FDS
+                                                                         : PARALLEL_RESERVED_FDS;
+      max_buffered = std::min<size_t>(max_buffered, free_fds / 2);
+    }
+    error_code = parse_args(args);
+  }
+
+  /* Default class destructor */
+  ~parallel_runner()
+  =default;
+
+  /* Runs all instances. Returns number of failed instances (at most 101) as exit status */
+  int run()
+  {
+    int saved_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    std::string item;
+
+    while (true)
+    {
+      while (running < (size_t)max_jobs && get_buffered() < max_buffered && next_item(item))
+      {
+        start_instance(item, saved_stderr);
+      }
+
+      if (running == 0)
+      {
+        break;
+      }
+
+      collect_instance();
+    }
+
+    close(saved_stderr);
+    return (failed > PARALLEL_MAX_FAILED) ? PARALLEL_MAX_FAILED : failed;
+  }
+
+private:
+  /* Parses options, command template and ':::' items */
+  ERR_CODE parse_args(const std::vector<std::string> &args)
+  {
+    size_t i = 0;
+
+    for (; i < args.size() && args[i][0] == '-'; i++)
+    {
+      if (args[i] == "-k")
+      {
+        keep_order = true;
+      }
+      else if (args[i].compare(0, 2, "-j") == 0)
+      {
+        std::string number = (args[i].size() > 2) ? args[i].substr(2) : (i + 1 < args.size() ? args[++i] : "");
+        char *number_end = nullptr;
+        max_jobs = strtol(number.c_str(), &number_end, 10);
+
+        if (number.empty() || *number_end != '\0' || max_jobs <= 0)
+        {
+          std::cerr << "parallel: wrong number of jobs '" << number << "'" << std::endl;
+          ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 2);
+        }
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    for (; i < args.size() && args[i] != ":::"; i++)
+    {
+      cmd_template.push_back(args[i]);
+    }
+
+    if (i < args.size())
+    {
+      items_from_stdin = false;
+      arg_items.assign(args.begin() + i + 1, args.end());
+    }
+
+    if (cmd_template.empty())
+    {
+      std::cerr << "Usage : parallel [-j N] [-k] command args... [::: items...]" << std::endl;
+      ADD_LOG_WITH_RETURN(ERR_WRONG_INPUT, 2);
+    }
+
+    return SUCCESS;
+  }
+
+  /* Gets next item from ':::' list or standard input. Returns false if there are no more items */
+  bool next_item(std::string &item)
+  {
+    if (!items_from_stdin)
+    {
+      if (instances.size() >= arg_items.size())
+      {
+        return false;
+      }
+      item = arg_items[instances.size()];
+      return true;
+    }
+
+    while (true)
+    {
+      size_t line_end = input_buffer.find('\n');
+      if (line_end != std::string::npos || (input_eof && !input_buffer.empty()))
+      {
+        item.assign(input_buffer, 0, line_end);
+        input_buffer.erase(0, (line_end == std::string::npos) ? line_end : line_end + 1);
+        return true;
+      }
+
+      if (input_eof)
+      {
+        return false;
+      }
+
+      char chunk[1 << 16];
+      ssize_t read_size = read(STDIN_FILENO, chunk, sizeof(chunk));
+      if (read_size < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (read_size <= 0)
+      {
+        input_eof = true;
+        continue;
+      }
+      input_buffer.append(chunk, read_size);
+    }
+  }
+
+  /* Builds command instance for item and starts it with standard output and error redirected to memory files */
+  void start_instance(const std::string &item, int saved_stderr)
+  {
+    std::vector<std::string> args = cmd_template;
+    bool is_substituted = false;
+
+    for (auto &arg : args)
+    {
+      for (size_t pos = arg.find("{}"); pos != std::string::npos; pos = arg.find("{}", pos + item.size()))
+      {
+        arg.replace(pos, 2, item);
+        is_substituted = true;
+      }
+    }
+    if (!is_substituted)
+    {
+      args.push_back(item);
+    }
+
+    instance inst;
+    inst.out_fd = memfd_create("parallel_out", MFD_CLOEXEC);
+    inst.err_fd = memfd_create("parallel_err", MFD_CLOEXEC);
+
+    // without buffers output of the instance would interleave with others, so the item fails
+    if (inst.out_fd == -1 || inst.err_fd == -1)
+    {
+      ADD_LOG(ERR_FILE_OPEN, 6);
+      perror("parallel: could not create output buffer");
+      close_buffers(inst);
+      inst.finished = true;
+      failed++;
+      instances.push_back(inst);
+      flush_output(instances.size() - 1);
+      return;
+    }
+
+    // instance inherits standard error of the runner, so it is switched to the memory file for the launch time
+    command cmd(args);
+    dup2(inst.err_fd, STDERR_FILENO);
+    int stdin_fd = items_from_stdin ? open("/dev/null", O_RDONLY | O_CLOEXEC) : -1;
+    ERR_CODE err_code = launch(cmd, stdin_fd, inst.out_fd, inst.pid);
+    dup2(saved_stderr, STDERR_FILENO);
+
+    if (stdin_fd != -1)
+    {
+      close(stdin_fd);
+    }
+
+    if (err_code != SUCCESS)
+    {
+      inst.finished = true;
+      failed++;
+    }
+    else
+    {
+      running++;
+    }
+
+    instances.push_back(inst);
+    if (inst.finished)
+    {
+      flush_output(instances.size() - 1);
+    }
+  }
+
+  /* Returns number of instances holding output buffers: running ones, and with '-k' also finished ones
+   * waiting for earlier instances */
+  size_t get_buffered() const
+  {
+    return keep_order ? instances.size() - next_to_print : running;
+  }
+
+  /* Waits for any instance to finish and writes out buffered output */
+  void collect_instance()
+  {
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+
+    if (pid == -1)
+    {
+      if (errno == ECHILD)
+      {
+        running = 0;
+      }
+      return;
+    }
+
+    for (size_t i = instances.size(); i-- > 0;)
+    {
+      if (instances[i].pid == pid && !instances[i].finished)
+      {
+        instances[i].finished = true;
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+          failed++;
+        }
+        flush_output(i);
+        return;
+      }
+    }
+  }
+
+  /* Writes out output of finished instances: this one, or all ready ones in input order with '-k' */
+  void flush_output(size_t index)
+  {
+    if (!keep_order)
+    {
+      write_instance(instances[index]);
+      return;
+    }
+
+    while (next_to_print < instances.size() && instances[next_to_print].finished)
+    {
+      write_instance(instances[next_to_print++]);
+    }
+  }
+
+  /* Copies buffered output of instance to standard output and error, frees the buffers */
+  static void write_instance(instance &inst)
+  {
+    copy_buffer(inst.out_fd, STDOUT_FILENO);
+    copy_buffer(inst.err_fd, STDERR_FILENO);
+    inst.out_fd = inst.err_fd = -1;
+  }
+
+  /* Closes output buffers of instance */
+  static void close_buffers(instance &inst)
+  {
+    if (inst.out_fd != -1) { close(inst.out_fd); }
+    if (inst.err_fd != -1) { close(inst.err_fd); }
+    inst.out_fd = inst.err_fd = -1;
+  }
+
+  /* Writes whole memory file to descriptor and closes it */
+  static void copy_buffer(int buffer_fd, int dst_fd)
+  {
+    if (buffer_fd == -1)
+    {
+      return;
+    }
+
+    char chunk[1 << 16];
+    off_t offset = 0;
+    ssize_t read_size;
+    while ((read_size = pread(buffer_fd, chunk, sizeof(chunk), offset)) > 0)
+    {
+      offset += read_size;
+      for (ssize_t written = 0, res; written < read_size; written += res)
+      {
+        res = write(dst_fd, chunk + written, read_size - written);
+        if (res <= 0)
+        {
+          close(buffer_fd);
+          return;
+        }
+      }
+    }
+
+    close(buffer_fd);
+  }
+};
+
+#endif //MICROSHA_PARALLEL_RUNNER_H
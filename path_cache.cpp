@@ -0,0 +1 @@
+#include "path_cache.h"
\ No newline at end of file
@@ -0,0 +1,349 @@
+#ifndef MICROSHA_PATH_CACHE_H
+#define MICROSHA_PATH_CACHE_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <string>
+#include <memory_resource>
+#include <vector>
+#include <unordered_map>
+#include <string_view>
+#include <memory>
+#include <iomanip>
+#include <algorithm>
+
+#include "string_funcitons.h"
+#include "dir_cache.h"
+#include "path_trie.h"
+
+/* Persistent command location cache ('hash' table).
+ * Resolves command names to absolute executable pathnames once, so that 'execve' can be called directly
+ * instead of trying every '$PATH' directory on each command start.
+ * Cached locations are dropped when
+ * - '$PATH' value changes;
+ * - cached file stops existing or being executable;
+ * - modification time of the location directory or of any '$PATH' directory preceding it changes.
+ * For command name completion all executables of absolute '$PATH' directories are listed once into a prefix tree.
+ * Directories whose modification time changed are listed again before the next completion. Once the tree is built,
+ * lookup of a new command checks the directory the tree names first instead of trying every '$PATH' directory.
+ * 'chmod' does not change directory modification time, so names of not executable files are listed too: if a directory
+ * before the named one holds the name, every directory is tried. */
+class path_cache
+{
+private:
+  /* '$PATH' directory description */
+  struct path_dir
+  {
+    std::string name;
+    timespec mtime{};
+    timespec listed_mtime{};              // modification time when executables were listed into the tree
+    bool is_listed = false;
+    std::vector<std::string> executables; // names added to the tree
+    std::vector<std::string> others;      // sorted names of files which were not executable when listed
+  };
+
+  /* Resolved command location */
+  struct cache_entry
+  {
+    std::string path;
+    size_t dir_index = 0; // index of the '$PATH' directory containing command
+    unsigned hits = 0;
+  };
+
+  std::string path_env;
+  std::vector<path_dir> path_dirs;
+  std::unordered_map<std::string, cache_entry> entries;
+  path_trie executables;        // executables of all listed '$PATH' directories
+  bool is_trie_built = false;   // completion was asked since '$PATH' was set
+
+public:
+  /* Default class constructor */
+  path_cache()
+  =default;
+
+  /* Default class destructor */
+  ~path_cache()
+  =default;
+
+  /* Returns shell-wide cache instance */
+  static path_cache &instance()
+  {
+    static path_cache cache;
+    return cache;
+  }
+
+  /* Resolves command name to the pathname to be given to 'execve'.
+   * Names containing '/' are returned as is.
+   *
+   * @param cmd_name  - command name
+   * @param full_path - reference to the string where pathname is to be written
+   *
+   * @return 'SUCCESS' if command is found, 'ERR_FILE_DIR_EXIST' otherwise */
+  ERR_CODE resolve(const char *cmd_name, std::pmr::string &full_path)
+  {
+    if (strchr(cmd_name, '/') != nullptr)
+    {
+      full_path = cmd_name;
+      return SUCCESS;
+    }
+
+    sync_path_env();
+
+    auto entry = entries.find(cmd_name);
+    if (entry != entries.end())
+    {
+      if (is_entry_valid(entry->second))
+      {
+        entry->second.hits++;
+        full_path.assign(entry->second.path.data(), entry->second.path.size());
+        return SUCCESS;
+      }
+      entries.erase(cmd_name);
+    }
+
+    // the tree names the directory at once. It does not know relative directories and files made executable
+    // by 'chmod' after listing, so every directory is tried if an earlier one may hold the name
+    if (is_trie_built)
+    {
+      sync_trie();
+      int dir_index = executables.find(cmd_name);
+      std::string candidate = (dir_index == -1) ? "" : path_dirs[dir_index].name + "/" + cmd_name;
+      bool may_be_before = std::any_of(path_dirs.begin(), path_dirs.begin() + std::max(dir_index, 0),
+                                       [cmd_name](const path_dir &dir)
+                                       {
+                                         return dir.name[0] != '/' ||
+                                                std::binary_search(dir.others.begin(), dir.others.end(), cmd_name);
+                                       });
+      if (dir_index != -1 && !may_be_before && is_executable(candidate))
+      {
+        entries[cmd_name] = {candidate, (size_t)dir_index, 1};
+        full_path.assign(candidate.data(), candidate.size());
+        return SUCCESS;
+      }
+    }
+
+    for (size_t i = 0; i < path_dirs.size(); i++)
+    {
+      std::string candidate = path_dirs[i].name + "/" + cmd_name;
+
+      if (!is_executable(candidate))
+      {
+        continue;
+      }
+
+      // commands from relative '$PATH' directories depend on the current directory and are never cached
+      if (path_dirs[i].name[0] == '/')
+      {
+        entries[cmd_name] = {candidate, i, 1};
+      }
+      full_path.assign(candidate.data(), candidate.size());
+      return SUCCESS;
+    }
+
+    return ERR_FILE_DIR_EXIST;
+  }
+
+  /* Appends sorted names of '$PATH' executables starting with prefix, up to 'limit' of them.
+   * Only directories changed since the previous call are listed again */
+  void complete(std::string_view prefix, std::vector<std::string> &names, size_t limit)
+  {
+    sync_path_env();
+    sync_trie();
+    is_trie_built = true;
+    executables.complete(prefix, names, limit);
+  }
+
+  /* Forgets all remembered locations ('hash -r') */
+  void clear()
+  {
+    entries.clear();
+  }
+
+  /* Prints remembered locations in 'hash' builtin format */
+  void print(std::ostream &os) const
+  {
+    if (entries.empty())
+    {
+      os << "hash: hash table empty" << std::endl;
+      return;
+    }
+
+    os << "hits\tcommand" << std::endl;
+    for (const auto &entry : entries)
+    {
+      os << std::setw(4) << entry.second.hits << "\t" << entry.second.path << std::endl;
+    }
+  }
+
+private:
+  /* Rebuilds directory list if '$PATH' was changed since the last lookup */
+  void sync_path_env()
+  {
+    const char *path_env_C = getenv("PATH");
+    if (path_env_C == nullptr)
+    {
+      path_env_C = "/usr/local/bin:/bin:/usr/bin";
+    }
+
+    // compared without copying: it is done for every command start
+    if (path_env == path_env_C && !path_dirs.empty())
+    {
+      return;
+    }
+
+    path_env = path_env_C;
+    path_dirs.clear();
+    entries.clear();
+    executables.clear();
+    is_trie_built = false;
+
+    // empty '$PATH' entries stand for the current directory
+    for (size_t prev = 0, next = 0; prev <= path_env.size(); prev = next + 1)
+    {
+      next = path_env.find(':', prev);
+      if (next == std::string::npos)
+      {
+        next = path_env.size();
+      }
+
+      path_dir dir;
+      dir.name = (next == prev) ? "." : path_env.substr(prev, next - prev);
+      get_mtime(dir.name, dir.mtime);
+      path_dirs.push_back(dir);
+    }
+  }
+
+  /* Lists again into the tree absolute '$PATH' directories that changed since they were listed */
+  void sync_trie()
+  {
+    for (size_t i = 0; i < path_dirs.size() && i <= UINT16_MAX; i++)
+    {
+      path_dir &dir = path_dirs[i];
+      if (dir.name[0] != '/')
+      {
+        continue;
+      }
+
+      timespec mtime{};
+      get_mtime(dir.name, mtime);
+      if (dir.is_listed && mtime.tv_sec == dir.listed_mtime.tv_sec && mtime.tv_nsec == dir.listed_mtime.tv_nsec)
+      {
+        continue;
+      }
+
+      for (const auto &name : dir.executables)
+      {
+        executables.remove(name, (uint16_t)i);
+      }
+      dir.executables.clear();
+      dir.others.clear();
+      list_executables(dir.name, dir.executables, dir.others);
+      for (const auto &name : dir.executables)
+      {
+        executables.add(name, (uint16_t)i);
+      }
+
+      dir.listed_mtime = mtime;
+      dir.is_listed = true;
+    }
+  }
+
+  /* Writes names of executable regular files of directory (symbolic links are followed) and sorted names
+   * of other files and links, which 'chmod' may make executable later */
+  static void list_executables(const std::string &dir_name, std::vector<std::string> &names,
+                               std::vector<std::string> &others)
+  {
+    int dir_fd = open(dir_name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1)
+    {
+      return;
+    }
+
+    std::shared_ptr<const dir_listing> listing = dir_cache::read_listing(dir_fd);
+    for (const dir_entry &entry : listing->entries)
+    {
+      if (entry.type != DT_REG && entry.type != DT_LNK)
+      {
+        continue;
+      }
+
+      struct stat st{};
+      if (fstatat(dir_fd, entry.name.c_str(), &st, 0) == 0 && S_ISREG(st.st_mode) &&
+          faccessat(dir_fd, entry.name.c_str(), X_OK, 0) == 0)
+      {
+        names.push_back(entry.name);
+      }
+      else
+      {
+        others.push_back(entry.name);
+      }
+    }
+    close(dir_fd);
+  }
+
+  /* Checks that remembered location is still the one 'execvp' would find */
+  bool is_entry_valid(const cache_entry &entry)
+  {
+    for (size_t i = 0; i <= entry.dir_index; i++)
+    {
+      timespec mtime{};
+      get_mtime(path_dirs[i].name, mtime);
+
+      if (mtime.tv_sec != path_dirs[i].mtime.tv_sec || mtime.tv_nsec != path_dirs[i].mtime.tv_nsec)
+      {
+        // directory content changed: every command found in it or behind it may be shadowed now
+        path_dirs[i].mtime = mtime;
+        drop_entries_from(i);
+        return false;
+      }
+    }
+
+    return is_executable(entry.path);
+  }
+
+  /* Forgets locations found in '$PATH' directory with given index or in later ones */
+  void drop_entries_from(size_t dir_index)
+  {
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+      if (it->second.dir_index >= dir_index)
+      {
+        it = entries.erase(it);
+      }
+      else
+      {
+        it++;
+      }
+    }
+  }
+
+  /* Writes modification time of directory or zero time if it does not exist */
+  static void get_mtime(const std::string &dir_name, timespec &mtime)
+  {
+    struct stat st{};
+
+    if (stat(dir_name.c_str(), &st) == 0)
+    {
+      mtime = st.st_mtim;
+    }
+    else
+    {
+      mtime = {0, 0};
+    }
+  }
+
+  /* Checks if file is regular and executable */
+  static bool is_executable(const std::string &file_name)
+  {
+    struct stat st{};
+
+    return stat(file_name.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(file_name.c_str(), X_OK) == 0;
+  }
+};
+
+#endif //MICROSHA_PATH_CACHE_H
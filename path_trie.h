@@ -0,0 +1,149 @@
+#ifndef MICROSHA_PATH_TRIE_H
+#define MICROSHA_PATH_TRIE_H
+
+#include <cstdint>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/* Prefix tree of executable names. Every name keeps ascending indexes of '$PATH' directories containing it,
+ * so the first one is the directory 'execvp' would take. Children are sorted by byte, completions come out sorted.
+ * Nodes of removed names stay until 'clear': a directory rescan usually adds the same names back */
+class path_trie
+{
+private:
+  /* Trie node */
+  struct trie_node
+  {
+    std::vector<std::pair<char, uint32_t>> children; // sorted by byte
+    std::vector<uint16_t> dirs;                       // directories containing the name ending here
+  };
+
+  std::vector<trie_node> nodes{1}; // the first node is the root
+
+public:
+  /* Default class constructor */
+  path_trie()
+  =default;
+
+  /* Default class destructor */
+  ~path_trie()
+  =default;
+
+  /* Adds name found in directory with given index */
+  void add(std::string_view name, uint16_t dir)
+  {
+    uint32_t node = 0;
+    for (char c : name)
+    {
+      auto &children = nodes[node].children;
+      auto child = std::lower_bound(children.begin(), children.end(), c,
+                                    [](const std::pair<char, uint32_t> &a, char b) { return a.first < b; });
+      if (child != children.end() && child->first == c)
+      {
+        node = child->second;
+        continue;
+      }
+
+      auto new_node = (uint32_t)nodes.size();
+      children.insert(child, {c, new_node});
+      nodes.emplace_back(); // 'children' reference is not used after this
+      node = new_node;
+    }
+
+    auto &dirs = nodes[node].dirs;
+    auto position = std::lower_bound(dirs.begin(), dirs.end(), dir);
+    if (position == dirs.end() || *position != dir)
+    {
+      dirs.insert(position, dir);
+    }
+  }
+
+  /* Removes name of directory with given index */
+  void remove(std::string_view name, uint16_t dir)
+  {
+    int node = find_node(name);
+    if (node == -1)
+    {
+      return;
+    }
+
+    auto &dirs = nodes[node].dirs;
+    auto position = std::lower_bound(dirs.begin(), dirs.end(), dir);
+    if (position != dirs.end() && *position == dir)
+    {
+      dirs.erase(position);
+    }
+  }
+
+  /* Returns index of the first directory containing name or -1 */
+  int find(std::string_view name) const
+  {
+    int node = find_node(name);
+    return (node == -1 || nodes[node].dirs.empty()) ? -1 : nodes[node].dirs.front();
+  }
+
+  /* Appends sorted names starting with prefix, up to 'limit' of them */
+  void complete(std::string_view prefix, std::vector<std::string> &names, size_t limit) const
+  {
+    int node = find_node(prefix);
+    if (node == -1)
+    {
+      return;
+    }
+
+    std::string name(prefix);
+    collect((uint32_t)node, name, names, limit);
+  }
+
+  /* Removes all names */
+  void clear()
+  {
+    nodes.clear();
+    nodes.emplace_back();
+  }
+
+private:
+  /* Returns node of name or -1 */
+  int find_node(std::string_view name) const
+  {
+    uint32_t node = 0;
+    for (char c : name)
+    {
+      const auto &children = nodes[node].children;
+      auto child = std::lower_bound(children.begin(), children.end(), c,
+                                    [](const std::pair<char, uint32_t> &a, char b) { return a.first < b; });
+      if (child == children.end() || child->first != c)
+      {
+        return -1;
+      }
+      node = child->second;
+    }
+    return (int)node;
+  }
+
+  /* Appends names of subtree in byte order. 'name' is the name of 'node' */
+  void collect(uint32_t node, std::string &name, std::vector<std::string> &names, size_t limit) const
+  {
+    if (names.size() >= limit)
+    {
+      return;
+    }
+    if (!nodes[node].dirs.empty())
+    {
+      names.push_back(name);
+    }
+
+    for (const auto &[c, child] : nodes[node].children)
+    {
+      name.push_back(c);
+      collect(child, name, names, limit);
+      name.pop_back();
+    }
+  }
+};
+
+#endif //MICROSHA_PATH_TRIE_H
@@ -0,0 +1,206 @@
+#ifndef MICROSHA_PERF_COUNTERS_H
+#define MICROSHA_PERF_COUNTERS_H
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/perf_event.h>
+#include <cerrno>
+#include <cstdint>
+
+/* Counted events */
+enum perf_event_id
+{
+  PERF_CYCLES,           // hardware: CPU cycles
+  PERF_INSTRUCTIONS,     // hardware: retired instructions
+  PERF_CACHE_MISSES,     // hardware: last level cache misses
+  PERF_BRANCH_MISSES,    // hardware: mispredicted branches
+  PERF_PAGE_FAULTS,      // software: page faults
+  PERF_TASK_CLOCK,       // software: nanoseconds on CPU
+  PERF_CONTEXT_SWITCHES, // software: context switches
+  PERF_EVENT_NUM
+};
+
+/* Counter values. Events which could not be opened have 'is_counted' false */
+struct perf_values
+{
+  uint64_t values[PERF_EVENT_NUM] = {};
+  bool is_counted[PERF_EVENT_NUM] = {};
+  bool is_scaled = false;    // some event was multiplexed, its value is an estimate
+  bool is_user_only = false; // kernel is excluded for some event (perf_event_paranoid)
+
+  /* Checks if any event was counted */
+  bool has_any() const
+  {
+    for (bool counted : is_counted)
+    {
+      if (counted)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+/* Set of perf_event counters of one thread or process with all its future threads and children.
+ * Hardware events are absent in most virtual machines: then only software events are counted.
+ * If 'perf_event_paranoid' forbids kernel profiling, events count user space only.
+ * Multiplexed events are scaled by their enabled/running time ratio */
+class perf_counters
+{
+private:
+  int fds[PERF_EVENT_NUM];
+  bool user_only[PERF_EVENT_NUM] = {};
+
+public:
+  /* Class constructor. Nothing is counted until 'open' */
+  perf_counters()
+  {
+    for (int &fd : fds)
+    {
+      fd = -1;
+    }
+  }
+
+  /* Class destructor */
+  ~perf_counters()
+  {
+    close_all();
+  }
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  /* Move constructor */
+  perf_counters(perf_counters &&other) noexcept
+  {
+    for (int i = 0; i < PERF_EVENT_NUM; i++)
+    {
+      fds[i] = other.fds[i];
+      user_only[i] = other.user_only[i];
+      other.fds[i] = -1;
+    }
+  }
+
+  /* Move assignment */
+  perf_counters &operator=(perf_counters &&other) noexcept
+  {
+    if (this != &other)
+    {
+      close_all();
+      for (int i = 0; i < PERF_EVENT_NUM; i++)
+      {
+        fds[i] = other.fds[i];
+        user_only[i] = other.user_only[i];
+        other.fds[i] = -1;
+      }
+    }
+    return *this;
+  }
+
+  /* Starts counting events of process or thread 'pid' (0 - the calling thread).
+   * Threads and children created by it later are counted too. Returns false if no event could be opened */
+  bool open(pid_t pid)
+  {
+    close_all();
+
+    bool is_opened = false;
+    for (int i = 0; i < PERF_EVENT_NUM; i++)
+    {
+      fds[i] = open_event((perf_event_id)i, pid, false);
+      if (fds[i] == -1 && (errno == EACCES || errno == EPERM))
+      {
+        fds[i] = open_event((perf_event_id)i, pid, true);
+        user_only[i] = (fds[i] != -1);
+      }
+      is_opened = is_opened || (fds[i] != -1);
+    }
+
+    return is_opened;
+  }
+
+  /* Reads counted values. Counts of children are added when children are reaped */
+  perf_values read_values() const
+  {
+    perf_values result;
+
+    for (int i = 0; i < PERF_EVENT_NUM; i++)
+    {
+      uint64_t data[3] = {}; // value, time enabled, time running
+      if (fds[i] == -1 || read(fds[i], data, sizeof(data)) != sizeof(data))
+      {
+        continue;
+      }
+
+      result.is_counted[i] = true;
+      result.values[i] = data[0];
+      if (data[2] > 0 && data[2] < data[1])
+      {
+        result.values[i] = (uint64_t)((long double)data[0] * data[1] / data[2]);
+        result.is_scaled = true;
+      }
+      result.is_user_only = result.is_user_only || user_only[i];
+    }
+
+    return result;
+  }
+
+  /* Returns event name */
+  static const char *get_event_name(perf_event_id id)
+  {
+    switch (id)
+    {
+      case PERF_CYCLES:           return "cycles";
+      case PERF_INSTRUCTIONS:     return "instructions";
+      case PERF_CACHE_MISSES:     return "cache-misses";
+      case PERF_BRANCH_MISSES:    return "branch-misses";
+      case PERF_PAGE_FAULTS:      return "page-faults";
+      case PERF_TASK_CLOCK:       return "task-clock";
+      case PERF_CONTEXT_SWITCHES: return "context-switches";
+      default:                    return "unknown";
+    }
+  }
+
+private:
+  /* Opens one counting event. Returns descriptor or -1 */
+  static int open_event(perf_event_id id, pid_t pid, bool exclude_kernel)
+  {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;
+    attr.exclude_kernel = exclude_kernel ? 1 : 0;
+    attr.exclude_hv = exclude_kernel ? 1 : 0;
+
+    switch (id)
+    {
+      case PERF_CYCLES:           attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES;       break;
+      case PERF_INSTRUCTIONS:     attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS;     break;
+      case PERF_CACHE_MISSES:     attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES;     break;
+      case PERF_BRANCH_MISSES:    attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES;    break;
+      case PERF_PAGE_FAULTS:      attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS;      break;
+      case PERF_TASK_CLOCK:       attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_TASK_CLOCK;       break;
+      case PERF_CONTEXT_SWITCHES: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+      default:                    return -1;
+    }
+
+    return (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+
+  /* Closes all event descriptors */
+  void close_all()
+  {
+    for (int i = 0; i < PERF_EVENT_NUM; i++)
+    {
+      if (fds[i] != -1)
+      {
+        close(fds[i]);
+        fds[i] = -1;
+      }
+      user_only[i] = false;
+    }
+  }
+};
+
+#endif //MICROSHA_PERF_COUNTERS_H
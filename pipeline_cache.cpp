@@ -0,0 +1 @@
+#include "pipeline_cache.h"
@@ -0,0 +1,132 @@
+#ifndef MICROSHA_PIPELINE_CACHE_H
+#define MICROSHA_PIPELINE_CACHE_H
+
+#include <cstdlib>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory_resource>
+#include <iostream>
+
+#include "command_lexer.h"
+
+#define PIPELINE_CACHE_DEFAULT_SIZE 256
+
+/* Command line split into tokens and checked against the pipeline pattern */
+struct parsed_pipeline
+{
+  std::string line;                 // command line, tokens refer to it
+  std::pmr::vector<token> tokens;   // line tokens without trailing '&'
+  std::vector<size_t> command_ends; // index of token ending every pipeline command ('|' or end of tokens)
+  std::string_view pipeline_line;   // part of the line from the first to the last token
+  bool is_background = false;       // line ends with '&'
+};
+
+/* Shell-wide cache of parsed command lines. Scripts and loops repeat the same lines,
+ * and the cached structure lets them skip tokenizing and pattern checking.
+ * Entries hold only what depends on the line text: words with unquoted pattern meta-symbols or '$?'
+ * are marked in their tokens ('has_glob', 'has_dollar') and expanded again each time the line runs,
+ * so entries stay valid whatever the current directory and file system are.
+ * Lines with syntax errors are not cached. Least recently used entries are evicted when their number
+ * exceeds the size set by 'MICROSHA_PARSE_CACHE' environment variable (default 256, 0 disables the cache). */
+class pipeline_cache
+{
+private:
+  size_t capacity = 0;
+  std::list<parsed_pipeline> lru; // the most recently used entry is the first
+  std::unordered_map<std::string_view, std::list<parsed_pipeline>::iterator> index;
+  parsed_pipeline uncached;       // parse result of the last line when the cache is disabled
+  size_t hits = 0, misses = 0;
+
+public:
+  /* Class constructor. Reads cache size */
+  pipeline_cache()
+  {
+    const char *size = getenv("MICROSHA_PARSE_CACHE");
+    capacity = (size == nullptr) ? PIPELINE_CACHE_DEFAULT_SIZE : strtoul(size, nullptr, 10);
+  }
+
+  /* Default class destructor */
+  ~pipeline_cache()
+  =default;
+
+  pipeline_cache(const pipeline_cache &) = delete;
+  pipeline_cache &operator=(const pipeline_cache &) = delete;
+
+  /* Returns shell-wide cache instance */
+  static pipeline_cache &instance()
+  {
+    static pipeline_cache cache;
+    return cache;
+  }
+
+  /* Returns parsed line or nullptr if it is not cached */
+  const parsed_pipeline *find(std::string_view line)
+  {
+    auto entry = index.find(line);
+    if (entry == index.end())
+    {
+      misses++;
+      return nullptr;
+    }
+
+    hits++;
+    lru.splice(lru.begin(), lru, entry->second);
+    return &*entry->second;
+  }
+
+  /* Returns entry for the line to be parsed into. It is cached until 'forget' is called for it.
+   * Entry is not moved while it is in the cache, so tokens may refer to its 'line' */
+  parsed_pipeline &add(std::string_view line)
+  {
+    if (capacity == 0)
+    {
+      uncached.line.assign(line.data(), line.size());
+      return uncached;
+    }
+
+    while (lru.size() >= capacity)
+    {
+      index.erase(lru.back().line);
+      lru.pop_back();
+    }
+
+    lru.emplace_front();
+    lru.front().line.assign(line.data(), line.size());
+    index[lru.front().line] = lru.begin();
+    return lru.front();
+  }
+
+  /* Removes entry that was not parsed successfully */
+  void forget(parsed_pipeline &entry)
+  {
+    auto position = index.find(entry.line);
+    if (&entry == &uncached || position == index.end())
+    {
+      return;
+    }
+
+    lru.erase(position->second);
+    index.erase(position);
+  }
+
+  /* Removes all entries and resets counters ('parsecache -r') */
+  void clear()
+  {
+    index.clear();
+    lru.clear();
+    hits = misses = 0;
+  }
+
+  /* Prints cache counters */
+  void print(std::ostream &os) const
+  {
+    os << "hits\tmisses\tentries" << std::endl;
+    os << hits << "\t" << misses << "\t" << lru.size() << std::endl;
+  }
+};
+
+#endif //MICROSHA_PIPELINE_CACHE_H
@@ -0,0 +1 @@
+#include "prompt.h"
@@ -0,0 +1,388 @@
+#ifndef MICROSHA_PROMPT_H
+#define MICROSHA_PROMPT_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ostream>
+#include <system_error>
+
+#include "text_colors.h"
+
+#define PROMPT_DEFAULT_DEADLINE_MS 10
+#define PROMPT_HEAD_SIZE 256 // enough for "ref: refs/heads/<branch>"
+
+/* Prompt segments */
+enum prompt_segment
+{
+  SEGMENT_CWD,      // current directory
+  SEGMENT_BRANCH,   // version control branch of the current directory
+  SEGMENT_STATUS,   // exit status of the last line, shown if it is not zero
+  SEGMENT_DURATION, // execution time of the last line
+  SEGMENT_JOBS      // number of background and stopped jobs, shown if there are any
+};
+
+/* Shell prompt: chosen segments separated by spaces, then "> " ("!" for root group).
+ * Segments are set by 'MICROSHA_PROMPT' environment variable - comma separated names "cwd", "branch", "status",
+ * "duration", "jobs" (default "cwd"). Cheap segments cost no system calls: current directory is asked again only
+ * after 'cd' changed it. Branch is read from ".git/HEAD" on a background thread: the prompt waits for it
+ * not longer than 'MICROSHA_PROMPT_DEADLINE_MS' milliseconds (default 10) and shows the last known branch
+ * of the directory otherwise, so a slow or hung filesystem never delays the prompt */
+class prompt
+{
+private:
+  /* Branch lookup shared with the background thread. Thread is detached: it may be stuck in a filesystem
+   * call when the shell exits, so it owns the state together with the prompt */
+  struct branch_lookup
+  {
+    std::mutex mutex;
+    std::condition_variable request_ready, result_ready;
+    std::string request_dir;    // directory to look up, the latest request replaces older ones
+    uint64_t request_seq = 0;
+    std::string result_dir, result_branch;
+    uint64_t result_seq = 0;    // number of the request answered last
+    bool is_running = false;    // thread is started
+    bool is_stopped = false;    // prompt is destroyed, thread must finish
+  };
+
+  std::vector<prompt_segment> segments;
+  std::chrono::milliseconds deadline{PROMPT_DEFAULT_DEADLINE_MS};
+  bool is_root_group = false;
+  std::string cwd;
+  unsigned cwd_version = 0;     // 'cd' count the cached directory belongs to
+  bool is_cwd_valid = false;
+  std::string branch_dir, branch; // the last branch which was got in time and its directory
+  std::shared_ptr<branch_lookup> lookup = std::make_shared<branch_lookup>();
+  std::string line;             // prompt text buffer, reused
+
+public:
+  /* Class constructor. Reads settings from the environment */
+  prompt()
+  {
+    is_root_group = (getgid() == 0);
+    segments = parse_segments(getenv("MICROSHA_PROMPT"));
+
+    const char *deadline_ms = getenv("MICROSHA_PROMPT_DEADLINE_MS");
+    if (deadline_ms != nullptr && *deadline_ms != '\0')
+    {
+      deadline = std::chrono::milliseconds(atol(deadline_ms));
+    }
+  }
+
+  /* Class destructor. Background thread finishes after its current lookup */
+  ~prompt()
+  {
+    std::lock_guard<std::mutex> lock(lookup->mutex);
+    lookup->is_stopped = true;
+    lookup->request_ready.notify_one();
+  }
+
+  prompt(const prompt &) = delete;
+  prompt &operator=(const prompt &) = delete;
+
+  /* Prints prompt with one write to the stream. Arguments are the ones of 'render' */
+  void print(std::ostream &os, unsigned cd_count, int last_status, double duration, size_t jobs_number)
+  {
+    os << render(cd_count, last_status, duration, jobs_number);
+  }
+
+  /* Returns prompt text. It is valid until the next call.
+   *
+   * @param cd_count    - number of directory changes in the shell: cached directory is read again when it grows
+   * @param last_status - exit status of the last line
+   * @param duration    - execution time of the last line in seconds
+   * @param jobs_number - number of jobs in the job table */
+  const std::string &render(unsigned cd_count, int last_status, double duration, size_t jobs_number)
+  {
+    line.clear();
+
+    for (prompt_segment segment : segments)
+    {
+      size_t segment_start = line.size();
+      switch (segment)
+      {
+        case SEGMENT_CWD:
+          line += BOLDCYAN;
+          line += get_cwd(cd_count);
+          line += RESET;
+          break;
+
+        case SEGMENT_BRANCH:
+        {
+          const std::string &current = get_branch(get_cwd(cd_count));
+          if (!current.empty())
+          {
+            line += MAGENTA "(" + current + ")" RESET;
+          }
+          break;
+        }
+
+        case SEGMENT_STATUS:
+          if (last_status != EXIT_SUCCESS)
+          {
+            line += RED "[" + std::to_string(last_status) + "]" RESET;
+          }
+          break;
+
+        case SEGMENT_DURATION:
+          line += YELLOW + format_duration(duration) + RESET;
+          break;
+
+        case SEGMENT_JOBS:
+          if (jobs_number > 0)
+          {
+            line += GREEN "&" + std::to_string(jobs_number) + RESET;
+          }
+          break;
+      }
+
+      // segments are separated by space, empty ones leave nothing
+      if (line.size() > segment_start && segment_start > 0)
+      {
+        line.insert(segment_start, 1, ' ');
+      }
+    }
+
+    line += BOLDCYAN;
+    line += is_root_group ? "!" : "> ";
+    line += RESET;
+    return line;
+  }
+
+  /* Returns current directory. It is asked from the kernel only after the directory was changed */
+  const std::string &get_cwd(unsigned cd_count)
+  {
+    if (!is_cwd_valid || cwd_version != cd_count)
+    {
+      char dir_name[PATH_MAX];
+      cwd = (getcwd(dir_name, sizeof(dir_name)) != nullptr) ? dir_name : "";
+      cwd_version = cd_count;
+      is_cwd_valid = true;
+    }
+    return cwd;
+  }
+
+  /* Parses comma separated segment names. Unknown names are skipped, empty list gives the current directory */
+  static std::vector<prompt_segment> parse_segments(const char *names)
+  {
+    std::vector<prompt_segment> result;
+
+    for (const char *name = names; name != nullptr && *name != '\0';)
+    {
+      const char *name_end = strchr(name, ',');
+      size_t length = (name_end == nullptr) ? strlen(name) : (size_t)(name_end - name);
+      std::string segment(name, length);
+
+      if      (segment == "cwd")      { result.push_back(SEGMENT_CWD);      }
+      else if (segment == "branch")   { result.push_back(SEGMENT_BRANCH);   }
+      else if (segment == "status")   { result.push_back(SEGMENT_STATUS);   }
+      else if (segment == "duration") { result.push_back(SEGMENT_DURATION); }
+      else if (segment == "jobs")     { result.push_back(SEGMENT_JOBS);     }
+
+      name = (name_end == nullptr) ? nullptr : name_end + 1;
+    }
+
+    if (result.empty())
+    {
+      result.push_back(SEGMENT_CWD);
+    }
+    return result;
+  }
+
+  /* Returns branch of repository containing 'dir': name of the checked out branch or short hash of detached HEAD.
+   * Empty if 'dir' is not in a git repository. Worktrees and submodules with ".git" file are followed */
+  static std::string find_branch(const std::string &dir)
+  {
+    std::string path = dir;
+
+    while (!path.empty())
+    {
+      std::string head;
+      if (read_head(path + "/.git", head))
+      {
+        return parse_head(head);
+      }
+
+      size_t slash = path.rfind('/');
+      if (slash == std::string::npos || path == "/")
+      {
+        break;
+      }
+      path.resize((slash == 0) ? 1 : slash);
+    }
+
+    return "";
+  }
+
+private:
+  /* Asks background thread for branch of 'dir' and waits for it until deadline.
+   * Late answer is kept and shown by the next prompt in the same directory */
+  const std::string &get_branch(const std::string &dir)
+  {
+    std::unique_lock<std::mutex> lock(lookup->mutex);
+
+    if (!lookup->is_running && !start_lookup_thread())
+    {
+      return branch;
+    }
+
+    uint64_t seq = ++lookup->request_seq;
+    lookup->request_dir = dir;
+    lookup->request_ready.notify_one();
+
+    lookup->result_ready.wait_for(lock, deadline, [&]() { return lookup->result_seq >= seq; });
+
+    // answer of this or an earlier request, if it is about the same directory
+    if (lookup->result_dir == dir)
+    {
+      branch_dir = lookup->result_dir;
+      branch = lookup->result_branch;
+    }
+    else if (branch_dir != dir)
+    {
+      branch_dir = dir;
+      branch.clear();
+    }
+    return branch;
+  }
+
+  /* Starts detached lookup thread. Must be called with the lookup mutex locked. Returns false on failure */
+  bool start_lookup_thread()
+  {
+    try
+    {
+      std::thread([state = lookup]() { run_lookup(*state); }).detach();
+      lookup->is_running = true;
+    }
+    catch (const std::system_error &)
+    {
+      return false;
+    }
+    return true;
+  }
+
+  /* Lookup thread: answers the latest request. Finishes when the prompt is destroyed */
+  static void run_lookup(branch_lookup &state)
+  {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    uint64_t answered = 0;
+
+    while (true)
+    {
+      state.request_ready.wait(lock, [&]() { return state.is_stopped || state.request_seq != answered; });
+      if (state.is_stopped)
+      {
+        return;
+      }
+
+      uint64_t seq = state.request_seq;
+      std::string dir = state.request_dir;
+      lock.unlock();
+      std::string found = find_branch(dir);
+      lock.lock();
+
+      answered = seq;
+      state.result_seq = seq;
+      state.result_dir = dir;
+      state.result_branch = found;
+      state.result_ready.notify_all();
+    }
+  }
+
+  /* Reads HEAD of git directory or of the directory named by ".git" file. Returns false if there is none */
+  static bool read_head(const std::string &git_path, std::string &head)
+  {
+    std::string content;
+    if (read_small_file(git_path + "/HEAD", content))
+    {
+      head = content;
+      return true;
+    }
+
+    // ".git" file of worktree or submodule: "gitdir: <path>"
+    if (!read_small_file(git_path, content) || content.compare(0, 8, "gitdir: ") != 0)
+    {
+      return false;
+    }
+
+    std::string git_dir = content.substr(8);
+    git_dir.erase(git_dir.find_last_not_of(" \n\r") + 1);
+    if (!git_dir.empty() && git_dir[0] != '/')
+    {
+      git_dir = git_path.substr(0, git_path.rfind('/') + 1) + git_dir;
+    }
+    return read_small_file(git_dir + "/HEAD", head);
+  }
+
+  /* Reads the beginning of a regular file. Returns false if it can not be read */
+  static bool read_small_file(const std::string &file_name, std::string &content)
+  {
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd == -1)
+    {
+      return false;
+    }
+
+    char buffer[PROMPT_HEAD_SIZE];
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (size <= 0)
+    {
+      return false;
+    }
+
+    content.assign(buffer, size);
+    return true;
+  }
+
+  /* Returns branch name of HEAD content: "ref: refs/heads/<name>" or commit hash */
+  static std::string parse_head(std::string head)
+  {
+    head.erase(head.find_last_not_of(" \n\r") + 1);
+
+    const char *ref_prefix = "ref: refs/heads/";
+    if (head.compare(0, strlen(ref_prefix), ref_prefix) == 0)
+    {
+      return head.substr(strlen(ref_prefix));
+    }
+    if (head.compare(0, 5, "ref: ") == 0)
+    {
+      return head.substr(5);
+    }
+    return head.substr(0, 7);
+  }
+
+  /* Returns duration as "850ms", "12.3s" or "2m05s" */
+  static std::string format_duration(double seconds)
+  {
+    char text[32];
+
+    if (seconds < 1)
+    {
+      snprintf(text, sizeof(text), "%dms", (int)(seconds * 1e3));
+    }
+    else if (seconds < 60)
+    {
+      snprintf(text, sizeof(text), "%.1fs", seconds);
+    }
+    else
+    {
+      snprintf(text, sizeof(text), "%dm%02ds", (int)(seconds / 60), (int)seconds % 60);
+    }
+    return text;
+  }
+};
+
+#endif //MICROSHA_PROMPT_H
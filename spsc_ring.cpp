@@ -0,0 +1 @@
+#include "spsc_ring.h"
@@ -0,0 +1,318 @@
+#ifndef MICROSHA_SPSC_RING_H
+#define MICROSHA_SPSC_RING_H
+
+#include <unistd.h>
+#include <climits>
+#include <cstring>
+#include <cstdint>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+
+#define SPSC_RING_CAPACITY (1 << 20)
+#define RING_STREAM_BUFFER_SIZE (1 << 16)
+
+/* Lock-free single-producer single-consumer byte ring. Replaces a pipe between two pipeline stages
+ * running on shell threads: data is copied once into the ring and once out of it, without system calls
+ * while both sides keep up.
+ * A side sleeps on futex only when it can not proceed: reader - when the ring is empty,
+ * writer - when there is less free space than it needs (at most a quarter of the ring, so handoff is batched).
+ * The other side wakes it only if it announced that it sleeps.
+ * Closing the write end gives EOF to the reader, closing the read end makes writes fail as EPIPE does */
+class spsc_ring
+{
+private:
+  std::unique_ptr<char[]> data;
+  size_t capacity;
+
+  alignas(64) std::atomic<size_t> head{0};         // total bytes read, written by reader only
+  alignas(64) std::atomic<size_t> tail{0};         // total bytes written, written by writer only
+  alignas(64) std::atomic<uint32_t> data_seq{0};   // futex word of the sleeping reader
+  std::atomic<bool> reader_sleeps{false};
+  std::atomic<bool> writer_closed{false};
+  alignas(64) std::atomic<uint32_t> space_seq{0};  // futex word of the sleeping writer
+  std::atomic<bool> writer_sleeps{false};
+  std::atomic<bool> reader_closed{false};
+
+public:
+  /* Class constructor. Capacity must be a power of 2 */
+  explicit spsc_ring(size_t new_capacity = SPSC_RING_CAPACITY) :
+    data(new char[new_capacity]), capacity(new_capacity)
+  {
+  }
+
+  /* Default class destructor */
+  ~spsc_ring()
+  =default;
+
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+  /* Writes all bytes waiting for free space. Returns false if the read end is closed */
+  bool write(const char *buffer, size_t size)
+  {
+    size_t written_tail = tail.load(std::memory_order_relaxed);
+
+    while (size > 0)
+    {
+      size_t free_size = capacity - (written_tail - head.load(std::memory_order_acquire));
+      if (reader_closed.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+      if (free_size == 0)
+      {
+        wait_for_space(written_tail, std::min(size, capacity / 4));
+        continue;
+      }
+
+      size_t chunk = std::min(size, free_size);
+      copy_in(written_tail, buffer, chunk);
+      written_tail += chunk;
+      buffer += chunk;
+      size -= chunk;
+
+      tail.store(written_tail, std::memory_order_seq_cst);
+      if (reader_sleeps.load(std::memory_order_seq_cst))
+      {
+        wake(data_seq);
+      }
+    }
+
+    return true;
+  }
+
+  /* Reads at most 'size' bytes waiting until some are available. Returns 0 at EOF */
+  size_t read(char *buffer, size_t size)
+  {
+    size_t read_head = head.load(std::memory_order_relaxed);
+    size_t available;
+
+    while ((available = tail.load(std::memory_order_acquire) - read_head) == 0)
+    {
+      if (writer_closed.load(std::memory_order_acquire))
+      {
+        // data written before closing is visible after 'writer_closed' is seen
+        if ((available = tail.load(std::memory_order_acquire) - read_head) == 0)
+        {
+          return 0;
+        }
+        break;
+      }
+      wait_for_data(read_head);
+    }
+
+    size_t chunk = std::min(size, available);
+    copy_out(read_head, buffer, chunk);
+    read_head += chunk;
+
+    head.store(read_head, std::memory_order_seq_cst);
+    if (writer_sleeps.load(std::memory_order_seq_cst) &&
+        capacity - (tail.load(std::memory_order_acquire) - read_head) >= capacity / 4)
+    {
+      wake(space_seq);
+    }
+
+    return chunk;
+  }
+
+  /* Closes write end: reader gets EOF after the written data */
+  void close_write()
+  {
+    writer_closed.store(true, std::memory_order_seq_cst);
+    wake(data_seq);
+  }
+
+  /* Closes read end: writer fails instead of waiting for space */
+  void close_read()
+  {
+    reader_closed.store(true, std::memory_order_seq_cst);
+    wake(space_seq);
+  }
+
+private:
+  /* Copies bytes into the ring at position 'pos' wrapping around its end */
+  void copy_in(size_t pos, const char *buffer, size_t size)
+  {
+    size_t offset = pos & (capacity - 1),
+           first_part = std::min(size, capacity - offset);
+
+    memcpy(data.get() + offset, buffer, first_part);
+    memcpy(data.get(), buffer + first_part, size - first_part);
+  }
+
+  /* Copies bytes from the ring at position 'pos' wrapping around its end */
+  void copy_out(size_t pos, char *buffer, size_t size) const
+  {
+    size_t offset = pos & (capacity - 1),
+           first_part = std::min(size, capacity - offset);
+
+    memcpy(buffer, data.get() + offset, first_part);
+    memcpy(buffer + first_part, data.get(), size - first_part);
+  }
+
+  /* Sleeps until reader frees 'needed' bytes or closes the ring */
+  void wait_for_space(size_t written_tail, size_t needed)
+  {
+    uint32_t seq = space_seq.load(std::memory_order_acquire);
+    writer_sleeps.store(true, std::memory_order_seq_cst);
+
+    // condition is checked again after announcing sleep, so wakeup sent in between is not lost
+    if (capacity - (written_tail - head.load(std::memory_order_seq_cst)) < needed &&
+        !reader_closed.load(std::memory_order_seq_cst))
+    {
+      syscall(SYS_futex, &space_seq, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+    }
+    writer_sleeps.store(false, std::memory_order_relaxed);
+  }
+
+  /* Sleeps until writer publishes data after 'read_head' or closes the ring */
+  void wait_for_data(size_t read_head)
+  {
+    uint32_t seq = data_seq.load(std::memory_order_acquire);
+    reader_sleeps.store(true, std::memory_order_seq_cst);
+
+    if (tail.load(std::memory_order_seq_cst) == read_head && !writer_closed.load(std::memory_order_seq_cst))
+    {
+      syscall(SYS_futex, &data_seq, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+    }
+    reader_sleeps.store(false, std::memory_order_relaxed);
+  }
+
+  /* Wakes the side sleeping on futex word */
+  static void wake(std::atomic<uint32_t> &seq)
+  {
+    seq.fetch_add(1, std::memory_order_seq_cst);
+    syscall(SYS_futex, &seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+  }
+};
+
+/* Output stream buffer writing to the ring. Large writes go to the ring directly */
+class ring_ostreambuf : public std::streambuf
+{
+private:
+  spsc_ring &ring;
+  std::unique_ptr<char[]> buffer;
+
+public:
+  /* Class constructor */
+  explicit ring_ostreambuf(spsc_ring &new_ring) : ring(new_ring), buffer(new char[RING_STREAM_BUFFER_SIZE])
+  {
+    setp(buffer.get(), buffer.get() + RING_STREAM_BUFFER_SIZE);
+  }
+
+  /* Class destructor. Writes buffered data */
+  ~ring_ostreambuf() override
+  {
+    sync();
+  }
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (sync() != 0)
+    {
+      return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override
+  {
+    if (n < epptr() - pptr())
+    {
+      memcpy(pptr(), s, n);
+      pbump((int)n);
+      return n;
+    }
+
+    if (sync() != 0 || !ring.write(s, n))
+    {
+      return 0;
+    }
+    return n;
+  }
+
+  int sync() override
+  {
+    bool is_written = ring.write(pbase(), pptr() - pbase());
+    setp(buffer.get(), buffer.get() + RING_STREAM_BUFFER_SIZE);
+    return is_written ? 0 : -1;
+  }
+};
+
+/* Input stream buffer reading from the ring */
+class ring_istreambuf : public std::streambuf
+{
+private:
+  spsc_ring &ring;
+  std::unique_ptr<char[]> buffer;
+
+public:
+  /* Class constructor */
+  explicit ring_istreambuf(spsc_ring &new_ring) : ring(new_ring), buffer(new char[RING_STREAM_BUFFER_SIZE])
+  {
+    setg(buffer.get(), buffer.get(), buffer.get());
+  }
+
+protected:
+  int_type underflow() override
+  {
+    size_t size = ring.read(buffer.get(), RING_STREAM_BUFFER_SIZE);
+    if (size == 0)
+    {
+      return traits_type::eof();
+    }
+
+    setg(buffer.get(), buffer.get(), buffer.get() + size);
+    return traits_type::to_int_type(*gptr());
+  }
+};
+
+/* Output stream writing to the ring */
+class ring_ostream : public std::ostream
+{
+private:
+  ring_ostreambuf buf;
+
+public:
+  /* Class constructor */
+  explicit ring_ostream(spsc_ring &ring) : std::ostream(nullptr), buf(ring)
+  {
+    rdbuf(&buf);
+  }
+
+  /* Class destructor. Writes buffered data */
+  ~ring_ostream() override
+  {
+    flush();
+  }
+};
+
+/* Input stream reading from the ring */
+class ring_istream : public std::istream
+{
+private:
+  ring_istreambuf buf;
+
+public:
+  /* Class constructor */
+  explicit ring_istream(spsc_ring &ring) : std::istream(nullptr), buf(ring)
+  {
+    rdbuf(&buf);
+  }
+};
+
+#endif //MICROSHA_SPSC_RING_H
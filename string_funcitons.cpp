@@ -5,7 +5,7 @@ void split_string_by_token(const std::string &text, char token, std::vector<std:
 {
   for (size_t i = 0, prev = 0; i <= text.size(); i++)
   {
-    if (text[i] == token || text[i] == '\0')
+    if (i == text.size() || text[i] == token)
     {
       if (i == prev)
       {
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Filename expansion checks: '**' with literal prefixes ('.', '..'), trailing '**' matching zero directories
+# and a symbolic link loop.
+# Usage : tests/glob_test.sh [shell] (default ./a.out)
+
+shell=$(realpath "${1:-./a.out}")
+dir=$(mktemp -d /tmp/glob_test.XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+mkdir -p "$dir/g/a/b" "$dir/g/c"
+touch "$dir/g/z.txt" "$dir/g/a/b/z.txt" "$dir/g/c/z.txt"
+ln -s .. "$dir/g/a/up"
+
+# check <pattern> <expected expansion>
+check()
+{
+  actual=$(cd "$dir/g" && "$shell" -c "echo $1")
+  if [ "$actual" != "$2" ]; then
+    echo "FAIL: echo $1"
+    echo "  expected: $2"
+    echo "  actual:   $actual"
+    failed=1
+  fi
+}
+
+check '**/z.txt'         'a/b/z.txt c/z.txt z.txt'
+check './**/z.txt'       './a/b/z.txt ./c/z.txt ./z.txt'
+check './**'             './ ./a ./a/b ./a/b/z.txt ./a/up ./c ./c/z.txt ./z.txt'
+check '../g/**/z.txt'    '../g/a/b/z.txt ../g/c/z.txt ../g/z.txt'
+check 'a/./**'           'a/./ a/./b a/./b/z.txt a/./up'
+check 'a/../c/**'        'a/../c/ a/../c/z.txt'
+check 'a/**'             'a/ a/b a/b/z.txt a/up'
+check 'a/**/'            'a/ a/b a/up'
+check 'a/b/**'           'a/b/ a/b/z.txt'
+check "$dir/g/**/z.txt"  "$dir/g/a/b/z.txt $dir/g/c/z.txt $dir/g/z.txt"
+
+[ $failed -eq 0 ] && echo "glob_test: OK"
+exit $failed
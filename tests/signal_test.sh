@@ -0,0 +1,41 @@
+#!/bin/sh
+# SIGINT checks: interrupted foreground pipeline reports 128+SIGINT even if its last command is a builtin thread.
+# Usage : tests/signal_test.sh [shell] (default ./a.out)
+
+shell=$(realpath "${1:-./a.out}")
+dir=$(mktemp -d /tmp/signal_test.XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# check <pipeline> <expected status>: runs pipeline in a shell reading lines from fifo and interrupts it
+check()
+{
+  mkfifo "$dir/input"
+  # background command of non-interactive sh ignores SIGINT, the shell must get the default action back
+  MICROSHA_HISTORY="$dir/history" env --default-signal=INT "$shell" < "$dir/input" > "$dir/output" 2>&1 &
+  shell_pid=$!
+  exec 3> "$dir/input"
+
+  echo "$1" >&3
+  sleep 0.5
+  kill -INT $shell_pid
+  echo 'echo status $?' >&3
+  exec 3>&-
+  wait $shell_pid
+
+  actual=$(grep -ao "status [0-9]*" "$dir/output")
+  if [ "$actual" != "status $2" ]; then
+    echo "FAIL: $1"
+    echo "  expected: status $2"
+    echo "  actual:   $actual"
+    failed=1
+  fi
+  rm -f "$dir/input"
+}
+
+check 'sleep 3 | cat'     130
+check 'sleep 3 | sleep 3' 130
+check 'sleep 3'           130
+
+[ $failed -eq 0 ] && echo "signal_test: OK"
+exit $failed
@@ -0,0 +1 @@
+#include "text_builtins.h"
@@ -0,0 +1,1227 @@
+#ifndef MICROSHA_TEXT_BUILTINS_H
+#define MICROSHA_TEXT_BUILTINS_H
+
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <cinttypes>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+
+#include "flat_argv.h"
+#include "fd_stream.h"
+#include "text_input.h"
+#include "text_scan.h"
+
+#define EXIT_GREP_ERROR 2
+#define GREP_BLOCK_SIZE (96 << 10)
+#define TAIL_TRIM_SIZE (1 << 20)
+
+/* Enumeration for character sets of the locale external utilities would use */
+enum text_locale
+{
+  LOCALE_BYTES, // "C" or "POSIX": every byte is a character
+  LOCALE_UTF8,  // UTF-8 multibyte characters
+  LOCALE_OTHER  // other encodings are not supported
+};
+
+/* Builtin versions of text utilities 'grep', 'wc', 'cut', 'head' and 'tail'. They replace short-lived
+ * external processes in pipelines and scan input with vector kernels of 'text_scan'.
+ * Only options whose output is byte-identical to GNU utilities are supported; 'is_*_supported' functions
+ * check the arguments, and the external utility is executed for other ones.
+ * Operands are names of files, '-' or no operands - the input stream. Every function returns exit status.
+ * Argument 0 is the command name */
+class text_builtins
+{
+private:
+  /* Options of 'grep' */
+  struct grep_options
+  {
+    std::string_view pattern;
+    bool invert = false;             // -v
+    bool count = false;              // -c
+    bool line_number = false;        // -n
+    bool quiet = false;              // -q
+    bool no_messages = false;        // -s
+    bool files_with_matches = false; // -l
+    bool line_regexp = false;        // -x
+    bool fixed = false;              // -F
+    int with_filename = -1;          // -H - 1, -h - 0, by number of files - -1
+    std::vector<std::string_view> files;
+  };
+
+  /* State of 'grep' searching one input */
+  struct grep_file
+  {
+    std::string_view name;
+    size_t selected = 0;       // number of selected lines
+    size_t line_number = 0;    // number of lines before the current one
+    bool is_binary = false;    // input has NUL bytes: they end lines, and lines are not printed
+    bool binary_matched = false;
+    bool stopped = false;      // nothing else is to be read
+  };
+
+  /* Options of 'wc' */
+  struct wc_options
+  {
+    bool lines = false, words = false, bytes = false;
+    std::vector<std::string_view> files;
+  };
+
+  /* Counters of 'wc' */
+  struct wc_counts
+  {
+    size_t lines = 0, words = 0, bytes = 0;
+  };
+
+  /* Options of 'head' and 'tail' */
+  struct part_options
+  {
+    bool bytes = false;      // -c, lines otherwise
+    bool from_start = false; // tail '+N': from line (byte) N to the end
+    uintmax_t count = 10;
+    int headers = -1;        // -v - 1, -q - 0, by number of files - -1
+    std::vector<std::string_view> files;
+  };
+
+  /* Options of 'cut' */
+  struct cut_options
+  {
+    char mode = 0;                                 // 'b' - bytes (-b, -c), 'f' - fields
+    char delimiter = '\t';                         // -d
+    bool only_delimited = false;                   // -s
+    std::vector<std::pair<size_t, size_t>> ranges; // sorted disjoint ranges of 1-based positions
+    std::vector<std::string_view> files;
+  };
+
+public:
+  /**********************************************************************
+   * grep
+   **********************************************************************/
+
+  /* 'grep [-FGHchlnqsvx] pattern [file ...]' - prints lines containing fixed string.
+   * Basic regular expression is supported only if it has no special characters, so it is a fixed string.
+   * Input with NUL bytes is binary: its lines are not printed, 'binary file matches' is reported instead.
+   * In UTF-8 locale lines with encoding errors are reported the same way.
+   * Returns 0 if a line is selected, 1 if none is, 2 on error */
+  static int exec_grep(const flat_argv &args, std::istream &is, std::ostream &os)
+  {
+    grep_options opts;
+    if (!parse_grep_options(args, opts))
+    {
+      std::cerr << "grep: unsupported arguments" << std::endl;
+      return EXIT_GREP_ERROR;
+    }
+
+    bool check_encoding = (get_text_locale() == LOCALE_UTF8),
+         with_name = (opts.with_filename == 1) || (opts.with_filename == -1 && opts.files.size() > 1),
+         has_selected = false, has_error = false;
+    if (opts.files.empty())
+    {
+      opts.files.emplace_back("-");
+    }
+
+    for (std::string_view name : opts.files)
+    {
+      std::unique_ptr<text_input> input = open_input(name, is);
+      grep_file file;
+      file.name = (name == "-") ? "(standard input)" : name;
+
+      if (input->is_open())
+      {
+        grep_input(*input, opts, file, with_name, check_encoding, os);
+      }
+      if (input->get_error() != 0)
+      {
+        if (!opts.no_messages)
+        {
+          std::cerr << "grep: " << file.name << ": " << strerror(input->get_error()) << std::endl;
+        }
+        has_error = true;
+      }
+      if (!input->is_open())
+      {
+        continue;
+      }
+
+      has_selected = has_selected || file.selected > 0;
+      if (opts.quiet && has_selected)
+      {
+        return EXIT_SUCCESS;
+      }
+
+      if (opts.files_with_matches)
+      {
+        if (file.selected > 0)
+        {
+          os << file.name << '\n';
+        }
+      }
+      else if (opts.count)
+      {
+        if (with_name)
+        {
+          os << file.name << ':';
+        }
+        os << file.selected << '\n';
+      }
+      if (file.binary_matched)
+      {
+        os.flush();
+        std::cerr << "grep: " << file.name << ": binary file matches" << std::endl;
+      }
+    }
+
+    os.flush();
+    if (has_error || !os.good())
+    {
+      return EXIT_GREP_ERROR;
+    }
+    return has_selected ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  /* Checks if 'grep' builtin supports given arguments. 'reads_input' is set if it reads the input stream */
+  static bool is_grep_supported(const flat_argv &args, bool &reads_input)
+  {
+    grep_options opts;
+    if (!parse_grep_options(args, opts) || get_text_locale() == LOCALE_OTHER)
+    {
+      return false;
+    }
+
+    reads_input = reads_stream(opts.files);
+    return true;
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * wc
+   **********************************************************************/
+
+  /* 'wc [-lwc] [file ...]' - prints numbers of lines, words and bytes of every file and their total.
+   * Numbers are aligned as GNU 'wc' does: by the total size of regular files, at least 7 positions if
+   * some input is not a regular file, with no padding if only one number is printed for one input.
+   * Words are counted in C locale only */
+  static int exec_wc(const flat_argv &args, std::istream &is, std::ostream &os)
+  {
+    wc_options opts;
+    if (!parse_wc_options(args, opts))
+    {
+      std::cerr << "wc: unsupported arguments" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    bool has_names = !opts.files.empty();
+    if (!has_names)
+    {
+      opts.files.emplace_back("-");
+    }
+    int width = get_wc_width(opts, is);
+    int status = EXIT_SUCCESS;
+    wc_counts total;
+
+    for (std::string_view name : opts.files)
+    {
+      std::unique_ptr<text_input> input = open_input(name, is);
+      if (!input->is_open())
+      {
+        std::cerr << "wc: " << quote_if_needed(name) << ": " << strerror(input->get_error()) << std::endl;
+        status = EXIT_FAILURE;
+        continue;
+      }
+
+      wc_counts counts;
+      bool in_word = false;
+      const char *begin, *end;
+      while (input->next_chunk(begin, end))
+      {
+        counts.bytes += end - begin;
+        if (opts.lines)
+        {
+          counts.lines += text_scan::count_byte(begin, end, '\n');
+        }
+        if (opts.words)
+        {
+          counts.words += text_scan::count_words(begin, end, in_word);
+        }
+      }
+
+      if (input->get_error() != 0)
+      {
+        std::cerr << "wc: " << quote_if_needed(name) << ": " << strerror(input->get_error()) << std::endl;
+        status = EXIT_FAILURE;
+      }
+
+      write_wc_counts(opts, counts, width, has_names ? name : std::string_view(), os);
+      total.lines += counts.lines;
+      total.words += counts.words;
+      total.bytes += counts.bytes;
+    }
+
+    if (opts.files.size() > 1)
+    {
+      write_wc_counts(opts, total, width, "total", os);
+    }
+
+    os.flush();
+    return os.good() ? status : EXIT_FAILURE;
+  }
+
+  /* Checks if 'wc' builtin supports given arguments. 'reads_input' is set if it reads the input stream */
+  static bool is_wc_supported(const flat_argv &args, bool &reads_input)
+  {
+    wc_options opts;
+    if (!parse_wc_options(args, opts) || (opts.words && get_text_locale() != LOCALE_BYTES))
+    {
+      return false;
+    }
+
+    reads_input = reads_stream(opts.files);
+    return true;
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * head and tail
+   **********************************************************************/
+
+  /* 'head [-qv] [-n lines | -c bytes | -lines] [file ...]' - prints the first 10 (or given number of) lines
+   * or bytes of every file. Files are preceded by '==> name <==' headers if there are several of them.
+   * Input is not read after the needed part */
+  static int exec_head(const flat_argv &args, std::istream &is, std::ostream &os)
+  {
+    part_options opts;
+    if (!parse_part_options(args, opts, false))
+    {
+      std::cerr << "head: unsupported arguments" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    return for_each_part_input(opts, "head", is, os, [&opts, &os](text_input &input)
+                               {
+                                 uintmax_t remaining = opts.count;
+                                 const char *begin, *end;
+
+                                 while (remaining > 0 && os.good() && input.next_chunk(begin, end))
+                                 {
+                                   // mapped file is scanned by chunks too, not to count lines past the needed ones
+                                   end = std::min(end, begin + TEXT_INPUT_CHUNK_SIZE);
+                                   input.unread(end);
+                                   const char *stop = end;
+                                   if (opts.bytes)
+                                   {
+                                     stop = begin + std::min<uintmax_t>(remaining, end - begin);
+                                     remaining -= stop - begin;
+                                   }
+                                   else
+                                   {
+                                     size_t lines = text_scan::count_byte(begin, end, '\n');
+                                     if (lines < remaining)
+                                     {
+                                       remaining -= lines;
+                                     }
+                                     else
+                                     {
+                                       for (stop = begin; remaining > 0; remaining--)
+                                       {
+                                         stop = text_scan::find_byte(stop, end, '\n') + 1;
+                                       }
+                                     }
+                                   }
+                                   os.write(begin, stop - begin);
+                                 }
+                               });
+  }
+
+  /* Checks if 'head' builtin supports given arguments. 'reads_input' is set if it reads the input stream */
+  static bool is_head_supported(const flat_argv &args, bool &reads_input)
+  {
+    part_options opts;
+    if (!parse_part_options(args, opts, false))
+    {
+      return false;
+    }
+
+    reads_input = reads_stream(opts.files);
+    return true;
+  }
+
+  /* 'tail [-qv] [-n [+]lines | -c [+]bytes | -lines] [file ...]' - prints the last 10 (or given number of)
+   * lines or bytes of every file, or all of them starting from the given one ('+N').
+   * Mapped file is scanned from its end; streams are kept in memory, cut down to the needed tail as they grow */
+  static int exec_tail(const flat_argv &args, std::istream &is, std::ostream &os)
+  {
+    part_options opts;
+    if (!parse_part_options(args, opts, true))
+    {
+      std::cerr << "tail: unsupported arguments" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    if (opts.count == 0 && !opts.from_start)
+    {
+      return EXIT_SUCCESS; // nothing is printed, files are not even opened
+    }
+
+    return for_each_part_input(opts, "tail", is, os, [&opts, &os](text_input &input)
+                               {
+                                 const char *begin, *end;
+
+                                 if (opts.from_start)
+                                 {
+                                   uintmax_t skipped = (opts.count > 0) ? opts.count - 1 : 0;
+                                   while (os.good() && input.next_chunk(begin, end))
+                                   {
+                                     while (skipped > 0 && begin < end)
+                                     {
+                                       if (opts.bytes)
+                                       {
+                                         size_t size = std::min<uintmax_t>(skipped, end - begin);
+                                         begin += size;
+                                         skipped -= size;
+                                       }
+                                       else
+                                       {
+                                         begin = text_scan::find_byte(begin, end, '\n');
+                                         skipped -= (begin < end);
+                                         begin += (begin < end);
+                                       }
+                                     }
+                                     os.write(begin, end - begin);
+                                   }
+                                   return;
+                                 }
+
+                                 if (input.is_memory())
+                                 {
+                                   if (input.next_chunk(begin, end))
+                                   {
+                                     const char *start = get_tail_start(begin, end, opts);
+                                     os.write(start, end - start);
+                                   }
+                                   return;
+                                 }
+
+                                 std::string data;
+                                 size_t trim_size = TAIL_TRIM_SIZE;
+                                 while (input.next_chunk(begin, end))
+                                 {
+                                   data.append(begin, end - begin);
+                                   if (data.size() >= trim_size)
+                                   {
+                                     data.erase(0, get_tail_start(data.data(), data.data() + data.size(), opts) - data.data());
+                                     trim_size = std::max<size_t>(TAIL_TRIM_SIZE, data.size() * 2);
+                                   }
+                                 }
+                                 const char *start = get_tail_start(data.data(), data.data() + data.size(), opts);
+                                 os.write(start, data.data() + data.size() - start);
+                               });
+  }
+
+  /* Checks if 'tail' builtin supports given arguments. 'reads_input' is set if it reads the input stream */
+  static bool is_tail_supported(const flat_argv &args, bool &reads_input)
+  {
+    part_options opts;
+    if (!parse_part_options(args, opts, true))
+    {
+      return false;
+    }
+
+    reads_input = reads_stream(opts.files);
+    return true;
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * cut
+   **********************************************************************/
+
+  /* 'cut -b list [-n] [file ...]', 'cut -c list [file ...]' or 'cut -f list [-d delim] [-s] [file ...]' -
+   * prints selected bytes or fields of every line. List is comma-separated numbers and ranges 'N-M', 'N-', '-M'.
+   * Characters are bytes as in GNU 'cut'. Lines without delimiter are printed whole, or skipped with -s */
+  static int exec_cut(const flat_argv &args, std::istream &is, std::ostream &os)
+  {
+    cut_options opts;
+    if (!parse_cut_options(args, opts))
+    {
+      std::cerr << "cut: unsupported arguments" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    if (opts.files.empty())
+    {
+      opts.files.emplace_back("-");
+    }
+    int status = EXIT_SUCCESS;
+
+    for (std::string_view name : opts.files)
+    {
+      std::unique_ptr<text_input> input = open_input(name, is);
+      const char *begin, *end;
+
+      while (input->is_open() && os.good() && input->next_lines(begin, end))
+      {
+        if (opts.mode == 'b') { cut_bytes(begin, end, opts, os);  }
+        else                  { cut_fields(begin, end, opts, os); }
+      }
+
+      if (input->get_error() != 0)
+      {
+        std::cerr << "cut: " << quote_if_needed(name) << ": " << strerror(input->get_error()) << std::endl;
+        status = EXIT_FAILURE;
+      }
+    }
+
+    os.flush();
+    return os.good() ? status : EXIT_FAILURE;
+  }
+
+  /* Checks if 'cut' builtin supports given arguments. 'reads_input' is set if it reads the input stream */
+  static bool is_cut_supported(const flat_argv &args, bool &reads_input)
+  {
+    cut_options opts;
+    if (!parse_cut_options(args, opts))
+    {
+      return false;
+    }
+
+    reads_input = reads_stream(opts.files);
+    return true;
+  }
+
+  /**********************************************************************/
+
+private:
+  /**********************************************************************
+   * Common functions
+   **********************************************************************/
+
+  /* Splits arguments into options and operands as 'getopt' does: options may follow operands until '--'.
+   * 'on_option' gets option letter and its value (letters from 'with_value' take the rest of the argument
+   * or the next one) and returns false for unsupported option. Long options are not supported.
+   * Operands and values refer to NUL-terminated arguments, so their 'data()' are C strings.
+   * Arguments before 'first' are skipped */
+  template <typename F>
+  static bool parse_options(const flat_argv &args, std::string_view with_value,
+                            std::vector<std::string_view> &operands, F on_option, size_t first = 1)
+  {
+    bool options_end = false;
+
+    for (size_t i = first; i < args.size(); i++)
+    {
+      std::string_view arg = args[i];
+      if (options_end || arg.size() < 2 || arg[0] != '-')
+      {
+        operands.push_back(arg);
+        continue;
+      }
+      if (arg == "--")
+      {
+        options_end = true;
+        continue;
+      }
+      if (arg[1] == '-')
+      {
+        return false;
+      }
+
+      for (size_t j = 1; j < arg.size(); j++)
+      {
+        if (with_value.find(arg[j]) == std::string_view::npos)
+        {
+          if (!on_option(arg[j], std::string_view()))
+          {
+            return false;
+          }
+          continue;
+        }
+
+        std::string_view value;
+        if      (j + 1 < arg.size()) { value = arg.substr(j + 1); }
+        else if (i + 1 < args.size()) { value = args[++i];        }
+        else                          { return false;             }
+
+        if (!on_option(arg[j], value))
+        {
+          return false;
+        }
+        break;
+      }
+    }
+
+    return true;
+  }
+
+  /* Opens input named by operand. '-' is the input stream */
+  static std::unique_ptr<text_input> open_input(std::string_view name, std::istream &is)
+  {
+    if (name == "-")
+    {
+      return std::make_unique<text_input>(is);
+    }
+    return std::make_unique<text_input>(name.data());
+  }
+
+  /* Checks if operands make the utility read the input stream */
+  static bool reads_stream(const std::vector<std::string_view> &files)
+  {
+    return files.empty() || std::find(files.begin(), files.end(), "-") != files.end();
+  }
+
+  /* Returns character set of the locale set by environment, which external utilities would use */
+  static text_locale get_text_locale()
+  {
+    const char *name = nullptr;
+    for (const char *variable : {"LC_ALL", "LC_CTYPE", "LANG"})
+    {
+      name = getenv(variable);
+      if (name != nullptr && *name != '\0')
+      {
+        break;
+      }
+    }
+
+    if (name == nullptr || *name == '\0' || strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0)
+    {
+      return LOCALE_BYTES;
+    }
+    if (strcasestr(name, "UTF-8") != nullptr || strcasestr(name, "utf8") != nullptr)
+    {
+      return LOCALE_UTF8;
+    }
+    return LOCALE_OTHER;
+  }
+
+  /* Parses decimal count. Returns false if it is not a number */
+  static bool parse_count(std::string_view value, uintmax_t &count)
+  {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string_view::npos)
+    {
+      return false;
+    }
+
+    errno = 0;
+    count = strtoumax(value.data(), nullptr, 10);
+    return errno != ERANGE;
+  }
+
+  /* Quotes file name for message as GNU utilities do with 'quotef': only if it has special characters */
+  static std::string quote_if_needed(std::string_view name)
+  {
+    bool is_plain = !name.empty();
+    for (char c : name)
+    {
+      is_plain = is_plain && (isalnum((unsigned char)c) || strchr("%+,-./:=@_", c) != nullptr);
+    }
+    return is_plain ? std::string(name) : quote(name);
+  }
+
+  /* Quotes file name for message as GNU utilities do with 'quote' */
+  static std::string quote(std::string_view name)
+  {
+    char mark = (name.find('\'') == std::string_view::npos) ? '\'' : '"';
+    return mark + std::string(name) + mark;
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * grep functions
+   **********************************************************************/
+
+  /* Parses 'grep' arguments. Returns false for unsupported ones */
+  static bool parse_grep_options(const flat_argv &args, grep_options &opts)
+  {
+    bool is_parsed = parse_options(args, "", opts.files, [&opts](char option, std::string_view)
+    {
+      switch (option)
+      {
+        case 'F': opts.fixed = true;              return true;
+        case 'G': opts.fixed = false;             return true;
+        case 'H': opts.with_filename = 1;         return true;
+        case 'h': opts.with_filename = 0;         return true;
+        case 'c': opts.count = true;              return true;
+        case 'l': opts.files_with_matches = true; return true;
+        case 'n': opts.line_number = true;        return true;
+        case 'q': opts.quiet = true;              return true;
+        case 's': opts.no_messages = true;        return true;
+        case 'v': opts.invert = true;             return true;
+        case 'x': opts.line_regexp = true;        return true;
+        default:                                  return false;
+      }
+    });
+    if (!is_parsed || opts.files.empty())
+    {
+      return false;
+    }
+
+    opts.pattern = opts.files.front();
+    opts.files.erase(opts.files.begin());
+
+    // several patterns or regular expression
+    return opts.pattern.find('\n') == std::string_view::npos &&
+           (opts.fixed || opts.pattern.find_first_of("\\[].*^$") == std::string_view::npos);
+  }
+
+  /* Searches one input. Selected lines are printed unless only counting */
+  static void grep_input(text_input &input, const grep_options &opts, grep_file &file, bool with_name,
+                         bool check_encoding, std::ostream &os)
+  {
+    const char *begin, *end;
+    std::string zapped;
+
+    while (!file.stopped && os.good() && input.next_lines(begin, end, GREP_BLOCK_SIZE))
+    {
+      // binary input is detected by blocks as GNU 'grep' does by its buffers. NUL bytes end lines in it
+      if (text_scan::find_byte(begin, end, '\0') != end)
+      {
+        file.is_binary = true;
+        zapped.assign(begin, end);
+        std::replace(zapped.begin(), zapped.end(), '\0', '\n');
+        begin = zapped.data();
+        end = begin + zapped.size();
+      }
+
+      for (const char *pos = begin; pos < end && !file.stopped;)
+      {
+        const char *match = find_matching_line(pos, end, opts);
+
+        if (opts.invert)
+        {
+          for (const char *line = pos; line < match && !file.stopped;)
+          {
+            const char *line_end = text_scan::find_byte(line, match, '\n');
+            file.line_number++;
+            select_line(line, line_end, opts, file, with_name, check_encoding, os);
+            line = (line_end < match) ? line_end + 1 : match;
+          }
+        }
+        else if (opts.line_number)
+        {
+          file.line_number += text_scan::count_byte(pos, match, '\n');
+        }
+
+        if (match == end)
+        {
+          break;
+        }
+
+        const char *line_end = text_scan::find_byte(match, end, '\n');
+        file.line_number++;
+        if (!opts.invert)
+        {
+          select_line(match, line_end, opts, file, with_name, check_encoding, os);
+        }
+        pos = (line_end < end) ? line_end + 1 : end;
+      }
+    }
+  }
+
+  /* Returns the start of the first line matching pattern in [begin, end), or 'end' */
+  static const char *find_matching_line(const char *begin, const char *end, const grep_options &opts)
+  {
+    for (const char *pos = begin; pos < end;)
+    {
+      const char *found = text_scan::find_string(pos, end, opts.pattern);
+      if (found == end)
+      {
+        return end;
+      }
+
+      const char *line = (const char *)memrchr(begin, '\n', found - begin);
+      line = (line == nullptr) ? begin : line + 1;
+      if (!opts.line_regexp)
+      {
+        return line;
+      }
+
+      const char *found_end = found + opts.pattern.size();
+      if (found == line && (found_end == end || *found_end == '\n'))
+      {
+        return line;
+      }
+      pos = found + 1;
+    }
+
+    return end;
+  }
+
+  /* Handles selected line [line, line_end) */
+  static void select_line(const char *line, const char *line_end, const grep_options &opts, grep_file &file,
+                          bool with_name, bool check_encoding, std::ostream &os)
+  {
+    file.selected++;
+    if (opts.quiet || opts.files_with_matches)
+    {
+      file.stopped = true;
+      return;
+    }
+    if (opts.count)
+    {
+      return;
+    }
+    if (file.is_binary)
+    {
+      file.binary_matched = true;
+      file.stopped = true;
+      return;
+    }
+    if (check_encoding && !is_valid_utf8(line, line_end))
+    {
+      file.binary_matched = true; // the line is not printed, searching goes on
+      return;
+    }
+
+    if (with_name)
+    {
+      os << file.name << ':';
+    }
+    if (opts.line_number)
+    {
+      os << file.line_number << ':';
+    }
+    os.write(line, line_end - line);
+    os << '\n';
+  }
+
+  /* Checks if text is valid UTF-8: no stray continuation bytes, truncated, overlong or surrogate sequences */
+  static bool is_valid_utf8(const char *begin, const char *end)
+  {
+    for (const char *pos = text_scan::find_non_ascii(begin, end); pos < end; pos = text_scan::find_non_ascii(pos, end))
+    {
+      auto c = (unsigned char)pos[0];
+      size_t size = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC2) ? 2 : 0;
+      if (size == 0 || c > 0xF4 || (size_t)(end - pos) < size)
+      {
+        return false;
+      }
+
+      for (size_t i = 1; i < size; i++)
+      {
+        if (((unsigned char)pos[i] & 0xC0) != 0x80)
+        {
+          return false;
+        }
+      }
+
+      auto second = (unsigned char)pos[1];
+      if ((c == 0xE0 && second < 0xA0) || (c == 0xED && second > 0x9F) ||
+          (c == 0xF0 && second < 0x90) || (c == 0xF4 && second > 0x8F))
+      {
+        return false;
+      }
+      pos += size;
+    }
+
+    return true;
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * wc functions
+   **********************************************************************/
+
+  /* Parses 'wc' arguments. Returns false for unsupported ones */
+  static bool parse_wc_options(const flat_argv &args, wc_options &opts)
+  {
+    bool is_parsed = parse_options(args, "", opts.files, [&opts](char option, std::string_view)
+    {
+      switch (option)
+      {
+        case 'l': opts.lines = true; return true;
+        case 'w': opts.words = true; return true;
+        case 'c': opts.bytes = true; return true;
+        default:                     return false;
+      }
+    });
+
+    if (!opts.lines && !opts.words && !opts.bytes)
+    {
+      opts.lines = opts.words = opts.bytes = true;
+    }
+    return is_parsed;
+  }
+
+  /* Returns width of numbers as GNU 'wc' computes it from sizes of inputs */
+  static int get_wc_width(const wc_options &opts, std::istream &is)
+  {
+    if (opts.files.size() == 1 && opts.lines + opts.words + opts.bytes == 1)
+    {
+      return 1;
+    }
+
+    uintmax_t regular_size = 0;
+    int min_width = 1, width = 1;
+    for (size_t i = 0; i < opts.files.size(); i++)
+    {
+      struct stat st{};
+      bool is_stated;
+      if (opts.files[i] == "-")
+      {
+        // ring between thread stages is a pipe for external 'wc'
+        auto *fd_input = dynamic_cast<fd_istream *>(&is);
+        is_stated = (fd_input == nullptr) || fstat(fd_input->get_fd(), &st) == 0;
+      }
+      else
+      {
+        is_stated = (stat(opts.files[i].data(), &st) == 0);
+      }
+
+      if (!is_stated)
+      {
+        if (i == 0)
+        {
+          return 1;
+        }
+        continue;
+      }
+      if (S_ISREG(st.st_mode)) { regular_size += st.st_size; }
+      else                     { min_width = 7;              }
+    }
+
+    for (; regular_size >= 10; regular_size /= 10)
+    {
+      width++;
+    }
+    return std::max(width, min_width);
+  }
+
+  /* Writes one line of 'wc' output */
+  static void write_wc_counts(const wc_options &opts, const wc_counts &counts, int width, std::string_view name,
+                              std::ostream &os)
+  {
+    bool is_first = true;
+    for (auto [is_printed, value] : {std::pair(opts.lines, counts.lines),
+                                     std::pair(opts.words, counts.words),
+                                     std::pair(opts.bytes, counts.bytes)})
+    {
+      if (!is_printed)
+      {
+        continue;
+      }
+
+      char buffer[32];
+      int size = snprintf(buffer, sizeof(buffer), is_first ? "%*zu" : " %*zu", width, value);
+      os.write(buffer, size);
+      is_first = false;
+    }
+
+    if (!name.empty())
+    {
+      os << ' ' << name;
+    }
+    os << '\n';
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * head and tail functions
+   **********************************************************************/
+
+  /* Parses 'head' or 'tail' arguments. Returns false for unsupported ones */
+  static bool parse_part_options(const flat_argv &args, part_options &opts, bool is_tail)
+  {
+    // obsolete first option '-N'
+    size_t first = 1;
+    if (args.size() > 1 && args[1].size() > 1 && args[1][0] == '-' &&
+        args[1].find_first_not_of("0123456789", 1) == std::string_view::npos)
+    {
+      if (!parse_count(args[1].substr(1), opts.count))
+      {
+        return false;
+      }
+      first = 2;
+    }
+
+    bool is_parsed = parse_options(args, "nc", opts.files, [&opts, is_tail](char option, std::string_view value)
+    {
+      switch (option)
+      {
+        case 'q': opts.headers = 0; return true;
+        case 'v': opts.headers = 1; return true;
+        case 'n':
+        case 'c':
+        {
+          opts.bytes = (option == 'c');
+          opts.from_start = is_tail && !value.empty() && value[0] == '+';
+          if (is_tail && !value.empty() && (value[0] == '+' || value[0] == '-'))
+          {
+            value.remove_prefix(1);
+          }
+          return parse_count(value, opts.count);
+        }
+        default: return false;
+      }
+    }, first);
+
+    // 'tail -N' is obsolete usage only with one file, otherwise it is an error
+    return is_parsed && (!is_tail || first == 1 || opts.files.size() <= 1);
+  }
+
+  /* Runs 'print_part' for every input of 'head' or 'tail' printing headers and error messages */
+  template <typename F>
+  static int for_each_part_input(part_options &opts, const char *name, std::istream &is, std::ostream &os,
+                                 F print_part)
+  {
+    bool with_headers = (opts.headers == 1) || (opts.headers == -1 && opts.files.size() > 1),
+         is_first = true;
+    if (opts.files.empty())
+    {
+      opts.files.emplace_back("-");
+    }
+    int status = EXIT_SUCCESS;
+
+    for (std::string_view file_name : opts.files)
+    {
+      std::string_view shown_name = (file_name == "-") ? "standard input" : file_name;
+      std::unique_ptr<text_input> input = open_input(file_name, is);
+      if (!input->is_open())
+      {
+        std::cerr << name << ": cannot open " << quote(shown_name) << " for reading: "
+                  << strerror(input->get_error()) << std::endl;
+        status = EXIT_FAILURE;
+        continue;
+      }
+
+      if (with_headers)
+      {
+        os << (is_first ? "" : "\n") << "==> " << shown_name << " <==\n";
+        is_first = false;
+      }
+      print_part(*input);
+
+      if (input->get_error() != 0)
+      {
+        os.flush();
+        std::cerr << name << ": error reading " << quote(shown_name) << ": " << strerror(input->get_error()) << std::endl;
+        status = EXIT_FAILURE;
+      }
+    }
+
+    os.flush();
+    return os.good() ? status : EXIT_FAILURE;
+  }
+
+  /* Returns the start of the last 'count' lines or bytes of [begin, end).
+   * The last line counts even without trailing newline */
+  static const char *get_tail_start(const char *begin, const char *end, const part_options &opts)
+  {
+    if (opts.bytes)
+    {
+      return end - std::min<uintmax_t>(opts.count, end - begin);
+    }
+    if (opts.count == 0)
+    {
+      return end;
+    }
+
+    const char *pos = (end > begin && end[-1] == '\n') ? end - 1 : end;
+    for (uintmax_t lines = 0; pos > begin;)
+    {
+      const char *newline = (const char *)memrchr(begin, '\n', pos - begin);
+      if (newline == nullptr || ++lines == opts.count)
+      {
+        return (newline == nullptr) ? begin : newline + 1;
+      }
+      pos = newline;
+    }
+    return begin;
+  }
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * cut functions
+   **********************************************************************/
+
+  /* Parses 'cut' arguments. Returns false for unsupported ones */
+  static bool parse_cut_options(const flat_argv &args, cut_options &opts)
+  {
+    bool has_delimiter = false;
+    bool is_parsed = parse_options(args, "bcfd", opts.files, [&opts, &has_delimiter](char option, std::string_view value)
+    {
+      switch (option)
+      {
+        case 'b':
+        case 'c':
+        case 'f':
+          if (opts.mode != 0)
+          {
+            return false;
+          }
+          opts.mode = (option == 'f') ? 'f' : 'b';
+          return parse_cut_list(value, opts.ranges);
+
+        case 'd':
+          opts.delimiter = value.empty() ? '\n' : value[0];
+          has_delimiter = true;
+          return value.size() == 1;
+
+        case 's': opts.only_delimited = true; return true;
+        case 'n':                             return true;
+        default:                              return false;
+      }
+    });
+
+    return is_parsed && opts.mode != 0 && opts.delimiter != '\n' &&
+           (opts.mode == 'f' || (!has_delimiter && !opts.only_delimited));
+  }
+
+  /* Parses list of positions into sorted disjoint ranges. Returns false if list is invalid */
+  static bool parse_cut_list(std::string_view list, std::vector<std::pair<size_t, size_t>> &ranges)
+  {
+    while (!list.empty())
+    {
+      size_t comma = list.find(',');
+      std::string_view item = list.substr(0, comma);
+      list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+
+      size_t dash = item.find('-');
+      uintmax_t low = 1, high = SIZE_MAX;
+      std::string_view low_text = item.substr(0, dash),
+                       high_text = (dash == std::string_view::npos) ? low_text : item.substr(dash + 1);
+
+      if ((low_text.empty() && high_text.empty()) ||
+          (!low_text.empty() && (!parse_count(low_text, low) || low == 0)) ||
+          (!high_text.empty() && (!parse_count(high_text, high) || high < low)))
+      {
+        return false;
+      }
+      ranges.emplace_back(low, high);
+    }
+
+    if (ranges.empty())
+    {
+      return false;
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); i++)
+    {
+      if (ranges[i].first <= ranges[merged].second + (ranges[merged].second < SIZE_MAX))
+      {
+        ranges[merged].second = std::max(ranges[merged].second, ranges[i].second);
+      }
+      else
+      {
+        ranges[++merged] = ranges[i];
+      }
+    }
+    ranges.resize(merged + 1);
+    return true;
+  }
+
+  /* Checks if 1-based position is selected */
+  static bool is_selected(const cut_options &opts, size_t position)
+  {
+    for (const auto &range : opts.ranges)
+    {
+      if (position < range.first)
+      {
+        return false;
+      }
+      if (position <= range.second)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* Prints selected bytes of every line of the block */
+  static void cut_bytes(const char *begin, const char *end, const cut_options &opts, std::ostream &os)
+  {
+    for (const char *line = begin; line < end;)
+    {
+      const char *line_end = text_scan::find_byte(line, end, '\n');
+      size_t size = line_end - line;
+
+      for (const auto &range : opts.ranges)
+      {
+        if (range.first > size)
+        {
+          break;
+        }
+        os.write(line + range.first - 1, std::min(range.second, size) - range.first + 1);
+      }
+      os << '\n';
+      line = (line_end < end) ? line_end + 1 : end;
+    }
+  }
+
+  /* Prints selected fields of every line of the block. Fields and line ends are found by one scan */
+  static void cut_fields(const char *begin, const char *end, const cut_options &opts, std::ostream &os)
+  {
+    size_t last_field = opts.ranges.back().second;
+
+    for (const char *line = begin; line < end;)
+    {
+      const char *field = line, *stop;
+      size_t field_number = 1;
+      bool has_delimiter = false, is_printed = false;
+
+      while ((stop = text_scan::find_either(field, end, opts.delimiter, '\n')) < end && *stop == opts.delimiter)
+      {
+        has_delimiter = true;
+        if (is_selected(opts, field_number))
+        {
+          if (is_printed)
+          {
+            os << opts.delimiter;
+          }
+          os.write(field, stop - field);
+          is_printed = true;
+        }
+        field = stop + 1;
+
+        if (++field_number > last_field)
+        {
+          // the rest of the line is not selected
+          stop = text_scan::find_byte(field, end, '\n');
+          break;
+        }
+      }
+
+      if (!has_delimiter)
+      {
+        if (!opts.only_delimited)
+        {
+          os.write(line, stop - line);
+          os << '\n';
+        }
+      }
+      else
+      {
+        if (field_number <= last_field && is_selected(opts, field_number))
+        {
+          if (is_printed)
+          {
+            os << opts.delimiter;
+          }
+          os.write(field, stop - field);
+        }
+        os << '\n';
+      }
+
+      line = (stop < end) ? stop + 1 : end;
+    }
+  }
+
+  /**********************************************************************/
+};
+
+#endif //MICROSHA_TEXT_BUILTINS_H
@@ -0,0 +1,248 @@
+#ifndef MICROSHA_TEXT_INPUT_H
+#define MICROSHA_TEXT_INPUT_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#include <istream>
+#include <vector>
+#include <algorithm>
+
+#include "fd_stream.h"
+#include "text_scan.h"
+
+#define TEXT_INPUT_CHUNK_SIZE (1 << 16)
+
+/* One input of a text builtin: named file or the stage input stream.
+ * Regular file - a named one or the one redirected with '<' to the stage input - is mapped to memory
+ * and given away without copying. Other inputs (pipes, rings, terminals) are read by chunks.
+ * Data is taken either by arbitrary chunks ('next_chunk') or by blocks of whole lines ('next_lines'),
+ * the last line of input may have no trailing newline. Read error finishes input, 'get_error' tells it */
+class text_input
+{
+private:
+  int fd = -1;                // descriptor of named file
+  std::istream *is = nullptr; // stage input if it is not mapped
+  const char *map = nullptr;  // mapped file
+  size_t map_size = 0;
+  size_t map_pos = 0;         // the first byte not given away yet
+  bool is_mapped = false;
+  std::vector<char> buffer;   // read data, bytes [line_end, buffer_end) are the incomplete line
+  size_t line_end = 0, buffer_end = 0;
+  int error = 0;
+
+public:
+  /* Class constructor. Opens file, 'get_error' tells why it could not be opened */
+  explicit text_input(const char *file_name)
+  {
+    fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      error = errno;
+      return;
+    }
+
+    if (!map_file(fd, 0))
+    {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+  }
+
+  /* Class constructor. Reads the stream. Regular file behind 'fd_istream' is mapped from its current offset */
+  explicit text_input(std::istream &input)
+  {
+    auto *fd_input = dynamic_cast<fd_istream *>(&input);
+    if (fd_input != nullptr && fd_input->get_fd() != -1 && input.rdbuf()->in_avail() == 0)
+    {
+      off_t offset = lseek(fd_input->get_fd(), 0, SEEK_CUR);
+      if (offset != -1 && map_file(fd_input->get_fd(), (size_t)offset))
+      {
+        return;
+      }
+    }
+    is = &input;
+  }
+
+  /* Class destructor. Unmaps and closes the file */
+  ~text_input()
+  {
+    if (map != nullptr)
+    {
+      munmap((void *)map, map_size);
+    }
+    if (fd != -1)
+    {
+      close(fd);
+    }
+  }
+
+  text_input(const text_input &) = delete;
+  text_input &operator=(const text_input &) = delete;
+
+  /* Checks if input was opened */
+  bool is_open() const
+  {
+    return is_mapped || fd != -1 || is != nullptr;
+  }
+
+  /* Returns errno of failed open or read, 0 if there was none */
+  int get_error() const
+  {
+    return error;
+  }
+
+  /* Checks if input is a mapped file: 'next_chunk' gives all of it at once */
+  bool is_memory() const
+  {
+    return is_mapped;
+  }
+
+  /* Gives the next chunk of input. Returns false at the end of input */
+  bool next_chunk(const char *&begin, const char *&end)
+  {
+    if (is_mapped)
+    {
+      begin = map + map_pos;
+      end = map + map_size;
+      map_pos = map_size;
+      return begin < end;
+    }
+
+    if (buffer.empty())
+    {
+      buffer.resize(TEXT_INPUT_CHUNK_SIZE);
+    }
+    size_t size = read_some(buffer.data(), buffer.size());
+    begin = buffer.data();
+    end = begin + size;
+    return size > 0;
+  }
+
+  /* Returns bytes of mapped file from 'pos' to the end of the last given chunk to input, so they are given again */
+  void unread(const char *pos)
+  {
+    if (is_mapped && pos >= map && pos < map + map_pos)
+    {
+      map_pos = pos - map;
+    }
+  }
+
+  /* Gives the next block of whole lines: the block ends with newline or at the end of input.
+   * Mapped file is split into blocks of about 'block_size' bytes. Returns false at the end of input */
+  bool next_lines(const char *&begin, const char *&end, size_t block_size = SIZE_MAX)
+  {
+    if (is_mapped)
+    {
+      if (map_pos >= map_size)
+      {
+        return false;
+      }
+
+      const char *block_end = map + map_size;
+      if (map_size - map_pos > block_size)
+      {
+        const char *line = (const char *)memrchr(map + map_pos, '\n', block_size);
+        block_end = (line != nullptr) ? line + 1 : text_scan::find_byte(map + map_pos + block_size, block_end, '\n') + 1;
+        block_end = std::min(block_end, map + map_size);
+      }
+
+      begin = map + map_pos;
+      end = block_end;
+      map_pos = block_end - map;
+      return true;
+    }
+
+    // incomplete line of the previous block is moved to the buffer start
+    size_t kept = buffer_end - line_end;
+    memmove(buffer.data(), buffer.data() + line_end, kept);
+    line_end = 0;
+    buffer_end = kept;
+
+    while (true)
+    {
+      if (buffer.size() - buffer_end < TEXT_INPUT_CHUNK_SIZE)
+      {
+        buffer.resize(std::max<size_t>(buffer.size() * 2, buffer_end + TEXT_INPUT_CHUNK_SIZE));
+      }
+
+      size_t size = read_some(buffer.data() + buffer_end, buffer.size() - buffer_end);
+      if (size == 0)
+      {
+        // end of input: the rest is the last line
+        begin = buffer.data();
+        end = begin + buffer_end;
+        line_end = buffer_end;
+        return buffer_end > 0;
+      }
+
+      const char *line = (const char *)memrchr(buffer.data() + buffer_end, '\n', size);
+      buffer_end += size;
+      if (line != nullptr)
+      {
+        line_end = line + 1 - buffer.data();
+        begin = buffer.data();
+        end = begin + line_end;
+        return true;
+      }
+    }
+  }
+
+private:
+  /* Maps regular file from 'offset' to its end. Returns false if the file can not be mapped */
+  bool map_file(int map_fd, size_t offset)
+  {
+    struct stat st{};
+    if (fstat(map_fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < offset)
+    {
+      return false;
+    }
+
+    if (st.st_size > 0)
+    {
+      void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, map_fd, 0);
+      if (data == MAP_FAILED)
+      {
+        return false;
+      }
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      map = (const char *)data;
+    }
+
+    map_size = st.st_size;
+    map_pos = offset;
+    is_mapped = true;
+    return true;
+  }
+
+  /* Reads at most 'size' bytes with one read. Returns 0 at the end of input or on error */
+  size_t read_some(char *data, size_t size)
+  {
+    if (is != nullptr)
+    {
+      std::streambuf *buf = is->rdbuf();
+      if (std::istream::traits_type::eq_int_type(buf->sgetc(), std::istream::traits_type::eof()))
+      {
+        return 0;
+      }
+      return (size_t)buf->sgetn(data, std::min<std::streamsize>(buf->in_avail(), (std::streamsize)size));
+    }
+
+    ssize_t read_size;
+    while ((read_size = read(fd, data, size)) == -1 && errno == EINTR)
+    {
+    }
+    if (read_size == -1)
+    {
+      error = errno;
+      return 0;
+    }
+    return (size_t)read_size;
+  }
+};
+
+#endif //MICROSHA_TEXT_INPUT_H
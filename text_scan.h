@@ -0,0 +1,442 @@
+#ifndef MICROSHA_TEXT_SCAN_H
+#define MICROSHA_TEXT_SCAN_H
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TEXT_SCAN_X86
+#endif
+
+/* Enumeration for instruction sets of scanning kernels */
+enum text_scan_level
+{
+  SCAN_SCALAR, // portable byte loops and libc
+  SCAN_SSE42,  // 16-byte vectors
+  SCAN_AVX2    // 32-byte vectors
+};
+
+/* Byte scanning kernels of text builtins: counting a byte (newlines) and words, finding one of two bytes
+ * (delimiter or newline), finding a fixed string and finding the first non-ASCII byte.
+ * Vector versions are compiled for their instruction set with target attributes, so the shell runs on any
+ * x86-64 processor: the best set supported by the processor is chosen once at the first call.
+ * 'MICROSHA_SIMD' environment variable ('scalar', 'sse4.2' or 'avx2') limits the choice.
+ * Ranges are [begin, end); functions returning a pointer return 'end' if nothing is found */
+class text_scan
+{
+private:
+  /* Kernels of one instruction set */
+  struct kernels
+  {
+    text_scan_level level;
+    size_t (*count_byte)(const char *begin, const char *end, char c);
+    const char *(*find_either)(const char *begin, const char *end, char a, char b);
+    const char *(*find_string)(const char *begin, const char *end, const char *needle, size_t needle_size);
+    const char *(*find_non_ascii)(const char *begin, const char *end);
+    size_t (*count_words)(const char *begin, const char *end, bool &in_word);
+  };
+
+public:
+  /* Returns number of bytes equal to 'c' */
+  static size_t count_byte(const char *begin, const char *end, char c)
+  {
+    return get_kernels().count_byte(begin, end, c);
+  }
+
+  /* Returns the first byte equal to 'c' */
+  static const char *find_byte(const char *begin, const char *end, char c)
+  {
+    const void *found = memchr(begin, c, end - begin); // libc version is vectorized already
+    return (found == nullptr) ? end : (const char *)found;
+  }
+
+  /* Returns the first byte equal to 'a' or 'b' */
+  static const char *find_either(const char *begin, const char *end, char a, char b)
+  {
+    return get_kernels().find_either(begin, end, a, b);
+  }
+
+  /* Returns the first occurrence of 'needle'. Empty needle is found at 'begin' */
+  static const char *find_string(const char *begin, const char *end, std::string_view needle)
+  {
+    if (needle.empty())
+    {
+      return begin;
+    }
+    if (needle.size() == 1)
+    {
+      return find_byte(begin, end, needle[0]);
+    }
+    return get_kernels().find_string(begin, end, needle.data(), needle.size());
+  }
+
+  /* Returns the first byte with the high bit set */
+  static const char *find_non_ascii(const char *begin, const char *end)
+  {
+    return get_kernels().find_non_ascii(begin, end);
+  }
+
+  /* Returns number of words starting in the range as 'wc' counts them in C locale: a word starts with
+   * a printable character after white space. Other bytes do not change the state.
+   * 'in_word' tells if the range continues a word and is updated for the next range */
+  static size_t count_words(const char *begin, const char *end, bool &in_word)
+  {
+    return get_kernels().count_words(begin, end, in_word);
+  }
+
+  /* Returns instruction set of used kernels */
+  static text_scan_level get_level()
+  {
+    return get_kernels().level;
+  }
+
+  /* Returns name of instruction set */
+  static const char *get_level_name(text_scan_level level)
+  {
+    switch (level)
+    {
+      case SCAN_AVX2:  return "avx2";
+      case SCAN_SSE42: return "sse4.2";
+      default:         return "scalar";
+    }
+  }
+
+  /* Uses kernels of given instruction set, or the best supported one below it. For benchmarks */
+  static void set_level(text_scan_level level)
+  {
+    get_kernels() = select_kernels(level);
+  }
+
+private:
+  /* Returns kernels chosen at the first call */
+  static kernels &get_kernels()
+  {
+    static kernels chosen = select_kernels(get_env_level());
+    return chosen;
+  }
+
+  /* Reads the highest allowed instruction set from the environment */
+  static text_scan_level get_env_level()
+  {
+    const char *name = getenv("MICROSHA_SIMD");
+    if (name == nullptr)                 { return SCAN_AVX2;   }
+    if (strcmp(name, "scalar") == 0)     { return SCAN_SCALAR; }
+    if (strcmp(name, "sse4.2") == 0)     { return SCAN_SSE42;  }
+    return SCAN_AVX2;
+  }
+
+  /* Returns kernels of the best instruction set not above 'level' supported by the processor */
+  static kernels select_kernels(text_scan_level level)
+  {
+#ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (level >= SCAN_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+      return {SCAN_AVX2, count_byte_avx2, find_either_avx2, find_string_avx2, find_non_ascii_avx2,
+              count_words_avx2};
+    }
+    if (level >= SCAN_SSE42 && __builtin_cpu_supports("sse4.2"))
+    {
+      return {SCAN_SSE42, count_byte_sse42, find_either_sse42, find_string_sse42, find_non_ascii_sse42,
+              count_words_sse42};
+    }
+#endif
+    return {SCAN_SCALAR, count_byte_scalar, find_either_scalar, find_string_scalar, find_non_ascii_scalar,
+            count_words_scalar};
+  }
+
+  /**********************************************************************
+   * Scalar kernels. They also finish the tails shorter than a vector
+   **********************************************************************/
+
+  static size_t count_byte_scalar(const char *begin, const char *end, char c)
+  {
+    size_t count = 0;
+    for (; begin < end; begin++)
+    {
+      count += (*begin == c);
+    }
+    return count;
+  }
+
+  static const char *find_either_scalar(const char *begin, const char *end, char a, char b)
+  {
+    for (; begin < end && *begin != a && *begin != b; begin++)
+    {
+    }
+    return begin;
+  }
+
+  static const char *find_string_scalar(const char *begin, const char *end, const char *needle, size_t needle_size)
+  {
+    const void *found = memmem(begin, end - begin, needle, needle_size);
+    return (found == nullptr) ? end : (const char *)found;
+  }
+
+  static const char *find_non_ascii_scalar(const char *begin, const char *end)
+  {
+    for (; begin < end && (unsigned char)*begin < 0x80; begin++)
+    {
+    }
+    return begin;
+  }
+
+  static size_t count_words_scalar(const char *begin, const char *end, bool &in_word)
+  {
+    size_t words = 0;
+    for (; begin < end; begin++)
+    {
+      unsigned char c = *begin;
+      if (c == ' ' || (c >= '\t' && c <= '\r'))
+      {
+        in_word = false;
+      }
+      else if (c > ' ' && c < 0x7F)
+      {
+        words += !in_word;
+        in_word = true;
+      }
+    }
+    return words;
+  }
+
+  /**********************************************************************/
+
+#ifdef TEXT_SCAN_X86
+  /**********************************************************************
+   * AVX2 kernels
+   **********************************************************************/
+
+  /* Equal bytes are counted in 8-bit lanes (at most 255 vectors), which are summed up by 'sad' */
+  __attribute__((target("avx2")))
+  static size_t count_byte_avx2(const char *begin, const char *end, char c)
+  {
+    const __m256i pattern = _mm256_set1_epi8(c), zero = _mm256_setzero_si256();
+    __m256i total = zero;
+
+    while (end - begin >= 32)
+    {
+      __m256i lanes = zero;
+      for (int i = 0; i < 255 && end - begin >= 32; i++, begin += 32)
+      {
+        __m256i block = _mm256_loadu_si256((const __m256i *)begin);
+        lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(block, pattern));
+      }
+      total = _mm256_add_epi64(total, _mm256_sad_epu8(lanes, zero));
+    }
+
+    size_t count = (size_t)_mm256_extract_epi64(total, 0) + (size_t)_mm256_extract_epi64(total, 1) +
+                   (size_t)_mm256_extract_epi64(total, 2) + (size_t)_mm256_extract_epi64(total, 3);
+    return count + count_byte_scalar(begin, end, c);
+  }
+
+  __attribute__((target("avx2")))
+  static const char *find_either_avx2(const char *begin, const char *end, char a, char b)
+  {
+    const __m256i first = _mm256_set1_epi8(a), second = _mm256_set1_epi8(b);
+
+    for (; end - begin >= 32; begin += 32)
+    {
+      __m256i block = _mm256_loadu_si256((const __m256i *)begin);
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, first),
+                                                                     _mm256_cmpeq_epi8(block, second)));
+      if (mask != 0)
+      {
+        return begin + __builtin_ctz(mask);
+      }
+    }
+    return find_either_scalar(begin, end, a, b);
+  }
+
+  /* Positions where both the first and the last needle bytes match are found for 32 positions at once,
+   * only they are compared completely */
+  __attribute__((target("avx2")))
+  static const char *find_string_avx2(const char *begin, const char *end, const char *needle, size_t needle_size)
+  {
+    const __m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[needle_size - 1]);
+    const char *pos = begin;
+
+    for (; end - pos >= (ptrdiff_t)(needle_size + 31); pos += 32)
+    {
+      __m256i block_first = _mm256_loadu_si256((const __m256i *)pos),
+              block_last = _mm256_loadu_si256((const __m256i *)(pos + needle_size - 1));
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                                                      _mm256_cmpeq_epi8(block_last, last)));
+      for (; mask != 0; mask &= mask - 1)
+      {
+        const char *candidate = pos + __builtin_ctz(mask);
+        if (memcmp(candidate + 1, needle + 1, needle_size - 2) == 0)
+        {
+          return candidate;
+        }
+      }
+    }
+    return find_string_scalar(pos, end, needle, needle_size);
+  }
+
+  __attribute__((target("avx2")))
+  static const char *find_non_ascii_avx2(const char *begin, const char *end)
+  {
+    for (; end - begin >= 32; begin += 32)
+    {
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)begin));
+      if (mask != 0)
+      {
+        return begin + __builtin_ctz(mask);
+      }
+    }
+    return find_non_ascii_scalar(begin, end);
+  }
+  /* Vectors of white space and printable characters only are counted at once:
+   * word starts are printable characters whose previous byte is white space */
+  __attribute__((target("avx2,popcnt")))
+  static size_t count_words_avx2(const char *begin, const char *end, bool &in_word)
+  {
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), ctrl_span = _mm256_set1_epi8('\r' - '\t'),
+                  graph_first = _mm256_set1_epi8('!'), graph_span = _mm256_set1_epi8('~' - '!');
+    size_t words = 0;
+
+    for (; end - begin >= 32; begin += 32)
+    {
+      __m256i block = _mm256_loadu_si256((const __m256i *)begin),
+              ctrl = _mm256_sub_epi8(block, tab),
+              graph = _mm256_sub_epi8(block, graph_first);
+      __m256i is_space = _mm256_or_si256(_mm256_cmpeq_epi8(block, space),
+                                         _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, ctrl_span), ctrl)),
+              is_graph = _mm256_cmpeq_epi8(_mm256_min_epu8(graph, graph_span), graph);
+
+      if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(is_space, is_graph)) != 0xFFFFFFFFu)
+      {
+        words += count_words_scalar(begin, begin + 32, in_word);
+        continue;
+      }
+
+      uint32_t graph_mask = (uint32_t)_mm256_movemask_epi8(is_graph);
+      words += (size_t)__builtin_popcount(graph_mask & ~((graph_mask << 1) | (uint32_t)in_word));
+      in_word = (graph_mask >> 31) != 0;
+    }
+    return words + count_words_scalar(begin, end, in_word);
+  }
+
+
+  /**********************************************************************/
+
+  /**********************************************************************
+   * SSE4.2 kernels. The same algorithms on 16-byte vectors
+   **********************************************************************/
+
+  __attribute__((target("sse4.2")))
+  static size_t count_byte_sse42(const char *begin, const char *end, char c)
+  {
+    const __m128i pattern = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+    __m128i total = zero;
+
+    while (end - begin >= 16)
+    {
+      __m128i lanes = zero;
+      for (int i = 0; i < 255 && end - begin >= 16; i++, begin += 16)
+      {
+        __m128i block = _mm_loadu_si128((const __m128i *)begin);
+        lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(block, pattern));
+      }
+      total = _mm_add_epi64(total, _mm_sad_epu8(lanes, zero));
+    }
+
+    size_t count = (size_t)_mm_extract_epi64(total, 0) + (size_t)_mm_extract_epi64(total, 1);
+    return count + count_byte_scalar(begin, end, c);
+  }
+
+  __attribute__((target("sse4.2")))
+  static const char *find_either_sse42(const char *begin, const char *end, char a, char b)
+  {
+    const __m128i first = _mm_set1_epi8(a), second = _mm_set1_epi8(b);
+
+    for (; end - begin >= 16; begin += 16)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i *)begin);
+      uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, first),
+                                                               _mm_cmpeq_epi8(block, second)));
+      if (mask != 0)
+      {
+        return begin + __builtin_ctz(mask);
+      }
+    }
+    return find_either_scalar(begin, end, a, b);
+  }
+
+  __attribute__((target("sse4.2")))
+  static const char *find_string_sse42(const char *begin, const char *end, const char *needle, size_t needle_size)
+  {
+    const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[needle_size - 1]);
+    const char *pos = begin;
+
+    for (; end - pos >= (ptrdiff_t)(needle_size + 15); pos += 16)
+    {
+      __m128i block_first = _mm_loadu_si128((const __m128i *)pos),
+              block_last = _mm_loadu_si128((const __m128i *)(pos + needle_size - 1));
+      uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                                _mm_cmpeq_epi8(block_last, last)));
+      for (; mask != 0; mask &= mask - 1)
+      {
+        const char *candidate = pos + __builtin_ctz(mask);
+        if (memcmp(candidate + 1, needle + 1, needle_size - 2) == 0)
+        {
+          return candidate;
+        }
+      }
+    }
+    return find_string_scalar(pos, end, needle, needle_size);
+  }
+
+  __attribute__((target("sse4.2")))
+  static const char *find_non_ascii_sse42(const char *begin, const char *end)
+  {
+    for (; end - begin >= 16; begin += 16)
+    {
+      uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)begin));
+      if (mask != 0)
+      {
+        return begin + __builtin_ctz(mask);
+      }
+    }
+    return find_non_ascii_scalar(begin, end);
+  }
+  __attribute__((target("sse4.2,popcnt")))
+  static size_t count_words_sse42(const char *begin, const char *end, bool &in_word)
+  {
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), ctrl_span = _mm_set1_epi8('\r' - '\t'),
+                  graph_first = _mm_set1_epi8('!'), graph_span = _mm_set1_epi8('~' - '!');
+    size_t words = 0;
+
+    for (; end - begin >= 16; begin += 16)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i *)begin),
+              ctrl = _mm_sub_epi8(block, tab),
+              graph = _mm_sub_epi8(block, graph_first);
+      __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(block, space),
+                                      _mm_cmpeq_epi8(_mm_min_epu8(ctrl, ctrl_span), ctrl)),
+              is_graph = _mm_cmpeq_epi8(_mm_min_epu8(graph, graph_span), graph);
+
+      if ((uint32_t)_mm_movemask_epi8(_mm_or_si128(is_space, is_graph)) != 0xFFFFu)
+      {
+        words += count_words_scalar(begin, begin + 16, in_word);
+        continue;
+      }
+
+      uint32_t graph_mask = (uint32_t)_mm_movemask_epi8(is_graph);
+      words += (size_t)__builtin_popcount(graph_mask & ~((graph_mask << 1) | (uint32_t)in_word) & 0xFFFFu);
+      in_word = (graph_mask >> 15) != 0;
+    }
+    return words + count_words_scalar(begin, end, in_word);
+  }
+
+
+  /**********************************************************************/
+#endif
+};
+
+#endif //MICROSHA_TEXT_SCAN_H
@@ -0,0 +1 @@
+#include "time_report.h"
@@ -0,0 +1,367 @@
+#ifndef MICROSHA_TIME_REPORT_H
+#define MICROSHA_TIME_REPORT_H
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <ctime>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iostream>
+
+#include "job_table.h"
+#include "perf_counters.h"
+
+#define TIME_REPORT_NAME_WIDTH 20
+
+/* Output formats of 'time' builtin */
+enum time_format
+{
+  TIME_SHORT,   // real, user and sys time of the whole pipeline
+  TIME_VERBOSE, // '-v': short report and the table of pipeline stages
+  TIME_JSON     // '--json': everything as one JSON object
+};
+
+/* Measurements of one pipeline run by 'time' */
+struct time_measure
+{
+  double real = 0, user = 0, sys = 0; // seconds, user and sys time of the shell and its reaped children
+  int status = 0;                     // pipeline exit status
+  std::vector<std::string> names;     // command lines of the stages
+  std::vector<stage_usage> stages;    // resource usage of the stages, empty if pipeline was not waited for
+  std::vector<int> stage_status;
+  bool is_counted = false;            // perf_event counters were collected ('-c')
+  perf_values counters;               // counters of the whole pipeline
+};
+
+/* Printing of 'time' results */
+class time_report
+{
+public:
+  /* Prints measurements in the given format */
+  static void print(std::ostream &os, const time_measure &measure, time_format format)
+  {
+    if (format == TIME_JSON)
+    {
+      print_json(os, measure);
+      return;
+    }
+
+    print_short(os, measure);
+    if (measure.is_counted)
+    {
+      print_counters(os, measure.counters);
+    }
+    if (format == TIME_VERBOSE)
+    {
+      print_table(os, measure);
+      if (measure.is_counted)
+      {
+        print_counter_table(os, measure);
+      }
+    }
+  }
+
+  /* Returns seconds between two monotonic time points */
+  static double get_seconds(const timespec &from, const timespec &to)
+  {
+    return (double)(to.tv_sec - from.tv_sec) + (double)(to.tv_nsec - from.tv_nsec) * 1e-9;
+  }
+
+  /* Returns seconds of 'rusage' time */
+  static double get_seconds(const timeval &time)
+  {
+    return (double)time.tv_sec + (double)time.tv_usec * 1e-6;
+  }
+
+  /* Returns usage of the current thread. 'ru_maxrss' is the peak of the whole process */
+  static rusage get_thread_usage()
+  {
+    rusage usage{};
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage;
+  }
+
+  /* Subtracts counters of 'before' from 'after'. Maximum RSS is kept as is */
+  static rusage get_usage_diff(const rusage &after, const rusage &before)
+  {
+    rusage diff = after;
+
+    timersub(&after.ru_utime, &before.ru_utime, &diff.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &diff.ru_stime);
+    diff.ru_nvcsw   -= before.ru_nvcsw;
+    diff.ru_nivcsw  -= before.ru_nivcsw;
+    diff.ru_inblock -= before.ru_inblock;
+    diff.ru_oublock -= before.ru_oublock;
+
+    return diff;
+  }
+
+  /* Writes string as JSON string literal */
+  static void write_json_string(std::ostream &os, std::string_view str)
+  {
+    os << '"';
+    for (unsigned char c : str)
+    {
+      if (c == '"' || c == '\\')
+      {
+        os << '\\' << c;
+      }
+      else if (c < 0x20)
+      {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        os << escaped;
+      }
+      else
+      {
+        os << c;
+      }
+    }
+    os << '"';
+  }
+
+private:
+  /* Prints real, user and sys time of the pipeline */
+  static void print_short(std::ostream &os, const time_measure &measure)
+  {
+    char line[128];
+
+    snprintf(line, sizeof(line), "real : %.3fs\nuser : %.3fs\nsys  : %.3fs\n", measure.real, measure.user, measure.sys);
+    os << line;
+  }
+
+  /* Prints pipeline counters one per line. Instructions are followed by instructions per cycle,
+   * misses - by their number per thousand instructions */
+  static void print_counters(std::ostream &os, const perf_values &counters)
+  {
+    char line[128];
+
+    os << std::endl;
+    for (int i = 0; i < PERF_EVENT_NUM; i++)
+    {
+      auto id = (perf_event_id)i;
+      const char *name = perf_counters::get_event_name(id);
+
+      if (!counters.is_counted[i])
+      {
+        snprintf(line, sizeof(line), "%-16s : %20s\n", name, "<not supported>");
+      }
+      else if (id == PERF_TASK_CLOCK)
+      {
+        snprintf(line, sizeof(line), "%-16s : %20.3f ms\n", name, (double)counters.values[i] * 1e-6);
+      }
+      else if (id == PERF_INSTRUCTIONS && counters.is_counted[PERF_CYCLES] && counters.values[PERF_CYCLES] > 0)
+      {
+        snprintf(line, sizeof(line), "%-16s : %20llu    # %.2f per cycle\n", name, (unsigned long long)counters.values[i],
+                 (double)counters.values[i] / (double)counters.values[PERF_CYCLES]);
+      }
+      else if ((id == PERF_CACHE_MISSES || id == PERF_BRANCH_MISSES) &&
+               counters.is_counted[PERF_INSTRUCTIONS] && counters.values[PERF_INSTRUCTIONS] > 0)
+      {
+        snprintf(line, sizeof(line), "%-16s : %20llu    # %.2f per 1000 instructions\n", name,
+                 (unsigned long long)counters.values[i],
+                 (double)counters.values[i] * 1e3 / (double)counters.values[PERF_INSTRUCTIONS]);
+      }
+      else
+      {
+        snprintf(line, sizeof(line), "%-16s : %20llu\n", name, (unsigned long long)counters.values[i]);
+      }
+      os << line;
+    }
+
+    if (counters.is_scaled)
+    {
+      os << "(counters were multiplexed, values are scaled estimates)" << std::endl;
+    }
+    if (counters.is_user_only)
+    {
+      os << "(kernel is not counted: perf_event_paranoid forbids it)" << std::endl;
+    }
+  }
+
+  /* Prints table of counters of pipeline stages. Counters of a process are attached after its 'exec',
+   * so a command finishing before that has none */
+  static void print_counter_table(std::ostream &os, const time_measure &measure)
+  {
+    char line[256];
+
+    snprintf(line, sizeof(line), "\n%-3s %-*s %14s %14s %6s %12s %12s %11s %11s %9s\n", "#", TIME_REPORT_NAME_WIDTH,
+             "command", "cycles", "instructions", "IPC", "cache-miss", "branch-miss", "page-fault", "task-ms", "ctx-sw");
+    os << line;
+
+    for (size_t i = 0; i < measure.stages.size(); i++)
+    {
+      const perf_values &counters = measure.stages[i].counters;
+      std::string name = get_short_name(measure, i);
+
+      snprintf(line, sizeof(line), "%-3zu %-*s", i + 1, TIME_REPORT_NAME_WIDTH, name.c_str());
+      os << line;
+
+      static const int widths[PERF_EVENT_NUM] = {14, 14, 12, 12, 11, 11, 9};
+      for (int j = 0; j < PERF_EVENT_NUM; j++)
+      {
+        if (!counters.is_counted[j])
+        {
+          snprintf(line, sizeof(line), " %*s", widths[j], "-");
+        }
+        else if (j == PERF_TASK_CLOCK)
+        {
+          snprintf(line, sizeof(line), " %*.3f", widths[j], (double)counters.values[j] * 1e-6);
+        }
+        else
+        {
+          snprintf(line, sizeof(line), " %*llu", widths[j], (unsigned long long)counters.values[j]);
+        }
+        os << line;
+
+        // instructions per cycle column follows instructions
+        if (j == PERF_INSTRUCTIONS)
+        {
+          if (counters.is_counted[PERF_CYCLES] && counters.is_counted[PERF_INSTRUCTIONS] && counters.values[PERF_CYCLES] > 0)
+          {
+            snprintf(line, sizeof(line), " %6.2f", (double)counters.values[PERF_INSTRUCTIONS] / (double)counters.values[PERF_CYCLES]);
+          }
+          else
+          {
+            snprintf(line, sizeof(line), " %6s", "-");
+          }
+          os << line;
+        }
+      }
+      os << std::endl;
+    }
+  }
+
+  /* Returns command line of stage 'i' cut to the table column width */
+  static std::string get_short_name(const time_measure &measure, size_t i)
+  {
+    std::string name = (i < measure.names.size()) ? measure.names[i] : "";
+    if (name.size() > TIME_REPORT_NAME_WIDTH)
+    {
+      name.resize(TIME_REPORT_NAME_WIDTH - 3);
+      name += "...";
+    }
+    return name;
+  }
+
+  /* Prints table of pipeline stages: times in seconds, spawn latency (from stage creation to 'exec') in ms,
+   * maximum resident set in KiB, context switches and block I/O operations */
+  static void print_table(std::ostream &os, const time_measure &measure)
+  {
+    char line[256];
+
+    snprintf(line, sizeof(line), "\n%-3s %-*s %8s %4s %9s %9s %9s %9s %10s %7s %7s %7s %7s\n",
+             "#", TIME_REPORT_NAME_WIDTH, "command", "pid", "exit", "real,s", "user,s", "sys,s", "spawn,ms",
+             "maxrss,KiB", "vcsw", "ivcsw", "inblk", "outblk");
+    os << line;
+
+    for (size_t i = 0; i < measure.stages.size(); i++)
+    {
+      const stage_usage &stage = measure.stages[i];
+      std::string name = get_short_name(measure, i);
+      std::string pid = (stage.kind == STAGE_THREAD) ? "thread" :
+                        (stage.kind == STAGE_SHELL)  ? "shell"  : std::to_string(stage.pid);
+      if (!stage.is_finished)
+      {
+        snprintf(line, sizeof(line), "%-3zu %-*s %8s %4s %9s\n", i + 1, TIME_REPORT_NAME_WIDTH, name.c_str(),
+                 pid.c_str(), "-", "not run");
+        os << line;
+        continue;
+      }
+
+      snprintf(line, sizeof(line), "%-3zu %-*s %8s %4d %9.3f %9.3f %9.3f %9.3f %10ld %7ld %7ld %7ld %7ld\n",
+               i + 1, TIME_REPORT_NAME_WIDTH, name.c_str(), pid.c_str(), get_stage_status(measure, i),
+               get_seconds(stage.start, stage.end), get_seconds(stage.usage.ru_utime), get_seconds(stage.usage.ru_stime),
+               get_seconds(stage.start, stage.ready) * 1e3, stage.usage.ru_maxrss,
+               stage.usage.ru_nvcsw, stage.usage.ru_nivcsw, stage.usage.ru_inblock, stage.usage.ru_oublock);
+      os << line;
+    }
+  }
+
+  /* Prints measurements as one JSON object line. Times are in seconds, not run stages have "pid": null.
+   * Counters are raw event counts, "task-clock" is in nanoseconds */
+  static void print_json(std::ostream &os, const time_measure &measure)
+  {
+    char number[64];
+
+    snprintf(number, sizeof(number), "%.9f", measure.real);
+    os << "{\"real\":" << number;
+    snprintf(number, sizeof(number), "%.6f", measure.user);
+    os << ",\"user\":" << number;
+    snprintf(number, sizeof(number), "%.6f", measure.sys);
+    os << ",\"sys\":" << number << ",\"status\":" << measure.status;
+    if (measure.is_counted)
+    {
+      os << ",\"counters\":";
+      write_json_counters(os, measure.counters);
+    }
+    os << ",\"stages\":[";
+
+    for (size_t i = 0; i < measure.stages.size(); i++)
+    {
+      const stage_usage &stage = measure.stages[i];
+
+      os << ((i > 0) ? ",{" : "{") << "\"command\":";
+      write_json_string(os, (i < measure.names.size()) ? measure.names[i] : "");
+      os << ",\"kind\":\"" << ((stage.kind == STAGE_THREAD) ? "thread" : (stage.kind == STAGE_SHELL) ? "shell" : "process")
+         << "\"";
+
+      if (!stage.is_finished)
+      {
+        os << ",\"pid\":null}";
+        continue;
+      }
+
+      if (stage.kind == STAGE_PROCESS)
+      {
+        os << ",\"pid\":" << stage.pid;
+      }
+      os << ",\"status\":" << get_stage_status(measure, i);
+      snprintf(number, sizeof(number), "%.9f", get_seconds(stage.start, stage.end));
+      os << ",\"real\":" << number;
+      snprintf(number, sizeof(number), "%.6f", get_seconds(stage.usage.ru_utime));
+      os << ",\"user\":" << number;
+      snprintf(number, sizeof(number), "%.6f", get_seconds(stage.usage.ru_stime));
+      os << ",\"sys\":" << number;
+      snprintf(number, sizeof(number), "%.9f", get_seconds(stage.start, stage.ready));
+      os << ",\"spawn_latency\":" << number
+         << ",\"max_rss_kb\":" << stage.usage.ru_maxrss
+         << ",\"voluntary_switches\":" << stage.usage.ru_nvcsw
+         << ",\"involuntary_switches\":" << stage.usage.ru_nivcsw
+         << ",\"in_blocks\":" << stage.usage.ru_inblock
+         << ",\"out_blocks\":" << stage.usage.ru_oublock;
+      if (measure.is_counted)
+      {
+        os << ",\"counters\":";
+        write_json_counters(os, stage.counters);
+      }
+      os << "}";
+    }
+    os << "]}" << std::endl;
+  }
+
+  /* Returns exit status of stage 'i' */
+  static int get_stage_status(const time_measure &measure, size_t i)
+  {
+    return (i < measure.stage_status.size()) ? measure.stage_status[i] : 0;
+  }
+
+  /* Writes counters as JSON object. Events which were not counted are null */
+  static void write_json_counters(std::ostream &os, const perf_values &counters)
+  {
+    os << "{";
+    for (int i = 0; i < PERF_EVENT_NUM; i++)
+    {
+      os << ((i > 0) ? ",\"" : "\"") << perf_counters::get_event_name((perf_event_id)i) << "\":";
+      if (counters.is_counted[i]) { os << counters.values[i]; }
+      else                        { os << "null";             }
+    }
+    os << ",\"scaled\":" << (counters.is_scaled ? "true" : "false")
+       << ",\"user_only\":" << (counters.is_user_only ? "true" : "false") << "}";
+  }
+};
+
+#endif //MICROSHA_TIME_REPORT_H